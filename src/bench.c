@@ -0,0 +1,135 @@
+/**
+ * \file bench.c
+ * \brief Common code of the copycat-bench-* programs.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "bench.h"
+
+/**
+ * \var static const char *bench_cfg
+ * \brief The bench configuration, formatted with the directory twice.
+ */
+static const char *bench_cfg =
+"public-server-port %d\n"
+"private-server-port %d\n"
+"source-port %d\n"
+"private-address4 10.255.255.254\n"
+"private-mask4 8\n"
+"private-address6 fd00::fffe\n"
+"private-mask6 64\n"
+"public-address4 127.0.0.1\n"
+"public-address6 ::1\n"
+"inactivity-timeout 1\n"
+"tcp-send-timeout 1\n"
+"tcp-receive-timeout 1\n"
+"initial-sleep 0\n"
+"client-dir %s\n"
+"server-file /dev/null\n"
+"output-dir %s\n"
+"io-backend fake\n"
+"buffer-length 8192\n"
+"backlog-size 10\n"
+"fd-lim 512\n"
+"tun-tcp-mss 1432\n";
+
+int bench_env_init(struct bench_env *env, int ndest, int v6) {
+   const char *tmp = getenv("TMPDIR");
+   snprintf(env->dir, STR_SIZE, "%s/copycat-bench.XXXXXX", tmp ? tmp : "/tmp");
+   if (!mkdtemp(env->dir))
+      return -1;
+   strncat(env->dir, "/", STR_SIZE - strlen(env->dir) - 1);
+   snprintf(env->cfg, STR_SIZE, "%scopycat.cfg", env->dir);
+   snprintf(env->dest, STR_SIZE, "%sdest.txt", env->dir);
+   env->ndest = ndest;
+
+   FILE *fp = fopen(env->cfg, "w");
+   if (!fp)
+      return -1;
+   fprintf(fp, bench_cfg, BENCH_SERV_PORT, BENCH_SERV_PORT + 1, BENCH_CLI_PORT,
+           env->dir, env->dir);
+   fclose(fp);
+
+   if (!(fp = fopen(env->dest, "w")))
+      return -1;
+   char priv4[INET_ADDRSTRLEN], priv6[INET6_ADDRSTRLEN];
+   for (int i = 0; i < ndest; i++) {
+      in_addr_t a4 = bench_priv4(i);
+      inet_ntop(AF_INET, &a4, priv4, sizeof(priv4));
+      if (v6) {
+         struct in6_addr a6;
+         bench_priv6(i, &a6);
+         inet_ntop(AF_INET6, &a6, priv6, sizeof(priv6));
+         fprintf(fp, "%d 127.0.0.1 %s ::1 %s\n", BENCH_SPORT + i, priv4, priv6);
+      } else
+         fprintf(fp, "%d 127.0.0.1 %s\n", BENCH_SPORT + i, priv4);
+   }
+   fclose(fp);
+   return 0;
+}
+
+void bench_env_free(struct bench_env *env) {
+   char buf[STR_SIZE];
+   unlink(env->cfg);
+   unlink(env->dest);
+   /* output files of the run */
+   const char *out[] = {"stats.mmap", "latency.txt", "threads.txt", "dest.db", NULL};
+   for (int i = 0; out[i]; i++) {
+      if (snprintf(buf, STR_SIZE, "%s%s", env->dir, out[i]) < STR_SIZE)
+         unlink(buf);
+   }
+   rmdir(env->dir);
+}
+
+void bench_args(struct bench_env *env, struct arguments *args, int mode) {
+   memset(args, 0, sizeof(struct arguments));
+   args->mode        = mode;
+   args->udp         = 1;
+   args->silent      = 1;
+   args->config_file = env->cfg;
+   args->dest_file   = env->dest;
+}
+
+uint64_t bench_now() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+in_addr_t bench_priv4(int i) {
+   return htonl((10 << 24) + i + 1);
+}
+
+void bench_priv6(int i, struct in6_addr *addr) {
+   uint32_t n = htonl(i + 1);
+   memset(addr, 0, sizeof(struct in6_addr));
+   addr->s6_addr[0] = 0xfd;
+   memcpy(&addr->s6_addr[12], &n, 4);
+}
+
+int bench_pkt4(char *buf, int len, in_addr_t daddr) {
+   in_addr_t saddr = htonl(0x0afffffe);
+   uint16_t tot = htons(len), sport = htons(BENCH_SPORT), dport = htons(9);
+   uint16_t ulen = htons(len - 20);
+   memset(buf, 0, len);
+   buf[0] = 0x45;                /* v4, 20B header */
+   memcpy(buf + 2, &tot, 2);
+   buf[8] = 64;                  /* ttl */
+   buf[9] = IPPROTO_UDP;
+   memcpy(buf + 12, &saddr, 4);
+   memcpy(buf + 16, &daddr, 4);
+   memcpy(buf + 20, &sport, 2);
+   memcpy(buf + 22, &dport, 2);
+   memcpy(buf + 24, &ulen, 2);
+   return len;
+}
+
@@ -0,0 +1,107 @@
+/**
+ * \file bench.h
+ * \brief Common code of the copycat-bench-* programs.
+ *
+ *    A bench environment is a temporary directory holding a
+ *    configuration file (udp mode, fake io backend, loopback public
+ *    addresses) and a destination file of synthetic peers, so that
+ *    init_tun_state and the forwarding loops run unprivileged.
+ *    Peer i has source port BENCH_SPORT + i, private addresses
+ *    10.0.0.0/8 + i + 1 and fd00::/64 + i + 1.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_BENCH_H
+#define UDPTUN_BENCH_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "udptun.h"
+
+/**
+ * \def BENCH_SPORT
+ * \brief The source port of the first peer.
+ */
+#define BENCH_SPORT 20000
+
+/**
+ * \def BENCH_CLI_PORT
+ * \brief The source port of the bench copycat.
+ */
+#define BENCH_CLI_PORT 19998
+
+/**
+ * \def BENCH_SERV_PORT
+ * \brief The public server port of the bench peers.
+ */
+#define BENCH_SERV_PORT 19999
+
+/**
+ * \struct bench_env
+ *	\brief A bench environment.
+ */
+struct bench_env {
+   char dir[STR_SIZE];          /*!< The temporary directory, '/' terminated */
+   char cfg[STR_SIZE];          /*!< The configuration file */
+   char dest[STR_SIZE];         /*!< The destination file */
+   int  ndest;                  /*!< The number of peers */
+};
+
+/**
+ * \fn int bench_env_init(struct bench_env *env, int ndest, int v6)
+ * \brief Create a bench environment.
+ *
+ * \param env The environment
+ * \param ndest The number of peers
+ * \param v6 Write dual stack destination lines
+ * \return 0 for success, -1 on error (errno is filled)
+ */
+int bench_env_init(struct bench_env *env, int ndest, int v6);
+
+/**
+ * \fn void bench_env_free(struct bench_env *env)
+ * \brief Remove the files of a bench environment.
+ */
+void bench_env_free(struct bench_env *env);
+
+/**
+ * \fn void bench_args(struct bench_env *env, struct arguments *args, int mode)
+ * \brief Fill program arguments (udp mode) for an environment.
+ *
+ * \param env The environment
+ * \param args The arguments
+ * \param mode CLI_MODE, SERV_MODE or FULLMESH_MODE
+ */
+void bench_args(struct bench_env *env, struct arguments *args, int mode);
+
+/**
+ * \fn uint64_t bench_now()
+ * \brief CLOCK_MONOTONIC in ns.
+ */
+uint64_t bench_now();
+
+/**
+ * \fn in_addr_t bench_priv4(int i)
+ * \brief The private IPv4 address of peer i (network order).
+ */
+in_addr_t bench_priv4(int i);
+
+/**
+ * \fn void bench_priv6(int i, struct in6_addr *addr)
+ * \brief The private IPv6 address of peer i.
+ */
+void bench_priv6(int i, struct in6_addr *addr);
+
+/**
+ * \fn int bench_pkt4(char *buf, int len, in_addr_t daddr)
+ * \brief Write an inner IPv4/UDP packet of len bytes to daddr.
+ *
+ * \return The packet length
+ */
+int bench_pkt4(char *buf, int len, in_addr_t daddr);
+
+#endif
+
@@ -0,0 +1,349 @@
+/**
+ * \file bpf.c
+ * \brief Classic BPF socket filter builder.
+ *
+ *    Raw socket filters used to be compiled by libpcap, which requires
+ *    a live handle on the device and generates link-layer offsets.
+ *    Here, programs are emitted directly with raw socket offsets:
+ *    IPv4 raw sockets see the network header, IPv6 raw sockets do not.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "bpf.h"
+#include "debug.h"
+#include "sock.h"
+
+#if defined(LINUX_OS)
+
+/**
+ * \def BPF_MAX_INSNS
+ * \brief The maximal size of a generated program.
+ */
+#define BPF_MAX_INSNS 32
+
+/**
+ * \def BPF_DROP
+ * \brief Placeholder jump target, patched to the drop instruction.
+ */
+#define BPF_DROP 0xff
+
+/**
+ * \struct bpf_key
+ *	\brief The parameters of a generated filter, used as cache key.
+ */
+struct bpf_key {
+   enum { PORT_FILTER, L45_FILTER } kind; /*!< The filter type */
+   int     family;                /*!< AF_INET or AF_INET6 */
+   int     proto;                 /*!< protocol number */
+   int     sport;                 /*!< source port or 0 */
+   int     dport;                 /*!< destination port or 0 */
+   int     offset;                /*!< l4.5 field offset */
+   int     len;                   /*!< l4.5 field size */
+   int     min_len;               /*!< minimal payload size */
+   int     port_off;              /*!< tunneled port offset */
+   int     port;                  /*!< tunneled port or 0 */
+   uint8_t field[BPF_L45_MAX];    /*!< l4.5 field value */
+};
+
+/**
+ * \struct bpf_prog
+ *	\brief A builder for filter programs.
+ */
+struct bpf_prog {
+   struct sock_filter insns[BPF_MAX_INSNS]; /*!< The instructions */
+   int len;                                 /*!< The number of instructions */
+};
+
+/**
+ * \var static struct bpf_key cache_keys[BPF_CACHE_SIZE]
+ * \brief The cached filter parameters.
+ */
+static struct bpf_key cache_keys[BPF_CACHE_SIZE];
+
+/**
+ * \var static struct sock_fprog *cache_progs[BPF_CACHE_SIZE]
+ * \brief The cached filter programs.
+ */
+static struct sock_fprog *cache_progs[BPF_CACHE_SIZE];
+
+/**
+ * \var static int cache_len
+ * \brief The number of cached programs.
+ */
+static int cache_len;
+
+/**
+ * \var static pthread_mutex_t cache_lock
+ * \brief Protects the filter cache.
+ */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \fn static void emit(struct bpf_prog *p, uint16_t code, uint32_t k,
+ *                      uint8_t jt, uint8_t jf)
+ * \brief Append an instruction to a program.
+ */
+static void emit(struct bpf_prog *p, uint16_t code, uint32_t k,
+                 uint8_t jt, uint8_t jf);
+
+/**
+ * \fn static void emit_net_header(struct bpf_prog *p, int family, int proto)
+ * \brief Check protocol and fragment offset, then load the network
+ *        header length into X.
+ */
+static void emit_net_header(struct bpf_prog *p, int family, int proto);
+
+/**
+ * \fn static struct sock_fprog *finalize(struct bpf_prog *p)
+ * \brief Append accept & drop returns, resolve jumps to drop and copy
+ *        the program to the heap.
+ */
+static struct sock_fprog *finalize(struct bpf_prog *p);
+
+/**
+ * \fn static struct sock_fprog *build(const struct bpf_key *key)
+ * \brief Generate the program described by key.
+ */
+static struct sock_fprog *build(const struct bpf_key *key);
+
+/**
+ * \fn static struct sock_fprog *lookup(const struct bpf_key *key)
+ * \brief Lookup the cache for key, build & insert on miss.
+ */
+static struct sock_fprog *lookup(const struct bpf_key *key);
+
+void emit(struct bpf_prog *p, uint16_t code, uint32_t k,
+          uint8_t jt, uint8_t jf) {
+   if (p->len >= BPF_MAX_INSNS) {
+      errno=E2BIG;
+      die("bpf program");
+   }
+   struct sock_filter insn = BPF_JUMP(code, k, jt, jf);
+   p->insns[p->len++] = insn;
+}
+
+void emit_net_header(struct bpf_prog *p, int family, int proto) {
+   if (family == AF_INET6) {
+      /* no network header on IPv6 raw sockets */
+      emit(p, BPF_LDX|BPF_IMM, 0, 0, 0);
+      return;
+   }
+   /* ip proto */
+   emit(p, BPF_LD|BPF_B|BPF_ABS, 9, 0, 0);
+   emit(p, BPF_JMP|BPF_JEQ|BPF_K, proto, 0, BPF_DROP);
+   /* first fragment only */
+   emit(p, BPF_LD|BPF_H|BPF_ABS, 6, 0, 0);
+   emit(p, BPF_JMP|BPF_JSET|BPF_K, 0x1fff, BPF_DROP, 0);
+   /* X = ip header length */
+   emit(p, BPF_LDX|BPF_B|BPF_MSH, 0, 0, 0);
+}
+
+struct sock_fprog *finalize(struct bpf_prog *p) {
+   emit(p, BPF_RET|BPF_K, 0xffffffff, 0, 0);
+   emit(p, BPF_RET|BPF_K, 0, 0, 0);
+
+   /* resolve drop jumps */
+   int drop = p->len - 1;
+   for (int i = 0; i < drop; i++) {
+      struct sock_filter *insn = &p->insns[i];
+      if (BPF_CLASS(insn->code) != BPF_JMP)
+         continue;
+      if (insn->jt == BPF_DROP)
+         insn->jt = drop - i - 1;
+      if (insn->jf == BPF_DROP)
+         insn->jf = drop - i - 1;
+   }
+
+   struct sock_fprog *fprog = xmalloc(sizeof(struct sock_fprog));
+   fprog->len    = p->len;
+   fprog->filter = xmalloc(p->len * sizeof(struct sock_filter));
+   memcpy(fprog->filter, p->insns, p->len * sizeof(struct sock_filter));
+   return fprog;
+}
+
+struct sock_fprog *build(const struct bpf_key *key) {
+   struct bpf_prog p;
+   p.len = 0;
+
+   emit_net_header(&p, key->family, key->proto);
+
+   /* port filter */
+   if (key->kind == PORT_FILTER) {
+      if (key->sport) {
+         emit(&p, BPF_LD|BPF_H|BPF_IND, 0, 0, 0);
+         emit(&p, BPF_JMP|BPF_JEQ|BPF_K, key->sport, 0, BPF_DROP);
+      }
+      if (key->dport) {
+         emit(&p, BPF_LD|BPF_H|BPF_IND, 2, 0, 0);
+         emit(&p, BPF_JMP|BPF_JEQ|BPF_K, key->dport, 0, BPF_DROP);
+      }
+      return finalize(&p);
+   }
+
+   /* l4.5 filter: payload length */
+   if (key->min_len > 0) {
+      emit(&p, BPF_LD|BPF_W|BPF_LEN, 0, 0, 0);
+      emit(&p, BPF_ALU|BPF_SUB|BPF_X, 0, 0, 0);
+      emit(&p, BPF_JMP|BPF_JGE|BPF_K, key->min_len, 0, BPF_DROP);
+   }
+
+   /* l4.5 filter: field, by words, half-words, then bytes */
+   int pos = 0;
+   while (pos < key->len) {
+      const uint8_t *f = key->field + pos;
+      int left = key->len - pos;
+      uint32_t k;
+      if (left >= 4) {
+         k = (f[0] << 24) | (f[1] << 16) | (f[2] << 8) | f[3];
+         emit(&p, BPF_LD|BPF_W|BPF_IND, key->offset + pos, 0, 0);
+         pos += 4;
+      } else if (left >= 2) {
+         k = (f[0] << 8) | f[1];
+         emit(&p, BPF_LD|BPF_H|BPF_IND, key->offset + pos, 0, 0);
+         pos += 2;
+      } else {
+         k = f[0];
+         emit(&p, BPF_LD|BPF_B|BPF_IND, key->offset + pos, 0, 0);
+         pos += 1;
+      }
+      emit(&p, BPF_JMP|BPF_JEQ|BPF_K, k, 0, BPF_DROP);
+   }
+
+   /* l4.5 filter: port of the tunneled packet */
+   if (key->port) {
+      emit(&p, BPF_LD|BPF_H|BPF_IND, key->port_off, 0, 0);
+      emit(&p, BPF_JMP|BPF_JEQ|BPF_K, key->port, 0, BPF_DROP);
+   }
+
+   return finalize(&p);
+}
+
+struct sock_fprog *lookup(const struct bpf_key *key) {
+   struct sock_fprog *fprog = NULL;
+
+   if (pthread_mutex_lock(&cache_lock) != 0)
+      die("mutex lock");
+
+   for (int i = 0; i < cache_len; i++) {
+      if (!memcmp(&cache_keys[i], key, sizeof(struct bpf_key))) {
+         fprog = cache_progs[i];
+         debug_print("bpf cache hit\n");
+         goto out;
+      }
+   }
+
+   fprog = build(key);
+   if (cache_len < BPF_CACHE_SIZE) {
+      cache_keys[cache_len]    = *key;
+      cache_progs[cache_len++] = fprog;
+   } else {
+      debug_print("bpf cache full\n");
+   }
+   debug_print("generated bpf of %d instructions\n", fprog->len);
+out:
+   if (pthread_mutex_unlock(&cache_lock) != 0)
+      die("mutex unlock");
+   return fprog;
+}
+
+struct sock_fprog *bpf_port_filter(int family, int proto, int sport, int dport) {
+   struct bpf_key key;
+   memset(&key, 0, sizeof(key));
+   key.kind   = PORT_FILTER;
+   key.family = family;
+   key.proto  = proto;
+   key.sport  = sport;
+   key.dport  = dport;
+   return lookup(&key);
+}
+
+struct sock_fprog *bpf_l45_filter(int family, int proto, int offset,
+                                  const uint8_t *field, int len, int min_len,
+                                  int port_off, int port) {
+   struct bpf_key key;
+   memset(&key, 0, sizeof(key));
+   if (!field || len <= 0)
+      len = 0;
+   if (len > BPF_L45_MAX)
+      len = BPF_L45_MAX;
+
+   key.kind    = L45_FILTER;
+   key.family  = family;
+   key.proto   = proto;
+   key.offset  = offset;
+   key.min_len = min_len;
+   key.len     = len;
+   key.port    = port;
+   if (port)
+      key.port_off = port_off;
+   if (len)
+      memcpy(key.field, field, len);
+
+   return lookup(&key);
+}
+
+struct sock_fprog *gen_bpf(struct tun_state *state, int family, int sport, int dport) {
+   int proto = state->protocol_num;
+
+   if (state->udp || !proto || proto == IPPROTO_UDP || proto == IPPROTO_TCP)
+      return bpf_port_filter(family, proto ? proto : IPPROTO_UDP, sport, dport);
+
+   /* custom protocol: match a field of the layer 4.5 header */
+   const uint8_t *field = (const uint8_t *)state->l45_filter_value;
+   int len = state->l45_filter_len, offset = state->l45_filter_offset;
+   if (!field && state->raw_header) {
+      field  = (const uint8_t *)state->raw_header;
+      len    = state->raw_header_size < 4 ? state->raw_header_size : 4;
+      offset = 0;
+   }
+
+   /* peer mode: client or server socket by the port of the tunneled packet */
+   int port = 0, port_off = 0;
+   if (state->args->mode == FULLMESH_MODE) {
+      port     = state->private_port;
+      port_off = state->raw_header_size + (family == AF_INET6 ? 40 : 20)
+               + (sport == state->port ? 0 : 2);
+   }
+   return bpf_l45_filter(family, proto, offset, field, len,
+                         state->raw_header_size + MIN_PKT_SIZE, port_off, port);
+}
+
+void bpf_release(const struct sock_fprog *fprog) {
+   if (!fprog)
+      return;
+   if (pthread_mutex_lock(&cache_lock) != 0)
+      die("mutex lock");
+   for (int i = 0; i < cache_len; i++)
+      if (cache_progs[i] == fprog)
+         goto out;
+
+   free(fprog->filter);
+   free((struct sock_fprog *)fprog);
+out:
+   if (pthread_mutex_unlock(&cache_lock) != 0)
+      die("mutex unlock");
+}
+
+void bpf_cache_flush() {
+   if (pthread_mutex_lock(&cache_lock) != 0)
+      die("mutex lock");
+   for (int i = 0; i < cache_len; i++) {
+      free(cache_progs[i]->filter);
+      free(cache_progs[i]);
+   }
+   cache_len = 0;
+   if (pthread_mutex_unlock(&cache_lock) != 0)
+      die("mutex unlock");
+}
+
+#endif
+
@@ -0,0 +1,123 @@
+/**
+ * \file bpf.h
+ * \brief Classic BPF socket filter builder prototypes.
+ *
+ *    Filters are generated directly as cBPF instructions,
+ *    without a pcap handle, and cached so that sockets sharing
+ *    the same parameters share the same program.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_BPF_H
+#define UDPTUN_BPF_H
+
+#include <stdint.h>
+
+#include "sysconfig.h"
+#if defined(LINUX_OS)
+#  include <linux/filter.h>
+#endif
+
+#include "state.h"
+
+/**
+ * \def BPF_L45_MAX
+ * \brief The maximal size of a matched layer 4.5 header field.
+ */
+#define BPF_L45_MAX 16
+
+/**
+ * \def BPF_CACHE_SIZE
+ * \brief The maximal number of cached filter programs.
+ */
+#define BPF_CACHE_SIZE 16
+
+#if defined(LINUX_OS)
+
+/**
+ * \fn struct sock_fprog *bpf_port_filter(int family, int proto, int sport, int dport)
+ * \brief Build a port filter for a raw socket.
+ *
+ *    The filter is equivalent to
+ *    $tcpdump 'ip proto proto and src port sport and dst port dport'
+ *    and drops non-first fragments.
+ *
+ * \param family AF_INET or AF_INET6 (offsets differ, IPv6 raw sockets
+ *               do not see the network header)
+ * \param proto The transport protocol (IPPROTO_TCP or IPPROTO_UDP)
+ * \param sport The source port to filter or 0 for no filtering.
+ * \param dport The destination port to filter or 0 for no filtering.
+ * \return A pointer to a cached program, do not free.
+ */
+struct sock_fprog *bpf_port_filter(int family, int proto, int sport, int dport);
+
+/**
+ * \fn struct sock_fprog *bpf_l45_filter(int family, int proto, int offset,
+ *                                       const uint8_t *field, int len,
+ *                                       int min_len, int port_off, int port)
+ * \brief Build a layer 4.5 header filter for a raw socket.
+ *
+ *    Accepts packets of protocol proto, whose layer 4.5 header holds
+ *    field at offset, whose payload is at least min_len bytes and, if
+ *    port is set, that carry port at port_off in the payload (a port of
+ *    the tunneled packet).
+ *
+ * \param family AF_INET or AF_INET6
+ * \param proto The custom protocol number
+ * \param offset The offset of the field in the layer 4.5 header
+ * \param field The bytes to match or NULL for no field matching
+ * \param len The size of field (at most BPF_L45_MAX)
+ * \param min_len The minimal size of the payload after the network header
+ * \param port_off The offset of the port in the payload
+ * \param port The port to match or 0 for no port matching
+ * \return A pointer to a cached program, do not free.
+ */
+struct sock_fprog *bpf_l45_filter(int family, int proto, int offset,
+                                  const uint8_t *field, int len, int min_len,
+                                  int port_off, int port);
+
+/**
+ * \fn struct sock_fprog *gen_bpf(struct tun_state *state, int family, int sport, int dport)
+ * \brief Create the Berkeley Packet Filter (BPF) of a tunnel raw socket.
+ *
+ *    In TCP/UDP mode, this is a port filter. Otherwise, it matches
+ *    the protocol number and a field of the layer 4.5 header
+ *    (l45-filter-offset/l45-filter-value in cfg file, defaults to the
+ *    leading bytes of the raw header when it is known). Custom
+ *    protocols have no ports: in peer mode, where the client and
+ *    server sockets see the same packets, the tunneled packet tells
+ *    them apart as fwd_in does, the client socket takes the replies
+ *    of the private port (source port) and the server socket the
+ *    packets towards it (destination port).
+ *
+ * \param state The program state
+ * \param family AF_INET or AF_INET6
+ * \param sport The source port to filter or 0 for no filtering.
+ * \param dport The destination port to filter or 0 for no filtering.
+ * \return The program, release it with bpf_release once attached.
+ */
+struct sock_fprog *gen_bpf(struct tun_state *state, int family, int sport, int dport);
+
+/**
+ * \fn void bpf_release(const struct sock_fprog *fprog)
+ * \brief Release a filter program returned by gen_bpf.
+ *
+ *    Cached programs are kept until bpf_cache_flush, programs
+ *    built once the cache is full are freed.
+ *
+ * \param fprog The program, NULL is ignored.
+ */
+void bpf_release(const struct sock_fprog *fprog);
+
+/**
+ * \fn void bpf_cache_flush()
+ * \brief Free all cached filter programs.
+ */
+void bpf_cache_flush();
+
+#endif
+
+#endif
+
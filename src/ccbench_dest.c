@@ -0,0 +1,237 @@
+/**
+ * \file ccbench_dest.c
+ * \brief copycat-bench-dest, startup cost of the destination file.
+ *
+ *    For each destination file size, a child process times
+ *    init_tun_state (destination file parsing and table building),
+ *    measures the resident memory it added, then starts the client
+ *    loop on the fake io backend and times the first packet from the
+ *    fake tun to a loopback udp sink. With -b, each size is measured
+ *    again from the compiled destination database of the file.
+ *    Results are printed as JSON.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "state.h"
+#include "pktio.h"
+
+const char *bench_optstring = "6bd:h";
+const char *bench_help = "Usage: copycat-bench-dest [OPTION...]\n"
+"parse time, resident memory and first packet latency per destination\n"
+"file size, as JSON\n\n"
+"  -d NUM                       Number of peers (default: 10 to 1000000)\n"
+"  -6                           Dual stack destination file\n"
+"  -b                           Also measure compiled databases (copycat -C)\n"
+"  -h                           Give this help list\n";
+
+/**
+ * \struct bench_fwd
+ *	\brief The forwarding loop arguments.
+ */
+struct bench_fwd {
+   struct tun_state *state;     /*!< The client state */
+   int fd_tun;                  /*!< The fake tun */
+   int fd_net;                  /*!< The udp socket */
+};
+
+/**
+ * \fn static void *fwd_thread(void *arg)
+ * \brief Run the client loop until its inactivity timeout.
+ */
+static void *fwd_thread(void *arg);
+
+/**
+ * \fn static long rss_kb()
+ * \brief The resident memory of the process.
+ *
+ * \return The resident set size in kB, or -1
+ */
+static long rss_kb();
+
+/**
+ * \fn static void run_size(int ndest, int v6, int db)
+ * \brief Load a destination file of ndest peers (or its compiled
+ *        database if db), forward a first packet and print the JSON
+ *        object of the measures.
+ */
+static void run_size(int ndest, int v6, int db);
+
+/**
+ * \var static struct bench_env env
+ * \brief The bench environment of a child, removed at exit.
+ */
+static struct bench_env env;
+
+/**
+ * \var static struct arguments args
+ * \brief The arguments of a child, used by the state until exit.
+ */
+static struct arguments args;
+
+/**
+ * \fn static void cleanup()
+ * \brief Remove the bench environment.
+ */
+static void cleanup();
+
+void cleanup() {
+   bench_env_free(&env);
+}
+
+void *fwd_thread(void *arg) {
+   struct bench_fwd *fwd = arg;
+   tun_cli_fwd(fwd->state->fwd, fwd->fd_tun, fwd->fd_net, 0);
+   return NULL;
+}
+
+long rss_kb() {
+   long pages, resident;
+   FILE *fp = fopen("/proc/self/statm", "r");
+   if (!fp)
+      return -1;
+   int ret = fscanf(fp, "%ld %ld", &pages, &resident);
+   fclose(fp);
+   return ret == 2 ? resident * (sysconf(_SC_PAGESIZE) / 1024) : -1;
+}
+
+void run_size(int ndest, int v6, int db) {
+   static char db_file[STR_SIZE];
+   if (bench_env_init(&env, ndest, v6) < 0) {
+      perror("bench environment");
+      exit(1);
+   }
+   atexit(cleanup);
+   bench_args(&env, &args, CLI_MODE);
+   args.dual_stack = v6;
+   if (db) {
+      if (snprintf(db_file, STR_SIZE, "%sdest.db", env.dir) >= STR_SIZE) {
+         errno = ENAMETOOLONG;
+         perror("bench environment");
+         exit(1);
+      }
+      args.silent       = 1;
+      args.compile_dest = env.dest;
+      args.compile_out  = db_file;
+
+      /* compiled aside, out of the measured process memory */
+      pid_t pid = fork();
+      if (!pid)
+         _exit(compile_dest_db(&args) < 0);
+      int status;
+      if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+          WEXITSTATUS(status))
+         die("destination database");
+      args.dest_file = db_file;
+   }
+
+   struct stat st;
+   if (stat(args.dest_file, &st) < 0)
+      die("stat");
+
+   /* parsing and tables */
+   long rss = rss_kb();
+   uint64_t start = bench_now();
+   struct tun_state *state = init_tun_state(&args);
+   uint64_t init = bench_now();
+   long rss_init = rss_kb() - rss;
+
+   /* first packet: fake tun -> client loop -> sink */
+   struct bench_fwd fwd = { .state = state };
+   state->io->open_tun(state, &fwd.fd_tun);
+   fwd.fd_net  = state->io->open_udp4(state->port, 1, state->public_addr4);
+   int fd_app  = pktio_fake_peer(fwd.fd_tun);
+   int fd_sink = udp_sock4(state->public_port, 1, "127.0.0.1");
+   struct timeval tv = { .tv_sec = 1 };
+   setsockopt(fd_sink, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   pthread_t tid;
+   pthread_create(&tid, NULL, fwd_thread, &fwd);
+
+   char buf[BUFF_SIZE];
+   uint64_t sent = bench_now();
+   if (write(fd_app, buf, bench_pkt4(buf, 64, bench_priv4(0))) < 0)
+      die("write");
+   int recvd = recv(fd_sink, buf, BUFF_SIZE, 0);
+   uint64_t first = bench_now();
+
+   printf("    {\"peers\": %d, \"format\": \"%s\", \"file_bytes\": %ld, "
+          "\"init_ms\": %.2f, \"rss_kb\": %ld, \"bytes_per_peer\": %.1f, ",
+          ndest, db ? "db" : "text", (long)st.st_size, (init - start) / 1e6,
+          rss_init, rss_init * 1024.0 / ndest);
+   if (recvd > 0)
+      printf("\"first_pkt_us\": %.1f, \"startup_ms\": %.2f}",
+             (first - sent) / 1e3, (first - start) / 1e6);
+   else
+      printf("\"first_pkt_us\": null, \"startup_ms\": null}");
+   fflush(stdout);
+
+   /* the loop returns after its inactivity timeout */
+   pthread_join(tid, NULL);
+}
+
+int main(int argc, char *argv[]) {
+   int val, ndest = 0, v6 = 0, db = 0;
+   while((val = getopt(argc, argv, bench_optstring)) != EOF) {
+      switch (val) {
+         case 'd':
+            ndest = strtol(optarg, NULL, 10); break;
+         case '6':
+            v6 = 1; break;
+         case 'b':
+            db = 1; break;
+         default:
+            printf("%s", bench_help);
+            return -1;
+      }
+   }
+   if (ndest < 0) {
+      printf("%s", bench_help);
+      return -1;
+   }
+
+   int sizes[] = {10, 100, 1000, 10000, 100000, 1000000, 0};
+   int single[] = {ndest, 0};
+   int *run = ndest ? single : sizes;
+
+   printf("{\"bench\": \"dest\", \"dual_stack\": %s,\n  \"runs\": [\n",
+          v6 ? "true" : "false");
+   for (int i = 0, first = 1; run[i]; i++) {
+    for (int fmt = 0; fmt <= db; fmt++, first = 0) {
+      /* one process per measure: init_tun_state is called once */
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid < 0) {
+         perror("fork");
+         return 1;
+      } else if (!pid) {
+         if (!first)
+            printf(",\n");
+         run_size(run[i], v6, fmt);
+         exit(0);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+         fprintf(stderr, "%d peers: failed\n", run[i]);
+         return 1;
+      }
+    }
+   }
+   printf("\n  ]}\n");
+   return 0;
+}
+
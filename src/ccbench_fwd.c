@@ -0,0 +1,279 @@
+/**
+ * \file ccbench_fwd.c
+ * \brief copycat-bench-fwd, forwarding throughput of the client loop.
+ *
+ *    Runs the client forwarding loop (tun_cli_fwd) on the fake io
+ *    backend. Inner packets are written to the fake tun and counted
+ *    at a loopback udp sink bound to the peers public port (in), then
+ *    tunnelled packets are sent by the sink and counted at the fake
+ *    tun (out). With -R, the destinations are reloaded (SIGHUP) every
+ *    MS ms meanwhile. No privileges are needed.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+#include "state.h"
+#include "pktio.h"
+
+const char *bench_optstring = "d:hl:n:R:w:";
+const char *bench_help = "Usage: copycat-bench-fwd [OPTION...]\n"
+"forwarding throughput of the copycat client loop (fake io backend)\n\n"
+"  -n NUM                       Packets per direction (default: 1000000)\n"
+"  -l LEN                       Inner packet length (default: 512)\n"
+"  -d NUM                       Number of peers (default: 100)\n"
+"  -w NUM                       Packets in flight (default: 256)\n"
+"  -R MS                        Reload the destinations every MS ms\n"
+"  -h                           Give this help list\n";
+
+/**
+ * \struct bench_sink
+ *	\brief A packet counter.
+ */
+struct bench_sink {
+   int      fd;                 /*!< The counted fd */
+   uint64_t expected;           /*!< Stop after expected packets */
+   uint64_t pkts;               /*!< Received packets */
+   uint64_t bytes;              /*!< Received bytes */
+   uint64_t last;               /*!< Time of the last packet (ns) */
+};
+
+/**
+ * \struct bench_fwd
+ *	\brief The forwarding loop arguments.
+ */
+struct bench_fwd {
+   struct tun_state *state;     /*!< The client state */
+   int fd_tun;                  /*!< The fake tun */
+   int fd_net;                  /*!< The udp socket */
+};
+
+/**
+ * \struct bench_hup
+ *	\brief The reload generator.
+ */
+struct bench_hup {
+   int      period;             /*!< Reload period (ms) */
+   int      stop;               /*!< Stop sending */
+   uint64_t count;              /*!< Sent SIGHUPs */
+};
+
+/**
+ * \fn static void *hup_thread(void *arg)
+ * \brief Send SIGHUP to the process every period ms until stop.
+ */
+static void *hup_thread(void *arg);
+
+/**
+ * \fn static void *sink_thread(void *arg)
+ * \brief Count packets until expected or 1s without packets.
+ */
+static void *sink_thread(void *arg);
+
+/**
+ * \fn static void *fwd_thread(void *arg)
+ * \brief Run the client loop until its inactivity timeout.
+ */
+static void *fwd_thread(void *arg);
+
+/**
+ * \fn static void run(const char *dir, int fd_out, struct sockaddr_in *to,
+ *                     int fd_in, int n, int len, int ndest, int window)
+ * \brief Send n packets on fd_out (to 'to' if not NULL) in batches,
+ *        count them on fd_in and print the rate.
+ */
+static void run(const char *dir, int fd_out, struct sockaddr_in *to,
+                int fd_in, int n, int len, int ndest, int window);
+
+/**
+ * \var static struct bench_env env
+ * \brief The bench environment, removed at exit after copycat
+ *        wrote its output files.
+ */
+static struct bench_env env;
+
+/**
+ * \var static struct arguments args
+ * \brief The program arguments, used by the state until exit.
+ */
+static struct arguments args;
+
+/**
+ * \fn static void cleanup()
+ * \brief Remove the bench environment.
+ */
+static void cleanup();
+
+void cleanup() {
+   bench_env_free(&env);
+}
+
+void *sink_thread(void *arg) {
+   struct bench_sink *sink = arg;
+   struct pktio_buf bufs[PKTIO_BATCH];
+   char *data = xmalloc(PKTIO_BATCH * BUFF_SIZE);
+   struct timeval tv = { .tv_sec = 1 };
+   setsockopt(sink->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   while (__atomic_load_n(&sink->pkts, __ATOMIC_RELAXED) < sink->expected) {
+      for (int i = 0; i < PKTIO_BATCH; i++) {
+         bufs[i].data = data + i * BUFF_SIZE;
+         bufs[i].len  = BUFF_SIZE;
+      }
+      int n = pktio_read_batch(sink->fd, bufs, PKTIO_BATCH);
+      if (n <= 0)
+         break;
+      for (int i = 0; i < n; i++)
+         sink->bytes += bufs[i].len;
+      sink->last = bench_now();
+      __atomic_store_n(&sink->pkts, sink->pkts + n, __ATOMIC_RELEASE);
+   }
+   free(data);
+   return NULL;
+}
+
+void *hup_thread(void *arg) {
+   struct bench_hup *hup = arg;
+   struct timespec ts = {
+      .tv_sec  = hup->period / 1000,
+      .tv_nsec = hup->period % 1000 * 1000000L,
+   };
+   while (!__atomic_load_n(&hup->stop, __ATOMIC_RELAXED)) {
+      nanosleep(&ts, NULL);
+      kill(getpid(), SIGHUP);
+      hup->count++;
+   }
+   return NULL;
+}
+
+void *fwd_thread(void *arg) {
+   struct bench_fwd *fwd = arg;
+   tun_cli_fwd(fwd->state->fwd, fwd->fd_tun, fwd->fd_net, 0);
+   return NULL;
+}
+
+void run(const char *dir, int fd_out, struct sockaddr_in *to,
+         int fd_in, int n, int len, int ndest, int window) {
+   struct bench_sink sink = { .fd = fd_in, .expected = n };
+   struct pktio_buf bufs[PKTIO_BATCH];
+   static char data[PKTIO_BATCH][BUFF_SIZE];
+   pthread_t tid;
+   pthread_create(&tid, NULL, sink_thread, &sink);
+
+   uint64_t start = bench_now();
+   int sent = 0;
+   while (sent < n) {
+      /* window: wait for the sink */
+      while (sent - __atomic_load_n(&sink.pkts, __ATOMIC_ACQUIRE)
+                  > (uint64_t)window)
+         sched_yield();
+
+      int batch = n - sent < PKTIO_BATCH ? n - sent : PKTIO_BATCH;
+      for (int i = 0; i < batch; i++) {
+         bufs[i].data    = data[i];
+         bufs[i].len     = bench_pkt4(data[i], len,
+                                      bench_priv4((sent + i) % ndest));
+         bufs[i].addrlen = 0;
+         if (to) {
+            memcpy(&bufs[i].addr, to, sizeof(struct sockaddr_in));
+            bufs[i].addrlen = sizeof(struct sockaddr_in);
+         }
+      }
+      int ret = pktio_write_batch(fd_out, bufs, batch);
+      if (ret < 0) {
+         if (errno == EAGAIN || errno == ENOBUFS)
+            continue;
+         perror("write");
+         break;
+      }
+      sent += ret;
+   }
+   pthread_join(tid, NULL);
+
+   double sec = sink.last > start ? (sink.last - start) / 1e9 : 0;
+   printf("%-4s %10" PRIu64 " pkts %10" PRIu64 " lost %12.0f pkts/s %10.1f Mbit/s\n",
+          dir, sink.pkts, sent - sink.pkts, sec ? sink.pkts / sec : 0,
+          sec ? sink.bytes * 8 / sec / 1e6 : 0);
+}
+
+int main(int argc, char *argv[]) {
+   int val, n = 1000000, len = 512, ndest = 100, window = 256;
+   struct bench_hup hup = { .period = 0 };
+   while((val = getopt(argc, argv, bench_optstring)) != EOF) {
+      switch (val) {
+         case 'n':
+            n = strtol(optarg, NULL, 10); break;
+         case 'l':
+            len = strtol(optarg, NULL, 10); break;
+         case 'd':
+            ndest = strtol(optarg, NULL, 10); break;
+         case 'w':
+            window = strtol(optarg, NULL, 10); break;
+         case 'R':
+            hup.period = strtol(optarg, NULL, 10); break;
+         default:
+            printf("%s", bench_help);
+            return -1;
+      }
+   }
+   if (n <= 0 || ndest <= 0 || window <= 0 || len < 28 || len > BUFF_SIZE - 64 ||
+       hup.period < 0) {
+      printf("%s", bench_help);
+      return -1;
+   }
+
+   if (bench_env_init(&env, ndest, 0) < 0) {
+      perror("bench environment");
+      return 1;
+   }
+   atexit(cleanup);
+   bench_args(&env, &args, CLI_MODE);
+   struct tun_state *state = init_tun_state(&args);
+
+   struct bench_fwd fwd = { .state = state };
+   state->io->open_tun(state, &fwd.fd_tun);
+   fwd.fd_net   = state->io->open_udp4(state->port, 1, state->public_addr4);
+   int fd_app   = pktio_fake_peer(fwd.fd_tun);
+   int fd_sink  = udp_sock4(state->public_port, 1, "127.0.0.1");
+
+   pthread_t tid, tid_hup;
+   pthread_create(&tid, NULL, fwd_thread, &fwd);
+   if (hup.period)
+      pthread_create(&tid_hup, NULL, hup_thread, &hup);
+
+   /* tun -> udp */
+   run("in", fd_app, NULL, fd_sink, n, len, ndest, window);
+
+   /* udp -> tun */
+   struct sockaddr_in to;
+   memset(&to, 0, sizeof(to));
+   to.sin_family = AF_INET;
+   to.sin_port   = htons(state->port);
+   inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+   run("out", fd_sink, &to, fd_app, n, len, ndest, window);
+   if (hup.period) {
+      __atomic_store_n(&hup.stop, 1, __ATOMIC_RELAXED);
+      pthread_join(tid_hup, NULL);
+      printf("%" PRIu64 " reloads\n", hup.count);
+   }
+
+   /* the loop returns after its inactivity timeout */
+   pthread_join(tid, NULL);
+   return 0;
+}
+
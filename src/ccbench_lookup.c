@@ -0,0 +1,354 @@
+/**
+ * \file ccbench_lookup.c
+ * \brief copycat-bench-lookup, lookup table microbenchmark.
+ *
+ *    For each destination set size, a child process builds the tables
+ *    of a dual stack full mesh state with init_tun_state (serv keyed
+ *    by source port, cli4 and cli6 keyed by private address), then
+ *    times the lookups of the forwarding functions with uniform and
+ *    zipf keys, on one and on -t threads. Results are printed as JSON.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "state.h"
+
+/**
+ * \def BENCH_TABLE_IMPL
+ * \brief The benchmarked table implementation.
+ */
+#define BENCH_TABLE_IMPL "ghashtable"
+
+/**
+ * \def BENCH_KEYS
+ * \brief The number of pregenerated keys (power of 2).
+ */
+#define BENCH_KEYS (1 << 20)
+
+const char *bench_optstring = "d:hn:s:t:";
+const char *bench_help = "Usage: copycat-bench-lookup [OPTION...]\n"
+"ns per lookup of the copycat tables, as JSON\n\n"
+"  -d NUM                       Number of peers (default: 10 to 1000000)\n"
+"  -n NUM                       Lookups per measure (default: 4194304)\n"
+"  -s EXP                       Zipf exponent of skewed keys (default: 1.0)\n"
+"  -t NUM                       Threads of multithreaded measures (default: 4)\n"
+"  -h                           Give this help list\n";
+
+/**
+ * \enum bench_table
+ * \brief The benchmarked tables.
+ */
+enum bench_table {
+   BT_SERV = 0,  /*!< source port */
+   BT_CLI4,      /*!< private v4 address */
+   BT_CLI6,      /*!< private v6 address */
+   BT_TABLES     /*!< number of tables */
+};
+
+/**
+ * \var static const char *table_names[BT_TABLES]
+ * \brief Table names, indexed by enum bench_table.
+ */
+static const char *table_names[BT_TABLES] = {"serv", "cli4", "cli6"};
+
+/**
+ * \struct bench_keys
+ *	\brief Pregenerated keys of an access pattern.
+ */
+struct bench_keys {
+   int          *sport;         /*!< serv keys */
+   in_addr_t    *addr4;         /*!< cli4 keys */
+   unsigned char (*addr6)[16];  /*!< cli6 keys */
+};
+
+/**
+ * \struct bench_job
+ *	\brief A measure of a thread.
+ */
+struct bench_job {
+   GHashTable        *table;    /*!< The table */
+   enum bench_table   type;     /*!< Its key type */
+   struct bench_keys *keys;     /*!< The keys */
+   unsigned int       off;      /*!< First key */
+   long               n;        /*!< Number of lookups */
+   long               found;    /*!< Hits */
+   uint64_t           ns;       /*!< Elapsed time */
+};
+
+/**
+ * \var static uint64_t rng
+ * \brief The key generator state (fixed seed).
+ */
+static uint64_t rng = 88172645463325252ULL;
+
+/**
+ * \fn static uint64_t xorshift()
+ * \brief The key generator.
+ */
+static uint64_t xorshift();
+
+/**
+ * \fn static void gen_keys(struct bench_keys *keys, int ndest, double skew)
+ * \brief Generate BENCH_KEYS keys, uniform if skew is 0, zipf otherwise
+ *        (hot peers are scattered over the destination file).
+ */
+static void gen_keys(struct bench_keys *keys, int ndest, double skew);
+
+/**
+ * \fn static void *lookup_job(void *arg)
+ * \brief Run the lookups of a job.
+ */
+static void *lookup_job(void *arg);
+
+/**
+ * \fn static double measure(GHashTable *table, enum bench_table type,
+ *                           struct bench_keys *keys, long n, int threads)
+ * \brief Run n lookups per thread.
+ *
+ * \return The mean ns per lookup of a thread
+ */
+static double measure(GHashTable *table, enum bench_table type,
+                      struct bench_keys *keys, long n, int threads);
+
+/**
+ * \fn static void run_size(int ndest, long n, double skew, int threads)
+ * \brief Build the tables of ndest peers and print the JSON object
+ *        of their measures.
+ */
+static void run_size(int ndest, long n, double skew, int threads);
+
+/**
+ * \var static struct bench_env env
+ * \brief The bench environment of a child, removed at exit.
+ */
+static struct bench_env env;
+
+/**
+ * \var static struct arguments args
+ * \brief The arguments of a child, used by the state until exit.
+ */
+static struct arguments args;
+
+/**
+ * \fn static void cleanup()
+ * \brief Remove the bench environment.
+ */
+static void cleanup();
+
+void cleanup() {
+   bench_env_free(&env);
+}
+
+uint64_t xorshift() {
+   rng ^= rng << 13;
+   rng ^= rng >> 7;
+   rng ^= rng << 17;
+   return rng;
+}
+
+void gen_keys(struct bench_keys *keys, int ndest, double skew) {
+   int *perm = NULL;
+   double *cdf = NULL;
+   if (skew > 0) {
+      /* rank -> peer permutation and rank cdf */
+      perm = xmalloc(ndest * sizeof(int));
+      cdf  = xmalloc(ndest * sizeof(double));
+      for (int i = 0; i < ndest; i++)
+         perm[i] = i;
+      for (int i = ndest - 1; i > 0; i--) {
+         int j = xorshift() % (i + 1), t = perm[i];
+         perm[i] = perm[j]; perm[j] = t;
+      }
+      double sum = 0;
+      for (int i = 0; i < ndest; i++)
+         cdf[i] = (sum += 1.0 / pow(i + 1, skew));
+      for (int i = 0; i < ndest; i++)
+         cdf[i] /= sum;
+   }
+
+   keys->sport = xmalloc(BENCH_KEYS * sizeof(int));
+   keys->addr4 = xmalloc(BENCH_KEYS * sizeof(in_addr_t));
+   keys->addr6 = xmalloc(BENCH_KEYS * 16);
+   for (int k = 0; k < BENCH_KEYS; k++) {
+      int i;
+      if (skew > 0) {
+         double u = (xorshift() >> 11) * (1.0 / 9007199254740992.0);
+         int lo = 0, hi = ndest - 1;
+         while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < u)
+               lo = mid + 1;
+            else
+               hi = mid;
+         }
+         i = perm[lo];
+      } else
+         i = xorshift() % ndest;
+
+      keys->sport[k] = BENCH_SPORT + i;
+      keys->addr4[k] = bench_priv4(i);
+      bench_priv6(i, (struct in6_addr *)keys->addr6[k]);
+   }
+   free(perm);
+   free(cdf);
+}
+
+void *lookup_job(void *arg) {
+   struct bench_job *job = arg;
+   struct bench_keys *keys = job->keys;
+   unsigned int k = job->off;
+   long found = 0;
+
+   uint64_t start = bench_now();
+   switch (job->type) {
+      case BT_SERV:
+         for (long i = 0; i < job->n; i++, k++)
+            found += g_hash_table_lookup(job->table,
+                                         &keys->sport[k & (BENCH_KEYS-1)]) != NULL;
+         break;
+      case BT_CLI4:
+         for (long i = 0; i < job->n; i++, k++)
+            found += g_hash_table_lookup(job->table,
+                                         &keys->addr4[k & (BENCH_KEYS-1)]) != NULL;
+         break;
+      default:
+         for (long i = 0; i < job->n; i++, k++)
+            found += g_hash_table_lookup(job->table,
+                                         keys->addr6[k & (BENCH_KEYS-1)]) != NULL;
+         break;
+   }
+   job->ns    = bench_now() - start;
+   job->found = found;
+   return NULL;
+}
+
+double measure(GHashTable *table, enum bench_table type,
+               struct bench_keys *keys, long n, int threads) {
+   struct bench_job jobs[threads];
+   pthread_t tids[threads];
+   for (int t = 0; t < threads; t++) {
+      jobs[t] = (struct bench_job) {
+         .table = table, .type = type, .keys = keys,
+         .off = t * (BENCH_KEYS / threads), .n = n,
+      };
+      pthread_create(&tids[t], NULL, lookup_job, &jobs[t]);
+   }
+   double ns = 0;
+   for (int t = 0; t < threads; t++) {
+      pthread_join(tids[t], NULL);
+      if (jobs[t].found != n)
+         fprintf(stderr, "%s: %ld/%ld hits\n", table_names[type], jobs[t].found, n);
+      ns += (double)jobs[t].ns / n;
+   }
+   return ns / threads;
+}
+
+void run_size(int ndest, long n, double skew, int threads) {
+   if (bench_env_init(&env, ndest, 1) < 0) {
+      perror("bench environment");
+      exit(1);
+   }
+   atexit(cleanup);
+   bench_args(&env, &args, FULLMESH_MODE);
+   args.dual_stack = 1;
+
+   uint64_t start = bench_now();
+   struct tun_state *state = init_tun_state(&args);
+   double init_ms = (bench_now() - start) / 1e6;
+
+   GHashTable *tables[BT_TABLES] = {state->dests->serv, state->dests->cli4,
+                                    state->dests->cli6};
+   struct bench_keys keys[2];
+   const char *patterns[2] = {"uniform", "zipf"};
+   gen_keys(&keys[0], ndest, 0);
+   gen_keys(&keys[1], ndest, skew);
+
+   printf("    {\"peers\": %d, \"init_ms\": %.1f, \"sizes\": {", ndest, init_ms);
+   for (int t = 0; t < BT_TABLES; t++)
+      printf("%s\"%s\": %u", t ? ", " : "", table_names[t],
+             g_hash_table_size(tables[t]));
+   printf("},\n     \"results\": [\n");
+
+   int first = 1;
+   for (int t = 0; t < BT_TABLES; t++) {
+      for (int p = 0; p < 2; p++) {
+         int nthreads[2] = {1, threads};
+         for (int j = 0; j < (threads > 1 ? 2 : 1); j++) {
+            double ns = measure(tables[t], t, &keys[p], n, nthreads[j]);
+            printf("%s      {\"table\": \"%s\", \"keys\": \"%s\", \"threads\": %d, "
+                   "\"ns_per_lookup\": %.2f, \"mlookups_per_s\": %.2f}",
+                   first ? "" : ",\n", table_names[t], patterns[p], nthreads[j],
+                   ns, ns ? nthreads[j] * 1e3 / ns : 0);
+            first = 0;
+         }
+      }
+   }
+   printf("\n     ]}");
+   fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+   int val, ndest = 0, threads = 4;
+   long n = 1 << 22;
+   double skew = 1.0;
+   while((val = getopt(argc, argv, bench_optstring)) != EOF) {
+      switch (val) {
+         case 'd':
+            ndest = strtol(optarg, NULL, 10); break;
+         case 'n':
+            n = strtol(optarg, NULL, 10); break;
+         case 's':
+            skew = strtod(optarg, NULL); break;
+         case 't':
+            threads = strtol(optarg, NULL, 10); break;
+         default:
+            printf("%s", bench_help);
+            return -1;
+      }
+   }
+   if (ndest < 0 || n <= 0 || skew <= 0 || threads <= 0 || threads > 256) {
+      printf("%s", bench_help);
+      return -1;
+   }
+
+   int sizes[] = {10, 100, 1000, 10000, 100000, 1000000, 0};
+   int single[] = {ndest, 0};
+   int *run = ndest ? single : sizes;
+
+   printf("{\"bench\": \"lookup\", \"table\": \"%s\", \"lookups\": %ld, "
+          "\"zipf\": %.2f,\n  \"runs\": [\n", BENCH_TABLE_IMPL, n, skew);
+   for (int i = 0; run[i]; i++) {
+      /* one process per size: init_tun_state is called once */
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid < 0) {
+         perror("fork");
+         return 1;
+      } else if (!pid) {
+         if (i)
+            printf(",\n");
+         run_size(run[i], n, skew, threads);
+         exit(0);
+      }
+      int status;
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+         fprintf(stderr, "%d peers: failed\n", run[i]);
+         return 1;
+      }
+   }
+   printf("\n  ]}\n");
+   return 0;
+}
+
@@ -0,0 +1,358 @@
+/**
+ * \file ccbench_replay.c
+ * \brief copycat-bench-replay, forwarding replay of a pcap.
+ *
+ *    The inner packets of a pcap (e.g. a tun capture) are loaded in
+ *    memory, then pushed -r times through the classification and
+ *    encapsulation variants of the client (FWD_CLI) or of the
+ *    server (FWD_SERV) selected for the node modes (fwd.h). The
+ *    destination file is generated from the
+ *    pcap, so that every packet has a peer: one per destination
+ *    address (client) or per destination port (server). All peers
+ *    send to a loopback sink that is never read, the kernel discards
+ *    the packets. No privileges are needed.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <pcap.h>
+
+#include "bench.h"
+#include "state.h"
+#include "fwd.h"
+#include "pktio.h"
+#include "stats.h"
+#include "cycles.h"
+
+/**
+ * \def REPLAY_HEADROOM
+ * \brief Room left in front of each packet for the layer 4.5 header.
+ */
+#define REPLAY_HEADROOM 64
+
+const char *bench_optstring = "hm:r:x:";
+const char *bench_help = "Usage: copycat-bench-replay [OPTION...] FILE\n"
+"replay the inner packets of a pcap through the copycat tunnel functions\n\n"
+"  -m MODE                      cli (default) or serv\n"
+"  -r NUM                       Replays of the pcap (default: 10)\n"
+"  -x HEX                       Layer 4.5 header, as hexstring\n"
+"  -h                           Give this help list\n\n"
+"FILE is a pcap of raw, ethernet, linux cooked or null link type\n";
+
+/**
+ * \struct replay_pkt
+ *	\brief A loaded packet.
+ */
+struct replay_pkt {
+   char *data;                  /*!< The IP packet, after REPLAY_HEADROOM bytes */
+   int   len;                   /*!< Its length */
+};
+
+/**
+ * \struct replay_set
+ *	\brief The loaded packets.
+ */
+struct replay_set {
+   struct replay_pkt *pkts;     /*!< The packets */
+   int      npkts;              /*!< Number of packets */
+   int      size;               /*!< Allocated packets */
+   int      skipped;            /*!< Non-IP and truncated packets */
+   uint64_t bytes;              /*!< Sum of packet lengths */
+};
+
+/**
+ * \fn static int link_offset(int dlt)
+ * \brief The IP header offset of a link type.
+ *
+ * \return The offset, -1 if unsupported
+ */
+static int link_offset(int dlt);
+
+/**
+ * \fn static void load_pcap(const char *file, struct replay_set *set)
+ * \brief Load the IPv4/IPv6 packets of a pcap.
+ */
+static void load_pcap(const char *file, struct replay_set *set);
+
+/**
+ * \fn static int cmp_key(const void *a, const void *b)
+ * \brief Sort 16 bytes keys.
+ */
+static int cmp_key(const void *a, const void *b);
+
+/**
+ * \fn static int uniq(unsigned char (*keys)[16], int n)
+ * \brief Sort and remove duplicates.
+ *
+ * \return The number of unique keys
+ */
+static int uniq(unsigned char (*keys)[16], int n);
+
+/**
+ * \fn static int write_dest(const char *file, struct replay_set *set, int serv)
+ * \brief Write a destination file with a peer for each destination
+ *        address (client) or port (server) of the packets.
+ *
+ * \return The number of peers
+ */
+static int write_dest(const char *file, struct replay_set *set, int serv);
+
+/**
+ * \fn static void to_sink(gpointer key, gpointer value, gpointer port)
+ * \brief Redirect a server peer to the sink port.
+ */
+static void to_sink(gpointer key, gpointer value, gpointer port);
+
+/**
+ * \var static struct bench_env env
+ * \brief The bench environment, removed at exit.
+ */
+static struct bench_env env;
+
+/**
+ * \var static struct arguments args
+ * \brief The program arguments, used by the state until exit.
+ */
+static struct arguments args;
+
+/**
+ * \fn static void cleanup()
+ * \brief Remove the bench environment.
+ */
+static void cleanup();
+
+void cleanup() {
+   bench_env_free(&env);
+}
+
+int link_offset(int dlt) {
+   switch (dlt) {
+      case DLT_RAW:
+         return 0;
+      case DLT_NULL:
+         return 4;
+      case DLT_EN10MB:
+         return 14;
+      case DLT_LINUX_SLL:
+         return 16;
+      default:
+         return -1;
+   }
+}
+
+void load_pcap(const char *file, struct replay_set *set) {
+   char errbuf[PCAP_ERRBUF_SIZE];
+   pcap_t *handle = pcap_open_offline(file, errbuf);
+   if (!handle) {
+      fprintf(stderr, "%s: %s\n", file, errbuf);
+      exit(1);
+   }
+   int off = link_offset(pcap_datalink(handle));
+   if (off < 0) {
+      fprintf(stderr, "%s: unsupported link type %d\n", file, pcap_datalink(handle));
+      exit(1);
+   }
+
+   struct pcap_pkthdr *hdr;
+   const u_char *data;
+   while (pcap_next_ex(handle, &hdr, &data) == 1) {
+      int len = hdr->caplen - off;
+      int v = len > 0 ? data[off] & 0xf0 : 0;
+      /* the tunnel functions read up to the transport ports */
+      if (!((v == 0x40 && len >= 24) || (v == 0x60 && len >= 44))
+          || len > BUFF_SIZE - REPLAY_HEADROOM) {
+         set->skipped++;
+         continue;
+      }
+      if (set->npkts == set->size) {
+         set->size = set->size ? 2 * set->size : 1024;
+         set->pkts = realloc(set->pkts, set->size * sizeof(struct replay_pkt));
+         if (!set->pkts)
+            die("realloc");
+      }
+      struct replay_pkt *pkt = &set->pkts[set->npkts++];
+      pkt->data = (char *)xmalloc(REPLAY_HEADROOM + len) + REPLAY_HEADROOM;
+      pkt->len  = len;
+      memcpy(pkt->data, data + off, len);
+      set->bytes += len;
+   }
+   pcap_close(handle);
+}
+
+int cmp_key(const void *a, const void *b) {
+   return memcmp(a, b, 16);
+}
+
+int uniq(unsigned char (*keys)[16], int n) {
+   int j = 0;
+   qsort(keys, n, 16, cmp_key);
+   for (int i = 0; i < n; i++)
+      if (!j || memcmp(keys[i], keys[j-1], 16))
+         memcpy(keys[j++], keys[i], 16);
+   return j;
+}
+
+int write_dest(const char *file, struct replay_set *set, int serv) {
+   unsigned char (*k4)[16] = calloc(set->npkts + 1, 16);
+   unsigned char (*k6)[16] = calloc(set->npkts + 1, 16);
+   int n4 = 0, n6 = 0;
+   if (!k4 || !k6)
+      die("calloc");
+
+   for (int i = 0; i < set->npkts; i++) {
+      const char *p = set->pkts[i].data;
+      int v6 = (p[0] & 0xf0) == 0x60;
+      if (serv) {
+         /* destination port, one table for both families */
+         uint16_t dport;
+         memcpy(&dport, p + (v6 ? 42 : 22), 2);
+         memcpy(k4[n4++], &dport, 2);
+      } else if (v6)
+         memcpy(k6[n6++], p + 24, 16);
+      else
+         memcpy(k4[n4++], p + 16, 4);
+   }
+   n4 = uniq(k4, n4);
+   n6 = uniq(k6, n6);
+
+   FILE *fp = fopen(file, "w");
+   if (!fp)
+      die("destination file");
+   int n = n4 > n6 ? n4 : n6;
+   char priv4[INET_ADDRSTRLEN], priv6[INET6_ADDRSTRLEN];
+   for (int i = 0; i < n; i++) {
+      /* unused columns get synthetic values */
+      int sport = BENCH_SPORT + 65536 + i;
+      in_addr_t a4 = bench_priv4(i);
+      struct in6_addr a6;
+      bench_priv6(i, &a6);
+      if (serv && i < n4) {
+         uint16_t dport;
+         memcpy(&dport, k4[i], 2);
+         sport = ntohs(dport);
+      } else if (!serv) {
+         if (i < n4)
+            memcpy(&a4, k4[i], 4);
+         if (i < n6)
+            memcpy(&a6, k6[i], 16);
+      }
+      inet_ntop(AF_INET, &a4, priv4, sizeof(priv4));
+      inet_ntop(AF_INET6, &a6, priv6, sizeof(priv6));
+      fprintf(fp, "%d 127.0.0.1 %s ::1 %s\n", sport, priv4, priv6);
+   }
+   fclose(fp);
+   free(k4);
+   free(k6);
+   return n;
+}
+
+void to_sink(gpointer UNUSED(key), gpointer value, gpointer port) {
+   struct tun_rec *rec = value;
+   rec->addr4.sin_port   = *(uint16_t *)port;
+   rec->addr6.sin6_port = *(uint16_t *)port;
+}
+
+int main(int argc, char *argv[]) {
+   int val, serv = 0, repeat = 10;
+   char *raw_header = NULL;
+   while((val = getopt(argc, argv, bench_optstring)) != EOF) {
+      switch (val) {
+         case 'm':
+            if (!strcmp(optarg, "serv"))
+               serv = 1;
+            else if (strcmp(optarg, "cli")) {
+               printf("%s", bench_help);
+               return -1;
+            }
+            break;
+         case 'r':
+            repeat = strtol(optarg, NULL, 10); break;
+         case 'x':
+            raw_header = optarg; break;
+         default:
+            printf("%s", bench_help);
+            return -1;
+      }
+   }
+   if (optind >= argc || repeat <= 0 ||
+       (raw_header && strlen(raw_header) / 2 > REPLAY_HEADROOM)) {
+      printf("%s", bench_help);
+      return -1;
+   }
+
+   struct replay_set set;
+   memset(&set, 0, sizeof(set));
+   load_pcap(argv[optind], &set);
+   if (!set.npkts) {
+      fprintf(stderr, "%s: no IP packet\n", argv[optind]);
+      return 1;
+   }
+
+   /* peers of the pcap, full mesh for the serv and cli tables */
+   if (bench_env_init(&env, 0, 1) < 0) {
+      perror("bench environment");
+      return 1;
+   }
+   atexit(cleanup);
+   int npeers = write_dest(env.dest, &set, serv);
+   bench_args(&env, &args, FULLMESH_MODE);
+   args.dual_stack = 1;
+   args.raw_header = raw_header;
+   struct tun_state *state = init_tun_state(&args);
+   stats_register("replay");
+   cycles_register("replay");
+
+   /* discard sinks, never read */
+   int fd_sink4 = udp_sock4(BENCH_SERV_PORT, 1, "127.0.0.1");
+   int fd_sink6 = udp_sock6(BENCH_SERV_PORT, 1, "::1");
+   int rcvbuf = 0;
+   setsockopt(fd_sink4, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+   setsockopt(fd_sink6, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+   uint16_t port = htons(BENCH_SERV_PORT);
+   g_hash_table_foreach(state->dests->serv, (GHFunc) to_sink, &port);
+
+   int fd_net[2] = {state->io->open_udp4(0, 1, state->public_addr4),
+                    state->io->open_udp6(0, 1, state->public_addr6)};
+   const struct fwd_cfg *cfg = state->fwd;
+   int role = serv ? FWD_SERV : FWD_CLI;
+   fwd_in_fn in[2] = {cfg->ops->in[0][role], cfg->ops->in[1][role]};
+
+   /* layer 4.5 header in front of each packet */
+   if (state->raw_header)
+      for (int i = 0; i < set.npkts; i++)
+         memcpy(set.pkts[i].data - state->raw_header_size, state->raw_header,
+                state->raw_header_size);
+
+   uint64_t start = bench_now(), cstart = cycles_now();
+   for (int r = 0; r < repeat; r++) {
+      for (int i = 0; i < set.npkts; i++) {
+         struct replay_pkt *pkt = &set.pkts[i];
+         int v6 = (pkt->data[0] & 0xf0) == 0x60;
+         in[v6](cfg, fd_net[v6], fd_net[v6], pkt->data, pkt->len);
+      }
+   }
+   uint64_t cycles = cycles_now() - cstart;
+   double sec = (bench_now() - start) / 1e9;
+
+   uint64_t pkts = (uint64_t)set.npkts * repeat, bytes = set.bytes * repeat;
+   printf("%s: %d packets (%d skipped), %d peers, %d replays\n",
+          argv[optind], set.npkts, set.skipped, npeers, repeat);
+   printf("%-4s %12" PRIu64 " pkts %12.0f pkts/s %14.0f bytes/s %8.1f cycles/pkt\n",
+          serv ? "serv" : "cli", pkts, pkts / sec, bytes / sec,
+          (double)cycles / pkts);
+   printf("sent %" PRIu64 ", lookup miss %" PRIu64 ", send error %" PRIu64 
+          ", short %" PRIu64 "\n", stats_local->cnt[ST_IN_PKTS],
+          stats_local->cnt[ST_LOOKUP_MISS], stats_local->cnt[ST_SEND_ERR],
+          stats_local->cnt[ST_SHORT_PKT]);
+   return 0;
+}
+
@@ -0,0 +1,327 @@
+/**
+ * \file ccbench_rtt.c
+ * \brief copycat-bench-rtt, tunnel round-trip time benchmark.
+ *
+ *    A child process runs the server loop (tun_serv_fwd) with a
+ *    reflector on its fake tun, and a udp echo socket. The parent runs
+ *    the client loop (tun_cli_fwd) and sends one small inner packet
+ *    at a time through its fake tun to the reflector (tunnel), then
+ *    directly to the echo socket (direct). Both paths cross the
+ *    loopback; the difference is the per-packet latency of copycat.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "state.h"
+#include "pktio.h"
+
+/**
+ * \def RTT_ECHO_PORT
+ * \brief The port of the direct echo socket.
+ */
+#define RTT_ECHO_PORT (BENCH_SERV_PORT + 2)
+
+/**
+ * \def RTT_CLI_ADDR
+ * \brief The private address of the client.
+ */
+#define RTT_CLI_ADDR "10.0.0.1"
+
+/**
+ * \def RTT_SERV_ADDR
+ * \brief The private address of the server (private-address4 of the
+ *        bench configuration).
+ */
+#define RTT_SERV_ADDR "10.255.255.254"
+
+const char *bench_optstring = "hl:n:w:";
+const char *bench_help = "Usage: copycat-bench-rtt [OPTION...]\n"
+"round-trip time through the copycat tunnel and directly (fake io backend)\n\n"
+"  -n NUM                       Pings per path (default: 100000)\n"
+"  -l LEN                       Inner packet length (default: 64)\n"
+"  -w NUM                       Warm-up pings (default: 1000)\n"
+"  -h                           Give this help list\n";
+
+/**
+ * \struct rtt_fwd
+ *	\brief A forwarding loop and its fds.
+ */
+struct rtt_fwd {
+   struct tun_state *state;     /*!< The state */
+   int fd_tun;                  /*!< The fake tun */
+   int fd_net;                  /*!< The udp socket */
+   int serv;                    /*!< Server loop */
+};
+
+/**
+ * \fn static void *fwd_thread(void *arg)
+ * \brief Run a forwarding loop until its inactivity timeout.
+ */
+static void *fwd_thread(void *arg);
+
+/**
+ * \fn static void *reflect_thread(void *arg)
+ * \brief Return the inner packets of the server fake tun, with swapped
+ *        addresses and ports.
+ */
+static void *reflect_thread(void *arg);
+
+/**
+ * \fn static void *echo_thread(void *arg)
+ * \brief Return the datagrams of the direct echo socket.
+ */
+static void *echo_thread(void *arg);
+
+/**
+ * \fn static void setup(int serv, const char *priv, struct rtt_fwd *fwd)
+ * \brief Create the environment and state of one side, its only peer
+ *        is the other side at private address priv.
+ */
+static void setup(int serv, const char *priv, struct rtt_fwd *fwd);
+
+/**
+ * \fn static void ping(const char *path, int fd, struct sockaddr_in *to,
+ *                      int n, int warmup, int len)
+ * \brief Send n + warmup pings one at a time and print the RTT
+ *        percentiles of the last n.
+ */
+static void ping(const char *path, int fd, struct sockaddr_in *to,
+                 int n, int warmup, int len);
+
+/**
+ * \fn static int cmp_u64(const void *a, const void *b)
+ * \brief Sort RTTs.
+ */
+static int cmp_u64(const void *a, const void *b);
+
+/**
+ * \var static struct bench_env env
+ * \brief The bench environment of a process, removed at exit.
+ */
+static struct bench_env env;
+
+/**
+ * \var static struct arguments args
+ * \brief The arguments of a process, used by the state until exit.
+ */
+static struct arguments args;
+
+/**
+ * \fn static void cleanup()
+ * \brief Remove the bench environment.
+ */
+static void cleanup();
+
+void cleanup() {
+   bench_env_free(&env);
+}
+
+void *fwd_thread(void *arg) {
+   struct rtt_fwd *fwd = arg;
+   if (fwd->serv)
+      tun_serv_fwd(fwd->state->fwd, fwd->fd_tun, fwd->fd_net, 0);
+   else
+      tun_cli_fwd(fwd->state->fwd, fwd->fd_tun, fwd->fd_net, 0);
+   return NULL;
+}
+
+void *reflect_thread(void *arg) {
+   int fd = *(int *)arg;
+   char buf[BUFF_SIZE], tmp[4];
+   for (;;) {
+      int len = read(fd, buf, BUFF_SIZE);
+      if (len < 24)
+         continue;
+      memcpy(tmp, buf + 12, 4);
+      memcpy(buf + 12, buf + 16, 4);
+      memcpy(buf + 16, tmp, 4);
+      memcpy(tmp, buf + 20, 2);
+      memcpy(buf + 20, buf + 22, 2);
+      memcpy(buf + 22, tmp, 2);
+      if (write(fd, buf, len) < 0)
+         perror("reflector");
+   }
+   return NULL;
+}
+
+void *echo_thread(void *arg) {
+   int fd = *(int *)arg;
+   char buf[BUFF_SIZE];
+   struct sockaddr_in from;
+   for (;;) {
+      socklen_t slen = sizeof(from);
+      int len = recvfrom(fd, buf, BUFF_SIZE, 0, (struct sockaddr *)&from, &slen);
+      if (len > 0)
+         sendto(fd, buf, len, 0, (struct sockaddr *)&from, slen);
+   }
+   return NULL;
+}
+
+void setup(int serv, const char *priv, struct rtt_fwd *fwd) {
+   if (bench_env_init(&env, 0, 0) < 0) {
+      perror("bench environment");
+      exit(1);
+   }
+   atexit(cleanup);
+   FILE *fp = fopen(env.dest, "w");
+   if (!fp)
+      die("destination file");
+   fprintf(fp, "%d 127.0.0.1 %s\n", BENCH_CLI_PORT, priv);
+   fclose(fp);
+
+   bench_args(&env, &args, serv ? SERV_MODE : CLI_MODE);
+   fwd->serv  = serv;
+   fwd->state = init_tun_state(&args);
+   fwd->state->io->open_tun(fwd->state, &fwd->fd_tun);
+   fwd->fd_net = fwd->state->io->open_udp4(serv ? fwd->state->public_port
+                                                : fwd->state->port,
+                                           1, fwd->state->public_addr4);
+}
+
+int cmp_u64(const void *a, const void *b) {
+   uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+   return x < y ? -1 : x > y;
+}
+
+void ping(const char *path, int fd, struct sockaddr_in *to,
+          int n, int warmup, int len) {
+   char pkt[BUFF_SIZE], buf[BUFF_SIZE];
+   uint64_t *rtt = xmalloc(n * sizeof(uint64_t));
+   uint16_t tot = htons(len), sport = htons(BENCH_CLI_PORT), dport = htons(7);
+   uint16_t ulen = htons(len - 20);
+   in_addr_t saddr, daddr;
+   inet_pton(AF_INET, RTT_CLI_ADDR, &saddr);
+   inet_pton(AF_INET, RTT_SERV_ADDR, &daddr);
+
+   /* inner udp packet, its source port is the client port */
+   memset(pkt, 0, len);
+   pkt[0] = 0x45;
+   memcpy(pkt + 2, &tot, 2);
+   pkt[8] = 64;
+   pkt[9] = IPPROTO_UDP;
+   memcpy(pkt + 12, &saddr, 4);
+   memcpy(pkt + 16, &daddr, 4);
+   memcpy(pkt + 20, &sport, 2);
+   memcpy(pkt + 22, &dport, 2);
+   memcpy(pkt + 24, &ulen, 2);
+
+   struct timeval tv = { .tv_sec = 1 };
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   int lost = 0, k = 0;
+   for (uint32_t seq = 0; seq < (uint32_t)(n + warmup); seq++) {
+      memcpy(pkt + 28, &seq, 4);
+      uint64_t start = bench_now();
+      if (sendto(fd, pkt, len, 0, (struct sockaddr *)to, to ? sizeof(*to) : 0) < 0)
+         die("sendto");
+      /* skip late replies of lost pings */
+      int recvd;
+      uint32_t rseq;
+      do {
+         recvd = recv(fd, buf, BUFF_SIZE, 0);
+         memcpy(&rseq, buf + 28, 4);
+      } while (recvd >= 32 && rseq != seq);
+      uint64_t end = bench_now();
+
+      if (recvd < 32)
+         lost++;
+      else if (seq >= (uint32_t)warmup)
+         rtt[k++] = end - start;
+   }
+
+   if (!k) {
+      printf("%-7s all %d pings lost\n", path, n);
+      free(rtt);
+      return;
+   }
+   qsort(rtt, k, sizeof(uint64_t), cmp_u64);
+   uint64_t sum = 0;
+   for (int i = 0; i < k; i++)
+      sum += rtt[i];
+   printf("%-7s %8d pings %4d lost  min %7.1f  mean %7.1f  p50 %7.1f  "
+          "p99 %7.1f  p99.9 %7.1f  max %8.1f us\n", path, k, lost,
+          rtt[0] / 1e3, sum / 1e3 / k, rtt[k / 2] / 1e3,
+          rtt[(int)(k * 0.99)] / 1e3, rtt[(int)(k * 0.999)] / 1e3,
+          rtt[k - 1] / 1e3);
+   free(rtt);
+}
+
+int main(int argc, char *argv[]) {
+   int val, n = 100000, len = 64, warmup = 1000;
+   while((val = getopt(argc, argv, bench_optstring)) != EOF) {
+      switch (val) {
+         case 'n':
+            n = strtol(optarg, NULL, 10); break;
+         case 'l':
+            len = strtol(optarg, NULL, 10); break;
+         case 'w':
+            warmup = strtol(optarg, NULL, 10); break;
+         default:
+            printf("%s", bench_help);
+            return -1;
+      }
+   }
+   if (n <= 0 || warmup < 0 || len < 32 || len > BUFF_SIZE - 64) {
+      printf("%s", bench_help);
+      return -1;
+   }
+
+   int ready[2];
+   if (pipe(ready) < 0)
+      die("pipe");
+   pid_t pid = fork();
+   if (pid < 0)
+      die("fork");
+
+   struct rtt_fwd fwd;
+   pthread_t tid;
+   if (!pid) {
+      /* server side: loop, reflector and echo socket */
+      setup(1, RTT_CLI_ADDR, &fwd);
+      int fd_app  = pktio_fake_peer(fwd.fd_tun);
+      int fd_echo = udp_sock4(RTT_ECHO_PORT, 1, "127.0.0.1");
+      pthread_create(&tid, NULL, reflect_thread, &fd_app);
+      pthread_create(&tid, NULL, echo_thread, &fd_echo);
+      if (write(ready[1], "", 1) < 0)
+         die("pipe");
+      fwd_thread(&fwd);
+      exit(0);
+   }
+
+   char c;
+   if (read(ready[0], &c, 1) != 1) {
+      fprintf(stderr, "server failed\n");
+      return 1;
+   }
+   setup(0, RTT_SERV_ADDR, &fwd);
+   pthread_create(&tid, NULL, fwd_thread, &fwd);
+
+   /* through the tunnel */
+   ping("tunnel", pktio_fake_peer(fwd.fd_tun), NULL, n, warmup, len);
+
+   /* directly */
+   struct sockaddr_in to;
+   memset(&to, 0, sizeof(to));
+   to.sin_family = AF_INET;
+   to.sin_port   = htons(RTT_ECHO_PORT);
+   inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+   ping("direct", udp_sock4(0, 1, "127.0.0.1"), &to, n, warmup, len);
+
+   /* both loops return after their inactivity timeout */
+   pthread_join(tid, NULL);
+   waitpid(pid, NULL, 0);
+   return 0;
+}
+
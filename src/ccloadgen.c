@@ -0,0 +1,408 @@
+/**
+ * \file ccloadgen.c
+ * \brief copycat-loadgen, a load generator emulating copycat clients.
+ *
+ *    Emulates -n udp mode clients from one process. Client i has its
+ *    own udp socket bound to source port base + i and its own private
+ *    address in the server private network, and sends a TCP-like
+ *    flow (inner tcp source port = source port, as copycat clients
+ *    do) wrapped in the raw header. The aggregate rate is paced in
+ *    1ms ticks over sendmmsg. Packets returned by the server on the
+ *    client sockets are counted. -D writes the destination file of
+ *    the emulated clients, to start the server with (-s -d FILE).
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+
+/**
+ * \def LG_BATCH
+ * \brief Maximal messages of a sendmmsg/recvmmsg.
+ */
+#define LG_BATCH 64
+
+/**
+ * \def LG_TICK
+ * \brief The pacing tick (ns).
+ */
+#define LG_TICK 1000000
+
+/**
+ * \def LG_DRAIN
+ * \brief Time waiting for returns after the last packet (s).
+ */
+#define LG_DRAIN 1
+
+const char *lg_optstring = "a:b:D:hl:L:n:p:P:r:R:T:";
+const char *lg_help = "Usage: copycat-loadgen [OPTION...]\n"
+"emulate copycat clients (udp mode) towards a copycat server\n\n"
+"  -n NUM                       Number of clients (default: 100)\n"
+"  -b PORT                      Source port of the first client (default: 20000)\n"
+"  -L ADDR                      Local public address (default: 127.0.0.1)\n"
+"  -a ADDR                      Server public address (default: 127.0.0.1)\n"
+"  -p PORT                      Server public port (default: 80)\n"
+"  -P ADDR/MASK                 Server private address and mask, clients\n"
+"                               are numbered in this network (default: 192.168.2.1/24)\n"
+"  -r BYTES                     Raw header (hex string)\n"
+"  -R RATE                      Aggregate rate, packets/s (default: 10000)\n"
+"  -l LEN                       Inner packet length (default: 100)\n"
+"  -T SEC                       Duration (default: 10)\n"
+"  -D FILE                      Write the destination file of the clients\n"
+"  -h                           Give this help list\n";
+
+/**
+ * \struct lg_client
+ *	\brief An emulated client.
+ */
+struct lg_client {
+   int       fd;                /*!< The udp socket */
+   uint16_t  sport;             /*!< The source port */
+   in_addr_t priv;              /*!< The private address */
+   uint32_t  seq;               /*!< The inner tcp sequence number */
+   uint64_t  sent;              /*!< Sent packets */
+   uint64_t  rcvd;              /*!< Returned packets */
+   uint64_t  rbytes;            /*!< Returned bytes */
+};
+
+/**
+ * \struct lg_conf
+ *	\brief The load generator settings and counters.
+ */
+struct lg_conf {
+   struct lg_client  *clients;  /*!< The clients */
+   int                n;        /*!< Number of clients */
+   struct sockaddr_in serv;     /*!< The server public address */
+   in_addr_t          serv_priv;/*!< The server private address */
+   unsigned char     *raw;      /*!< The raw header */
+   int                raw_len;  /*!< Its length */
+   int                len;      /*!< The inner packet length */
+   volatile int       done;     /*!< Set when the sender is done */
+   uint64_t           sent;     /*!< Sent packets */
+   uint64_t           send_err; /*!< sendmmsg errors */
+   uint64_t           rcvd;     /*!< Returned packets */
+   uint64_t           rbytes;   /*!< Returned bytes */
+};
+
+/**
+ * \fn static uint16_t csum(const void *data, int len, uint32_t sum)
+ * \brief The internet checksum of data, from a partial sum.
+ */
+static uint16_t csum(const void *data, int len, uint32_t sum);
+
+/**
+ * \fn static int build_pkt(struct lg_conf *lg, struct lg_client *c, char *buf)
+ * \brief Write the raw header and a TCP-like inner packet of a client.
+ *
+ * \return The packet length
+ */
+static int build_pkt(struct lg_conf *lg, struct lg_client *c, char *buf);
+
+/**
+ * \fn static void send_pkts(struct lg_conf *lg, struct lg_client *c, int k)
+ * \brief Send k packets of a client.
+ */
+static void send_pkts(struct lg_conf *lg, struct lg_client *c, int k);
+
+/**
+ * \fn static void *recv_thread(void *arg)
+ * \brief Count the packets returned on the client sockets.
+ */
+static void *recv_thread(void *arg);
+
+uint16_t csum(const void *data, int len, uint32_t sum) {
+   const uint8_t *p = data;
+   for (; len > 1; len -= 2, p += 2)
+      sum += (p[0] << 8) | p[1];
+   if (len)
+      sum += p[0] << 8;
+   while (sum >> 16)
+      sum = (sum & 0xffff) + (sum >> 16);
+   return htons(~sum);
+}
+
+int build_pkt(struct lg_conf *lg, struct lg_client *c, char *buf) {
+   memcpy(buf, lg->raw, lg->raw_len);
+   char *ip = buf + lg->raw_len, *tcp = ip + 20;
+   uint16_t tot = htons(lg->len), sport = htons(c->sport), dport = htons(80);
+   uint16_t win = htons(65535), sum;
+   uint32_t seq = htonl(c->seq), ack = 0;
+   memset(ip, 0, 40);
+   memset(tcp + 20, 'x', lg->len - 40);
+
+   /* ip header */
+   ip[0] = 0x45;
+   memcpy(ip + 2, &tot, 2);
+   ip[8] = 64;
+   ip[9] = IPPROTO_TCP;
+   memcpy(ip + 12, &c->priv, 4);
+   memcpy(ip + 16, &lg->serv_priv, 4);
+   sum = csum(ip, 20, 0);
+   memcpy(ip + 10, &sum, 2);
+
+   /* tcp header, ack|psh of the next segment */
+   memcpy(tcp, &sport, 2);
+   memcpy(tcp + 2, &dport, 2);
+   memcpy(tcp + 4, &seq, 4);
+   memcpy(tcp + 8, &ack, 4);
+   tcp[12] = 5 << 4;
+   tcp[13] = 0x18;
+   memcpy(tcp + 14, &win, 2);
+   uint32_t pseudo = ntohs(c->priv >> 16) + ntohs(c->priv & 0xffff)
+                   + ntohs(lg->serv_priv >> 16) + ntohs(lg->serv_priv & 0xffff)
+                   + IPPROTO_TCP + lg->len - 20;
+   sum = csum(tcp, lg->len - 20, pseudo);
+   memcpy(tcp + 16, &sum, 2);
+
+   c->seq += lg->len - 40;
+   return lg->raw_len + lg->len;
+}
+
+void send_pkts(struct lg_conf *lg, struct lg_client *c, int k) {
+   static char bufs[LG_BATCH][BUFF_SIZE];
+   struct mmsghdr msgs[LG_BATCH];
+   struct iovec iovs[LG_BATCH];
+
+   while (k > 0) {
+      int batch = k < LG_BATCH ? k : LG_BATCH;
+      for (int i = 0; i < batch; i++) {
+         iovs[i].iov_base = bufs[i];
+         iovs[i].iov_len  = build_pkt(lg, c, bufs[i]);
+         memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+         msgs[i].msg_hdr.msg_iov     = &iovs[i];
+         msgs[i].msg_hdr.msg_iovlen  = 1;
+         msgs[i].msg_hdr.msg_name    = &lg->serv;
+         msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      }
+      int ret = sendmmsg(c->fd, msgs, batch, 0);
+      if (ret < 0)
+         lg->send_err += batch;
+      else {
+         c->sent  += ret;
+         lg->sent += ret;
+         lg->send_err += batch - ret;
+      }
+      k -= batch;
+   }
+}
+
+void *recv_thread(void *arg) {
+   struct lg_conf *lg = arg;
+   int ep = epoll_create1(0);
+   if (ep < 0)
+      die("epoll_create1");
+   for (int i = 0; i < lg->n; i++) {
+      struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &lg->clients[i] };
+      if (epoll_ctl(ep, EPOLL_CTL_ADD, lg->clients[i].fd, &ev) < 0)
+         die("epoll_ctl");
+   }
+
+   static char bufs[LG_BATCH][BUFF_SIZE];
+   struct mmsghdr msgs[LG_BATCH];
+   struct iovec iovs[LG_BATCH];
+   struct epoll_event evs[LG_BATCH];
+   uint64_t drain = 0;
+   for (;;) {
+      if (lg->done && !drain)
+         drain = bench_now() + LG_DRAIN * 1000000000ULL;
+      if (drain && bench_now() > drain)
+         break;
+
+      int nev = epoll_wait(ep, evs, LG_BATCH, 100);
+      for (int e = 0; e < nev; e++) {
+         struct lg_client *c = evs[e].data.ptr;
+         for (int i = 0; i < LG_BATCH; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len  = BUFF_SIZE;
+            memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+            msgs[i].msg_hdr.msg_iov    = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+         }
+         int ret = recvmmsg(c->fd, msgs, LG_BATCH, MSG_DONTWAIT, NULL);
+         for (int i = 0; i < ret; i++) {
+            c->rbytes += msgs[i].msg_len;
+            __atomic_add_fetch(&lg->rbytes, msgs[i].msg_len, __ATOMIC_RELAXED);
+         }
+         if (ret > 0) {
+            c->rcvd += ret;
+            __atomic_add_fetch(&lg->rcvd, ret, __ATOMIC_RELAXED);
+         }
+      }
+   }
+   close(ep);
+   return NULL;
+}
+
+int main(int argc, char *argv[]) {
+   struct lg_conf lg;
+   memset(&lg, 0, sizeof(lg));
+   int val, n = 100, base = 20000, port = 80, mask = 24, duration = 10;
+   double rate = 10000;
+   char *local = "127.0.0.1", *serv = "127.0.0.1", *priv = "192.168.2.1";
+   char *raw = NULL, *dest = NULL;
+   lg.len = 100;
+
+   while((val = getopt(argc, argv, lg_optstring)) != EOF) {
+      switch (val) {
+         case 'n':
+            n = strtol(optarg, NULL, 10); break;
+         case 'b':
+            base = strtol(optarg, NULL, 10); break;
+         case 'L':
+            local = optarg; break;
+         case 'a':
+            serv = optarg; break;
+         case 'p':
+            port = strtol(optarg, NULL, 10); break;
+         case 'P': {
+            char *slash = strchr(optarg, '/');
+            if (slash) {
+               *slash = 0;
+               mask = strtol(slash + 1, NULL, 10);
+            }
+            priv = optarg;
+            break;
+         }
+         case 'r':
+            raw = optarg; break;
+         case 'R':
+            rate = strtod(optarg, NULL); break;
+         case 'l':
+            lg.len = strtol(optarg, NULL, 10); break;
+         case 'T':
+            duration = strtol(optarg, NULL, 10); break;
+         case 'D':
+            dest = optarg; break;
+         default:
+            printf("%s", lg_help);
+            return -1;
+      }
+   }
+   lg.serv.sin_family = AF_INET;
+   lg.serv.sin_port   = htons(port);
+   if (n <= 0 || base <= 0 || base + n > 65536 || rate <= 0 || duration <= 0 ||
+       mask < 8 || mask > 30 || lg.len < 40 || lg.len > BUFF_SIZE - 256 ||
+       inet_pton(AF_INET, serv, &lg.serv.sin_addr) != 1 ||
+       inet_pton(AF_INET, priv, &lg.serv_priv) != 1) {
+      printf("%s", lg_help);
+      return -1;
+   }
+
+   /* raw header */
+   if (raw) {
+      lg.raw_len = strlen(raw) / 2;
+      lg.raw = xmalloc(lg.raw_len);
+      for (int i = 0; i < lg.raw_len; i++) {
+         char buf[3] = {raw[2*i], raw[2*i+1], 0};
+         lg.raw[i] = strtol(buf, NULL, 16);
+      }
+   }
+
+   /* clients, numbered in the private network without the server */
+   uint32_t net = ntohl(lg.serv_priv) & ~((1U << (32 - mask)) - 1);
+   uint32_t hosts = (1U << (32 - mask)) - 2;
+   if ((uint32_t)n > hosts - 1) {
+      fprintf(stderr, "%d clients do not fit in /%d\n", n, mask);
+      return 1;
+   }
+   struct rlimit rl;
+   if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+      rl.rlim_cur = rl.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &rl);
+   }
+
+   FILE *fp = NULL;
+   if (dest && !(fp = fopen(dest, "w")))
+      die("destination file");
+   lg.clients = calloc(n, sizeof(struct lg_client));
+   lg.n       = n;
+   for (int i = 0, host = 1; i < n; i++, host++) {
+      struct lg_client *c = &lg.clients[i];
+      if (htonl(net + host) == lg.serv_priv)
+         host++;
+      c->priv  = htonl(net + host);
+      c->sport = base + i;
+      c->seq   = i * 1000003U;
+      c->fd    = udp_sock4(c->sport, 0, local);
+      if (fp) {
+         char buf[INET_ADDRSTRLEN];
+         inet_ntop(AF_INET, &c->priv, buf, sizeof(buf));
+         fprintf(fp, "%d %s %s\n", c->sport, local, buf);
+      }
+   }
+   if (fp)
+      fclose(fp);
+
+   pthread_t tid;
+   pthread_create(&tid, NULL, recv_thread, &lg);
+
+   /* pace the aggregate rate in ticks, clients in round robin */
+   uint64_t start = bench_now(), end = start + duration * 1000000000ULL;
+   uint64_t last_sent = 0, last_rcvd = 0, report = start + 1000000000ULL;
+   struct timespec next;
+   clock_gettime(CLOCK_MONOTONIC, &next);
+   uint64_t scheduled = 0;
+   int cursor = 0;
+   while (bench_now() < end) {
+      /* catch up on late ticks */
+      uint64_t target = rate * (bench_now() - start) / 1e9;
+      int q = target - scheduled;
+      scheduled = target;
+
+      int each = q / n, rem = q % n;
+      for (int i = 0; i < (each ? n : rem); i++) {
+         int k = each + (i < rem);
+         send_pkts(&lg, &lg.clients[(cursor + i) % n], k);
+      }
+      cursor = (cursor + rem) % n;
+
+      uint64_t now = bench_now();
+      if (now >= report) {
+         uint64_t rcvd = __atomic_load_n(&lg.rcvd, __ATOMIC_RELAXED);
+         printf("%4" PRIu64 "s sent %10" PRIu64 " pkts/s returned %10" PRIu64 " pkts/s\n",
+                (uint64_t)((report - start) / 1000000000ULL), lg.sent - last_sent, rcvd - last_rcvd);
+         fflush(stdout);
+         last_sent = lg.sent;
+         last_rcvd = rcvd;
+         report += 1000000000ULL;
+      }
+
+      next.tv_nsec += LG_TICK;
+      if (next.tv_nsec >= 1000000000L) {
+         next.tv_sec++;
+         next.tv_nsec -= 1000000000L;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+   }
+   double sec = (bench_now() - start) / 1e9;
+   lg.done = 1;
+   pthread_join(tid, NULL);
+
+   int answered = 0;
+   for (int i = 0; i < n; i++)
+      answered += lg.clients[i].rcvd > 0;
+   printf("clients %d, sent %" PRIu64 " pkts (%.0f pkts/s, %.1f Mbit/s), "
+          "send errors %" PRIu64 "\n", n, lg.sent, lg.sent / sec,
+          lg.sent * (lg.raw_len + lg.len) * 8 / sec / 1e6, lg.send_err);
+   printf("returned %" PRIu64 " pkts, %" PRIu64 " bytes (%.1f%%), "
+          "clients with returns %d\n", lg.rcvd, lg.rbytes,
+          lg.sent ? 100.0 * lg.rcvd / lg.sent : 0, answered);
+   return 0;
+}
+
@@ -0,0 +1,186 @@
+/**
+ * \file ccstat.c
+ * \brief copycat-stat, a reader of copycat stats files.
+ *
+ *    The stats file is mapped read-only, the running copycat
+ *    is never interrupted. Time series files (stats-interval)
+ *    are converted to CSV with -c.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+const char *stat_optstring = "chpw:";
+const char *stat_help = "Usage: copycat-stat [OPTION...] FILE\n"
+"print the data path counters of a running copycat\n\n"
+"  -c                           Convert a time series FILE to CSV\n"
+"  -p                           Print per-peer counters\n"
+"  -w SEC                       Print every SEC seconds\n"
+"  -h                           Give this help list\n\n"
+"FILE is <output-dir>/stats[.<run-id>].mmap, or\n"
+"<output-dir>/stats[.<run-id>].bin with -c\n";
+
+/**
+ * \fn static void print_stats(const struct stats_header *hdr, int peers)
+ * \brief Print the counters of a mapped stats file.
+ *
+ * \param hdr The mapped file
+ * \param peers Print per-peer counters
+ */
+static void print_stats(const struct stats_header *hdr, int peers);
+
+void print_stats(const struct stats_header *hdr, int peers) {
+   const struct stats_thread *blocks = (const struct stats_thread *)
+                                      ((const char *)hdr + hdr->thread_off);
+   uint32_t nthreads = hdr->nthreads < hdr->max_threads ?
+                       hdr->nthreads : hdr->max_threads;
+   uint64_t total[ST_COUNTERS];
+   memset(total, 0, sizeof(total));
+
+   printf("%-16s", "thread");
+   for (int c = 0; c < ST_COUNTERS; c++)
+      printf(" %12s", stats_names[c]);
+   printf("\n");
+
+   for (uint32_t i = 0; i < nthreads; i++) {
+      printf("%-16.16s", blocks[i].name);
+      for (int c = 0; c < ST_COUNTERS; c++) {
+         uint64_t v = __atomic_load_n(&blocks[i].cnt[c], __ATOMIC_RELAXED);
+         total[c] += v;
+         printf(" %12" PRIu64, v);
+      }
+      printf("\n");
+   }
+   printf("%-16s", "total");
+   for (int c = 0; c < ST_COUNTERS; c++)
+      printf(" %12" PRIu64, total[c]);
+   printf("\n");
+
+   if (!peers || !hdr->npeers)
+      return;
+
+   const struct stats_peer *p = (const struct stats_peer *)
+                               ((const char *)hdr + hdr->peer_off);
+   printf("\n%-8s %12s %12s %12s %12s\n", "peer",
+          "in_pkts", "in_bytes", "out_pkts", "out_bytes");
+   for (uint32_t i = 0; i < hdr->npeers; i++)
+      printf("%-8u %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+             i, p[i].in_pkts, p[i].in_bytes, p[i].out_pkts, p[i].out_bytes);
+}
+
+/**
+ * \fn static int print_csv(const char *file)
+ * \brief Convert a time series file to CSV on stdout. The first
+ *        column is the unix time (s), followed by the counters.
+ *
+ * \param file The time series file
+ * \return 0 for success, 1 on error
+ */
+static int print_csv(const char *file);
+
+int print_csv(const char *file) {
+   FILE *fp = fopen(file, "r");
+   if (!fp) {
+      perror(file);
+      return 1;
+   }
+   struct stats_series_header hdr;
+   if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != STATS_SERIES_MAGIC) {
+      fprintf(stderr, "%s: not a time series file\n", file);
+      fclose(fp);
+      return 1;
+   }
+   if (hdr.version != STATS_VERSION || hdr.counters != ST_COUNTERS) {
+      fprintf(stderr, "%s: bad version\n", file);
+      fclose(fp);
+      return 1;
+   }
+
+   printf("time");
+   for (int c = 0; c < ST_COUNTERS; c++)
+      printf(",%s", stats_names[c]);
+   printf("\n");
+
+   /* a truncated last record (killed copycat) is ignored */
+   struct stats_record rec;
+   while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+      uint64_t t = hdr.start_time + rec.time;
+      printf("%" PRIu64 ".%09" PRIu64, t / 1000000000, t % 1000000000);
+      for (int c = 0; c < ST_COUNTERS; c++)
+         printf(",%" PRIu64, rec.cnt[c]);
+      printf("\n");
+   }
+   fclose(fp);
+   return 0;
+}
+
+int main(int argc, char *argv[]) {
+   int val, peers = 0, interval = 0, csv = 0;
+   while((val = getopt(argc, argv, stat_optstring)) != EOF) {
+      switch (val) {
+         case 'c':
+            csv = 1; break;
+         case 'p':
+            peers = 1; break;
+         case 'w':
+            interval = strtol(optarg, NULL, 10); break;
+         default:
+            printf("%s", stat_help);
+            return -1;
+      }
+   }
+   if (optind >= argc) {
+      printf("%s", stat_help);
+      return -1;
+   }
+   if (csv)
+      return print_csv(argv[optind]);
+
+   int fd = open(argv[optind], O_RDONLY);
+   if (fd < 0) {
+      perror(argv[optind]);
+      return 1;
+   }
+   struct stat st;
+   if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct stats_header)) {
+      fprintf(stderr, "%s: not a stats file\n", argv[optind]);
+      return 1;
+   }
+   const struct stats_header *hdr = mmap(NULL, st.st_size, PROT_READ,
+                                         MAP_SHARED, fd, 0);
+   close(fd);
+   if (hdr == MAP_FAILED) {
+      perror("mmap");
+      return 1;
+   }
+   if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+       hdr->version != STATS_VERSION) {
+      fprintf(stderr, "%s: bad magic or version\n", argv[optind]);
+      return 1;
+   }
+   printf("copycat pid %u, %u peers\n", hdr->pid, hdr->npeers);
+
+   do {
+      print_stats(hdr, peers);
+      if (interval) {
+         sleep(interval);
+         printf("\n");
+      }
+   } while (interval);
+
+   munmap((void *)hdr, st.st_size);
+   return 0;
+}
+
@@ -0,0 +1,126 @@
+/**
+ * \file cctest_learn.c
+ * \brief copycat-test-learn, per-peer counters of learned peers.
+ *
+ *    Runs the server decapsulation of fwd.c (built with UNLOCKED) on
+ *    the fake io backend: a peer of the destination file and a peer
+ *    that is not in it each send two datagrams. The second one is
+ *    learned from its first datagram, and must only count in the
+ *    thread totals, then kept across a destination reload. No
+ *    privileges are needed.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+#include "state.h"
+#include "stats.h"
+#include "sock.h"
+#include "fwd.h"
+#include "reload.h"
+
+/**
+ * \def TEST_NDEST
+ * \brief The number of peers of the destination file.
+ */
+#define TEST_NDEST 4
+
+/**
+ * \def TEST_LEN
+ * \brief The length of a tunneled packet.
+ */
+#define TEST_LEN 64
+
+/**
+ * \var static struct bench_env env
+ * \brief The test environment, removed at exit.
+ */
+static struct bench_env env;
+
+/**
+ * \var static struct arguments args
+ * \brief The program arguments, used by the state until exit.
+ */
+static struct arguments args;
+
+/**
+ * \fn static void cleanup()
+ * \brief Remove the test environment.
+ */
+static void cleanup();
+
+/**
+ * \fn static void send_from(struct fwd_worker *w, int fd_net, int sport,
+ *                           int public_port)
+ * \brief Send a datagram from source port sport to the server socket,
+ *        and decapsulate it.
+ */
+static void send_from(struct fwd_worker *w, int fd_net, int sport,
+                      int public_port);
+
+void cleanup() {
+   bench_env_free(&env);
+}
+
+void send_from(struct fwd_worker *w, int fd_net, int sport, int public_port) {
+   char buf[TEST_LEN];
+   struct sockaddr_in to;
+   memset(&to, 0, sizeof(to));
+   to.sin_family = AF_INET;
+   to.sin_port   = htons(public_port);
+   inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+
+   int fd = udp_sock4(sport, 0, "127.0.0.1");
+   bench_pkt4(buf, TEST_LEN, bench_priv4(0));
+   if (sendto(fd, buf, TEST_LEN, 0, (struct sockaddr *)&to, sizeof(to)) < 0)
+      die("sendto");
+   close(fd);
+   fwd_net_out(w, fd_net, 0, 1);
+}
+
+int main() {
+   if (bench_env_init(&env, TEST_NDEST, 0) < 0) {
+      perror("test environment");
+      return 1;
+   }
+   atexit(cleanup);
+   bench_args(&env, &args, SERV_MODE);
+   struct tun_state *state = init_tun_state(&args);
+
+   int fd_tun;
+   state->io->open_tun(state, &fd_tun);
+   int fd_net = state->io->open_udp4(state->public_port, 0, state->public_addr4);
+   struct fwd_worker w;
+   fwd_worker_init(&w, state->fwd, FWD_SERV, fd_tun, 0, fd_net, 0, 0);
+
+   /* a known peer (id 0), and a learned one */
+   for (int i = 0; i < 2; i++) {
+      send_from(&w, fd_net, BENCH_SPORT, state->public_port);
+      send_from(&w, fd_net, BENCH_SPORT + TEST_NDEST, state->public_port);
+   }
+   fwd_worker_free(&w);
+   if (reload_dests(state) < 0 ||
+       !lookup_serv(state->fwd, BENCH_SPORT + TEST_NDEST)) {
+      fprintf(stderr, "learned peer lost on reload\n");
+      return 1;
+   }
+
+   uint64_t total = stats_local->cnt[ST_OUT_PKTS], peers = 0;
+   for (uint32_t i = 0; i < stats_npeers; i++)
+      peers += stats_peers[i].out_pkts;
+   printf("total %" PRIu64 " peer0 %" PRIu64 " peers %" PRIu64 "\n",
+          total, stats_peers[0].out_pkts, peers);
+   if (total != 4 || stats_peers[0].out_pkts != 2 || peers != 2) {
+      fprintf(stderr, "learned peer counted as a destination\n");
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * \file cctrace.c
+ * \brief copycat-trace, a decoder of copycat trace files.
+ *
+ *    Prints one line per event, or the number of events of each
+ *    kind per thread with -s.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+
+#include "trace.h"
+
+const char *trace_optstring = "hrs";
+const char *trace_help = "Usage: copycat-trace [OPTION...] FILE\n"
+"decode a copycat event trace\n\n"
+"  -r                           Print time relative to the first event\n"
+"  -s                           Print event counts per thread\n"
+"  -h                           Give this help list\n\n"
+"FILE is <output-dir>/trace[.<run-id>].bin\n";
+
+/**
+ * \var static const char *trace_names[TR_EVENTS]
+ * \brief Event names, indexed by enum trace_event.
+ */
+static const char *trace_names[TR_EVENTS] = {
+   "thread", "lost", "tun_read", "tun_write", "udp_send", "udp_recv",
+   "lookup_miss", "new_peer", "unknown_peer", "short_pkt", "non_ip", "icmp"
+};
+
+/**
+ * \var static char thread_names[TRACE_MAX_THREADS][9]
+ * \brief Thread names, from TR_THREAD records.
+ */
+static char thread_names[TRACE_MAX_THREADS][9];
+
+/**
+ * \fn static void print_args(const struct trace_rec *rec)
+ * \brief Print the arguments of a record according to its event.
+ *
+ * \param rec The record
+ */
+static void print_args(const struct trace_rec *rec);
+
+void print_args(const struct trace_rec *rec) {
+   switch (rec->event) {
+      case TR_THREAD:
+         printf("tid=%u name=%s", rec->a0, thread_names[rec->a0 % TRACE_MAX_THREADS]);
+         break;
+      case TR_LOST:
+         printf("tid=%u count=%" PRIu64, rec->a0, rec->a1);
+         break;
+      case TR_TUN_WRITE:
+      case TR_UDP_SEND:
+         printf("len=%d", (int32_t)rec->a0);
+         if (rec->a1 != TRACE_NO_PEER)
+            printf(" peer=%" PRIu64, rec->a1);
+         break;
+      case TR_LOOKUP_MISS:
+         printf("proto=%u sport=%u dport=%u", rec->a0,
+                (unsigned)(rec->a1 >> 16) & 0xffff, (unsigned)rec->a1 & 0xffff);
+         break;
+      case TR_NEW_PEER:
+      case TR_UNKNOWN_PEER:
+         printf("sport=%u", rec->a0);
+         break;
+      case TR_NON_IP:
+         printf("byte=0x%02x", rec->a0 & 0xff);
+         break;
+      case TR_ICMP:
+         printf("type=%u code=%" PRIu64, rec->a0, rec->a1);
+         break;
+      default:
+         printf("len=%d", (int32_t)rec->a0);
+         break;
+   }
+}
+
+int main(int argc, char *argv[]) {
+   int val, relative = 0, summary = 0;
+   while((val = getopt(argc, argv, trace_optstring)) != EOF) {
+      switch (val) {
+         case 'r':
+            relative = 1; break;
+         case 's':
+            summary = 1; break;
+         default:
+            printf("%s", trace_help);
+            return -1;
+      }
+   }
+   if (optind >= argc) {
+      printf("%s", trace_help);
+      return -1;
+   }
+
+   FILE *fp = fopen(argv[optind], "r");
+   if (!fp) {
+      perror(argv[optind]);
+      return 1;
+   }
+   struct trace_header hdr;
+   if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != TRACE_MAGIC) {
+      fprintf(stderr, "%s: not a trace file\n", argv[optind]);
+      return 1;
+   }
+   if (hdr.version != TRACE_VERSION || hdr.rec_size != sizeof(struct trace_rec)) {
+      fprintf(stderr, "%s: bad version\n", argv[optind]);
+      return 1;
+   }
+
+   uint64_t counts[TRACE_MAX_THREADS][TR_EVENTS];
+   memset(counts, 0, sizeof(counts));
+   uint64_t first = 0;
+   struct trace_rec rec;
+   while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+      unsigned int tid = rec.tid % TRACE_MAX_THREADS;
+      if (rec.event == TR_THREAD)
+         memcpy(thread_names[rec.a0 % TRACE_MAX_THREADS], &rec.a1, 8);
+      if (rec.event >= TR_EVENTS)
+         continue;
+      if (summary) {
+         counts[tid][rec.event] += rec.event == TR_LOST ? rec.a1 : 1;
+         continue;
+      }
+
+      if (!first)
+         first = rec.time;
+      uint64_t t = relative ? rec.time - first
+                            : hdr.real_time + (rec.time - hdr.mono_time);
+      printf("%" PRIu64 ".%09" PRIu64 " %-8s %-12s ", t / 1000000000,
+             t % 1000000000, thread_names[tid][0] ? thread_names[tid] : "-",
+             trace_names[rec.event]);
+      print_args(&rec);
+      printf("\n");
+   }
+   fclose(fp);
+
+   if (summary) {
+      printf("%-8s", "thread");
+      for (int e = TR_LOST; e < TR_EVENTS; e++)
+         printf(" %12s", trace_names[e]);
+      printf("\n");
+      for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+         if (!thread_names[i][0])
+            continue;
+         printf("%-8s", thread_names[i]);
+         for (int e = TR_LOST; e < TR_EVENTS; e++)
+            printf(" %12" PRIu64, counts[i][e]);
+         printf("\n");
+      }
+   }
+   return 0;
+}
+
@@ -18,6 +18,21 @@
  */ 
 void tun_cli(struct arguments *args);
 
+struct fwd_cfg;
+
+/**
+ * \fn void tun_cli_fwd(const struct fwd_cfg *cfg, int fd_tun, 
+ *                      int fd_net4, int fd_net6)
+ * \brief Run the client forwarding loop until shutdown or inactivity
+ *        timeout. The unused socket of single stack modes is 0.
+ *
+ * \param cfg The forwarding configuration.
+ * \param fd_tun The tun interface fd.
+ * \param fd_net4 The v4 socket fd.
+ * \param fd_net6 The v6 socket fd.
+ */ 
+void tun_cli_fwd(const struct fwd_cfg *cfg, int fd_tun, int fd_net4, int fd_net6);
+
 /**
  * \fn void cli_shutdown(int sig)
  * \brief Callback function for SIGINT catcher.
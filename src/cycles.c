@@ -0,0 +1,72 @@
+/**
+ * \file cycles.c
+ * \brief Per-stage cycle accounting of the forwarding functions.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cycles.h"
+
+#if defined(CYCLES)
+
+/**
+ * \var static struct cycles_thread threads[CYCLES_MAX_THREADS]
+ * \brief The counters of registered threads.
+ */
+static struct cycles_thread threads[CYCLES_MAX_THREADS];
+
+/**
+ * \var static uint32_t nthreads
+ * \brief The number of registered threads.
+ */
+static uint32_t nthreads;
+
+/**
+ * \var static struct cycles_thread cycles_private
+ * \brief The counters of unregistered threads.
+ */
+static struct cycles_thread cycles_private;
+
+__thread struct cycles_thread *cycles_local = &cycles_private;
+
+static const char *stage_names[CY_STAGES] = {
+   "parse", "lookup", "encap", "syscall"
+};
+
+void cycles_register(const char *name) {
+   uint32_t i = __atomic_fetch_add(&nthreads, 1, __ATOMIC_ACQ_REL);
+   if (i >= CYCLES_MAX_THREADS)
+      return;
+   strncpy(threads[i].name, name, sizeof(threads[i].name) - 1);
+   cycles_local = &threads[i];
+}
+
+void cycles_dump() {
+   uint32_t n = __atomic_load_n(&nthreads, __ATOMIC_ACQUIRE);
+   if (n > CYCLES_MAX_THREADS)
+      n = CYCLES_MAX_THREADS;
+
+   fprintf(stderr, "%-16s %12s", "cycles/pkt", "pkts");
+   for (int s = 0; s < CY_STAGES; s++)
+      fprintf(stderr, " %14s", stage_names[s]);
+   fprintf(stderr, " %10s\n", "total");
+
+   for (uint32_t i = 0; i < n; i++) {
+      const struct cycles_thread *t = &threads[i];
+      uint64_t total = 0;
+      for (int s = 0; s < CY_STAGES; s++)
+         total += t->cyc[s];
+      fprintf(stderr, "%-16s %12lu", t->name, (unsigned long)t->pkts);
+      for (int s = 0; s < CY_STAGES; s++)
+         fprintf(stderr, " %7.1f (%3.0f%%)",
+                 t->pkts ? (double)t->cyc[s] / t->pkts : 0.0,
+                 total ? 100.0 * t->cyc[s] / total : 0.0);
+      fprintf(stderr, " %10.1f\n", t->pkts ? (double)total / t->pkts : 0.0);
+   }
+}
+
+#endif /* CYCLES */
+
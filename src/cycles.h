@@ -0,0 +1,135 @@
+/**
+ * \file cycles.h
+ * \brief Per-stage cycle accounting of the forwarding functions.
+ *
+ *    Built with --enable-cycles (CYCLES defined), the forwarding
+ *    functions read the time stamp counter between their parse,
+ *    lookup, encapsulation and syscall stages. Cycles of forwarded
+ *    packets are accumulated in per-thread counters, and a breakdown
+ *    is printed at exit. Otherwise the macros are removed, cycles_now
+ *    is available in all builds.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_CYCLES_H
+#define UDPTUN_CYCLES_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * \enum cycles_stage
+ * \brief Forwarding stages.
+ */
+enum cycles_stage {
+   CY_PARSE = 0,  /*!< header parsing */
+   CY_LOOKUP,     /*!< destination lookup */
+   CY_ENCAP,      /*!< layer 4.5 header and PPI push/strip */
+   CY_SYSCALL,    /*!< tun and socket syscalls */
+   CY_STAGES      /*!< number of stages */
+};
+
+/**
+ * \fn static inline uint64_t cycles_now()
+ * \brief Read the time stamp counter (or a ns clock if there is none).
+ */
+static inline uint64_t cycles_now() {
+#if defined(__x86_64__) || defined(__i386__)
+   uint32_t lo, hi;
+   __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+   return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+   uint64_t v;
+   __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+   return v;
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#if defined(CYCLES)
+
+/**
+ * \def CYCLES_MAX_THREADS
+ * \brief The maximal number of accounted threads.
+ */
+#define CYCLES_MAX_THREADS 16
+
+/**
+ * \struct cycles_thread
+ *	\brief The cycle counters of a forwarding thread.
+ */
+struct cycles_thread {
+   char     name[16];           /*!< The thread name */
+   uint64_t pkts;               /*!< Forwarded packets */
+   uint64_t cyc[CY_STAGES];     /*!< Cycles per stage */
+} __attribute__((aligned(64)));
+
+/**
+ * \var extern __thread struct cycles_thread *cycles_local
+ * \brief The counters of the calling thread.
+ */
+extern __thread struct cycles_thread *cycles_local;
+
+/**
+ * \def CYCLES_START()
+ * \brief Start accounting a packet in the current function.
+ */
+#define CYCLES_START() uint64_t _cy[CY_STAGES] = {0}; \
+                       uint64_t _cy_t = cycles_now()
+
+/**
+ * \def CYCLES_STAGE(s)
+ * \brief Account the cycles since the last stage to stage s.
+ */
+#define CYCLES_STAGE(s) do { \
+      uint64_t _cy_n = cycles_now(); \
+      _cy[(s)] += _cy_n - _cy_t; \
+      _cy_t = _cy_n; \
+   } while (0)
+
+/**
+ * \def CYCLES_END()
+ * \brief Commit the cycles of a forwarded packet. Dropped packets
+ *        are not committed.
+ */
+#define CYCLES_END() do { \
+      cycles_local->pkts++; \
+      for (int _cy_s = 0; _cy_s < CY_STAGES; _cy_s++) \
+         cycles_local->cyc[_cy_s] += _cy[_cy_s]; \
+   } while (0)
+
+/**
+ * \fn void cycles_register(const char *name)
+ * \brief Attach counters to the calling thread.
+ *
+ * \param name The thread name
+ */
+void cycles_register(const char *name);
+
+/**
+ * \fn void cycles_dump()
+ * \brief Print the cycles per packet per stage of each thread.
+ */
+void cycles_dump();
+
+#else
+
+#define CYCLES_START()
+#define CYCLES_STAGE(s)
+#define CYCLES_END()
+#define cycles_register(name)
+#define cycles_dump()
+
+#endif /* CYCLES */
+
+#endif
+
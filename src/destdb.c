@@ -0,0 +1,300 @@
+/**
+ * \file destdb.c
+ * \brief Compiled destination database.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "destdb.h"
+#include "state.h"
+#include "parse.h"
+#include "udptun.h"
+#include "sock.h"
+
+/**
+ * \def DESTDB_ALIGN
+ * \brief The alignment of the database sections.
+ */
+#define DESTDB_ALIGN 64
+
+/**
+ * \fn static uint32_t hash_u32(uint32_t key, uint32_t shift)
+ * \brief Fibonacci hash of a 32 bits key.
+ */
+static uint32_t hash_u32(uint32_t key, uint32_t shift);
+
+/**
+ * \fn static uint32_t hash_addr6(const void *addr, uint32_t shift)
+ * \brief Hash of a 16 bytes v6 address.
+ */
+static uint32_t hash_addr6(const void *addr, uint32_t shift);
+
+/**
+ * \fn static uint64_t align(uint64_t off)
+ * \brief Align a section offset.
+ */
+static uint64_t align(uint64_t off);
+
+/**
+ * \fn static int write_all(int fd, const void *buf, size_t len)
+ * \brief Write a whole buffer, across short writes.
+ *
+ * \return 0 for success, -1 on error (errno is filled)
+ */
+static int write_all(int fd, const void *buf, size_t len);
+
+/**
+ * \fn static int write_section(int fd, const void *buf, size_t len)
+ * \brief Write a buffer, zero padded to the next section.
+ *
+ * \return 0 for success, -1 on error (errno is filled)
+ */
+static int write_section(int fd, const void *buf, size_t len);
+
+/**
+ * \fn static int check_idx(const uint32_t *idx, uint32_t nslots,
+ *                          uint32_t count)
+ * \brief Check that every index entry points to a record and that one
+ *        slot at least is empty, so that probes terminate.
+ *
+ * \return 0 if the index is valid, -1 otherwise
+ */
+static int check_idx(const uint32_t *idx, uint32_t nslots, uint32_t count);
+
+uint32_t hash_u32(uint32_t key, uint32_t shift) {
+   return (key * 2654435761u) >> shift;
+}
+
+uint32_t hash_addr6(const void *addr, uint32_t shift) {
+   uint32_t w[4];
+   memcpy(w, addr, 16);
+   return hash_u32(((w[0] * 31 + w[1]) * 31 + w[2]) * 31 + w[3], shift);
+}
+
+uint64_t align(uint64_t off) {
+   return (off + DESTDB_ALIGN - 1) & ~(uint64_t)(DESTDB_ALIGN - 1);
+}
+
+int write_all(int fd, const void *buf, size_t len) {
+   const char *pos = buf;
+   while (len) {
+      ssize_t ret = write(fd, pos, len);
+      if (ret < 0) {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+      pos += ret;
+      len -= ret;
+   }
+   return 0;
+}
+
+int write_section(int fd, const void *buf, size_t len) {
+   static const char zeros[DESTDB_ALIGN];
+   if (write_all(fd, buf, len) < 0)
+      return -1;
+   off_t off = lseek(fd, 0, SEEK_CUR);
+   if (off < 0)
+      return -1;
+   return write_all(fd, zeros, align(off) - off);
+}
+
+int check_idx(const uint32_t *idx, uint32_t nslots, uint32_t count) {
+   uint32_t used = 0;
+   for (uint32_t h = 0; h < nslots; h++) {
+      if (idx[h] > count)
+         return -1;
+      used += !!idx[h];
+   }
+   return used < nslots ? 0 : -1;
+}
+
+int destdb_probe(const char *path) {
+   char magic[8];
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return 0;
+   int ret = read(fd, magic, 8) == 8 && !memcmp(magic, DESTDB_MAGIC, 8);
+   close(fd);
+   return ret;
+}
+
+int destdb_write(const char *path, struct tun_state *state,
+                 struct dest_set *ds) {
+   struct tun_rec *serv_recs = ds->recs + 2 * ds->sa_len;
+   uint32_t count = ds->sa_len, bits = 4;
+   while ((1u << bits) < 2 * count)
+      bits++;
+
+   struct destdb_header hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, DESTDB_MAGIC, 8);
+   hdr.version      = DESTDB_VERSION;
+   hdr.rec_size     = sizeof(struct tun_rec);
+   hdr.flags        = ds->cli6 ? DESTDB_V6 : 0;
+   hdr.count        = count;
+   hdr.nslots       = 1u << bits;
+   hdr.public_port  = state->public_port;
+   hdr.private_port = state->private_port;
+
+   size_t recs_len = (size_t)count * sizeof(struct tun_rec);
+   size_t idx_len  = (size_t)hdr.nslots * sizeof(uint32_t);
+   hdr.recs_off = align(sizeof(hdr));
+   hdr.serv_off = align(hdr.recs_off + 3 * recs_len);
+   if (hdr.flags & DESTDB_V6) {
+      hdr.keys6_off = hdr.serv_off;
+      hdr.serv_off  = align(hdr.keys6_off + (size_t)count * 16);
+   }
+   hdr.cli4_off = align(hdr.serv_off + idx_len);
+   hdr.len      = align(hdr.cli4_off + idx_len);
+   if (hdr.flags & DESTDB_V6) {
+      hdr.cli6_off = hdr.len;
+      hdr.len      = align(hdr.cli6_off + idx_len);
+   }
+
+   /* build indexes, later lines replace duplicated keys */
+   uint32_t *idx[3];
+   uint32_t mask = hdr.nslots - 1, shift = 32 - bits;
+   for (int t = 0; t < 3; t++)
+      if (!(idx[t] = calloc(hdr.nslots, sizeof(uint32_t))))
+         die("calloc");
+   for (uint32_t i = 0; i < count; i++) {
+      struct tun_rec *pub = &ds->cli_public[i];
+      uint32_t h = hash_u32(serv_recs[i].sport, shift);
+      while (idx[0][h] && serv_recs[idx[0][h] - 1].sport != serv_recs[i].sport)
+         h = (h + 1) & mask;
+      idx[0][h] = i + 1;
+
+      h = hash_u32(pub->priv_addr4, shift);
+      while (idx[1][h] && ds->cli_public[idx[1][h] - 1].priv_addr4 != pub->priv_addr4)
+         h = (h + 1) & mask;
+      idx[1][h] = i + 1;
+
+      if (hdr.flags & DESTDB_V6) {
+         h = hash_addr6(ds->priv_addr6[i], shift);
+         while (idx[2][h] && memcmp(ds->priv_addr6[idx[2][h] - 1],
+                                    ds->priv_addr6[i], 16))
+            h = (h + 1) & mask;
+         idx[2][h] = i + 1;
+      }
+   }
+
+   char tmp[STR_SIZE];
+   snprintf(tmp, STR_SIZE, "%s.tmp", path);
+   int ret = -1, fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd >= 0) {
+      /* the three record arrays are contiguous, only the last one is padded */
+      ret = (write_section(fd, &hdr, sizeof(hdr)) < 0 ||
+             write_all(fd, ds->cli_public, recs_len) < 0 ||
+             write_all(fd, ds->cli_private, recs_len) < 0 ||
+             write_section(fd, serv_recs, recs_len) < 0 ||
+             ((hdr.flags & DESTDB_V6) &&
+              write_section(fd, ds->priv_addr6, (size_t)count * 16) < 0) ||
+             write_section(fd, idx[0], idx_len) < 0 ||
+             write_section(fd, idx[1], idx_len) < 0 ||
+             ((hdr.flags & DESTDB_V6) &&
+              write_section(fd, idx[2], idx_len) < 0)) ? -1 : 0;
+      if (close(fd) < 0)
+         ret = -1;
+      if (!ret)
+         ret = rename(tmp, path);
+      if (ret < 0)
+         unlink(tmp);
+   }
+   for (int t = 0; t < 3; t++)
+      free(idx[t]);
+   return ret;
+}
+
+struct destdb *destdb_open(const char *path) {
+   struct map_file mf;
+   if (map_file(path, &mf) < 0)
+      return NULL;
+
+   /* validate before use */
+   const struct destdb_header *hdr = (const void *)mf.data;
+   if (mf.len < sizeof(*hdr) || memcmp(hdr->magic, DESTDB_MAGIC, 8) ||
+       hdr->version != DESTDB_VERSION || hdr->rec_size != sizeof(struct tun_rec) ||
+       hdr->len != mf.len || !hdr->nslots || (hdr->nslots & (hdr->nslots - 1)) ||
+       hdr->nslots < 2 * (uint64_t)hdr->count ||
+       hdr->recs_off + 3 * (uint64_t)hdr->count * hdr->rec_size > 
+          ((hdr->flags & DESTDB_V6) ? hdr->keys6_off : hdr->serv_off) ||
+       ((hdr->flags & DESTDB_V6) && 
+        hdr->keys6_off + 16ULL * hdr->count > hdr->serv_off) ||
+       hdr->serv_off + hdr->nslots * 4ULL > hdr->cli4_off ||
+       hdr->cli4_off + hdr->nslots * 4ULL > mf.len ||
+       ((hdr->flags & DESTDB_V6) && hdr->cli6_off + hdr->nslots * 4ULL > mf.len) ||
+       check_idx((const void *)(mf.data + hdr->serv_off), hdr->nslots, hdr->count) ||
+       check_idx((const void *)(mf.data + hdr->cli4_off), hdr->nslots, hdr->count) ||
+       ((hdr->flags & DESTDB_V6) &&
+        check_idx((const void *)(mf.data + hdr->cli6_off), hdr->nslots, hdr->count))) {
+      unmap_file(&mf);
+      errno = EINVAL;
+      return NULL;
+   }
+
+   struct destdb *db = calloc(1, sizeof(struct destdb));
+   if (!db)
+      die("calloc");
+   const char *base = mf.data;
+   db->hdr      = hdr;
+   db->pub      = (struct tun_rec *)(base + hdr->recs_off);
+   db->priv     = db->pub + hdr->count;
+   db->serv     = db->priv + hdr->count;
+   db->priv_addr6 = (hdr->flags & DESTDB_V6) ?
+                    (void *)(base + hdr->keys6_off) : NULL;
+   db->idx_serv = (const uint32_t *)(base + hdr->serv_off);
+   db->idx_cli4 = (const uint32_t *)(base + hdr->cli4_off);
+   db->idx_cli6 = (hdr->flags & DESTDB_V6) ?
+                  (const uint32_t *)(base + hdr->cli6_off) : NULL;
+   db->mask     = hdr->nslots - 1;
+   db->shift    = 32 - __builtin_ctz(hdr->nslots);
+   return db;
+}
+
+void destdb_close(struct destdb *db) {
+   struct map_file mf = { .data = (const char *)db->hdr, .len = db->hdr->len };
+   unmap_file(&mf);
+   free(db);
+}
+
+struct tun_rec *destdb_lookup_serv(const struct destdb *db, int sport) {
+   uint32_t h = hash_u32(sport, db->shift), i;
+   while ((i = db->idx_serv[h])) {
+      if (db->serv[i - 1].sport == sport)
+         return &db->serv[i - 1];
+      h = (h + 1) & db->mask;
+   }
+   return NULL;
+}
+
+struct tun_rec *destdb_lookup_cli4(const struct destdb *db, in_addr_t addr) {
+   uint32_t h = hash_u32(addr, db->shift), i;
+   while ((i = db->idx_cli4[h])) {
+      if (db->pub[i - 1].priv_addr4 == addr)
+         return &db->pub[i - 1];
+      h = (h + 1) & db->mask;
+   }
+   return NULL;
+}
+
+struct tun_rec *destdb_lookup_cli6(const struct destdb *db, const void *addr) {
+   if (!db->idx_cli6)
+      return NULL;
+   uint32_t h = hash_addr6(addr, db->shift), i;
+   while ((i = db->idx_cli6[h])) {
+      if (!memcmp(db->priv_addr6[i - 1], addr, 16))
+         return &db->pub[i - 1];
+      h = (h + 1) & db->mask;
+   }
+   return NULL;
+}
+
@@ -0,0 +1,143 @@
+/**
+ * \file destdb.h
+ * \brief Compiled destination database.
+ *
+ *    A destination database (copycat -C dest.txt -O dest.db) is the
+ *    image of the destination records (cli_public, cli_private and
+ *    serv records, struct tun_rec) and of the private v6 addresses of
+ *    the public records, followed by three open addressing
+ *    indexes: source port to serv record, private v4 and private v6
+ *    address to public record. It is mapped read-only in place of a
+ *    destination file (-d dest.db, detected by its magic): nothing is
+ *    parsed or built at startup, and the copycat processes of a host
+ *    share its page cache. The image is specific to the host ABI
+ *    (record size and byte order) and to the configured ports.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_DESTDB_H
+#define UDPTUN_DESTDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/**
+ * \def DESTDB_MAGIC
+ * \brief The first 8 bytes of a destination database.
+ */
+#define DESTDB_MAGIC "CCDESTDB"
+
+/**
+ * \def DESTDB_VERSION
+ * \brief The destination database format version.
+ */
+#define DESTDB_VERSION 2
+
+/**
+ * \def DESTDB_V6
+ * \brief The database has v6 addresses and a cli6 index.
+ */
+#define DESTDB_V6 0x1
+
+/**
+ * \struct destdb_header
+ *	\brief The header of a destination database. Offsets are from the
+ *        start of the file, indexes hold record numbers + 1 (0: empty).
+ */
+struct destdb_header {
+   char     magic[8];           /*!< DESTDB_MAGIC */
+   uint32_t version;            /*!< DESTDB_VERSION */
+   uint32_t rec_size;           /*!< sizeof(struct tun_rec) */
+   uint32_t flags;              /*!< DESTDB_V6 */
+   uint32_t count;              /*!< Number of destinations */
+   uint32_t nslots;             /*!< Slots per index (power of 2) */
+   uint16_t public_port;        /*!< public-server-port of the records */
+   uint16_t private_port;       /*!< private-server-port of the records */
+   uint64_t recs_off;           /*!< count public, private then serv records */
+   uint64_t keys6_off;          /*!< Private v6 addresses (uint8_t[count][16]), 0 without DESTDB_V6 */
+   uint64_t serv_off;           /*!< Source port index (uint32_t[nslots]) */
+   uint64_t cli4_off;           /*!< Private v4 address index */
+   uint64_t cli6_off;           /*!< Private v6 address index, 0 without DESTDB_V6 */
+   uint64_t len;                /*!< File length */
+};
+
+struct tun_rec;
+struct tun_state;
+struct dest_set;
+
+/**
+ * \struct destdb
+ *	\brief A mapped destination database.
+ */
+struct destdb {
+   const struct destdb_header *hdr; /*!< The mapping */
+   struct tun_rec *pub;             /*!< cli_public records */
+   struct tun_rec *priv;            /*!< cli_private records */
+   struct tun_rec *serv;            /*!< serv records */
+   uint8_t (*priv_addr6)[16];       /*!< Private v6 addresses of pub, or NULL */
+   const uint32_t *idx_serv;        /*!< Source port index */
+   const uint32_t *idx_cli4;        /*!< Private v4 address index */
+   const uint32_t *idx_cli6;        /*!< Private v6 address index, or NULL */
+   uint32_t        mask;            /*!< nslots - 1 */
+   uint32_t        shift;           /*!< 32 - log2(nslots) */
+};
+
+/**
+ * \fn int destdb_probe(const char *path)
+ * \brief Check whether a file is a destination database.
+ *
+ * \return 1 if it starts with DESTDB_MAGIC, 0 otherwise
+ */
+int destdb_probe(const char *path);
+
+/**
+ * \fn int destdb_write(const char *path, struct tun_state *state,
+ *                     struct dest_set *ds)
+ * \brief Write a destination set to a database, atomically (written
+ *        to path.tmp then renamed).
+ *
+ * \param path The database location.
+ * \param state The state (configured ports).
+ * \param ds A set parsed from a destination file, with a serv table.
+ * \return 0 for success, -1 on error (errno is filled)
+ */
+int destdb_write(const char *path, struct tun_state *state,
+                 struct dest_set *ds);
+
+/**
+ * \fn struct destdb *destdb_open(const char *path)
+ * \brief Map and validate a destination database.
+ *
+ * \return The database, or NULL on error (errno is filled)
+ */
+struct destdb *destdb_open(const char *path);
+
+/**
+ * \fn void destdb_close(struct destdb *db)
+ * \brief Unmap a destination database.
+ */
+void destdb_close(struct destdb *db);
+
+/**
+ * \fn struct tun_rec *destdb_lookup_serv(const struct destdb *db, int sport)
+ * \brief Look up the serv record of a source port.
+ */
+struct tun_rec *destdb_lookup_serv(const struct destdb *db, int sport);
+
+/**
+ * \fn struct tun_rec *destdb_lookup_cli4(const struct destdb *db, in_addr_t addr)
+ * \brief Look up the public record of a private v4 address.
+ */
+struct tun_rec *destdb_lookup_cli4(const struct destdb *db, in_addr_t addr);
+
+/**
+ * \fn struct tun_rec *destdb_lookup_cli6(const struct destdb *db, const void *addr)
+ * \brief Look up the public record of a private v6 address (16 bytes).
+ */
+struct tun_rec *destdb_lookup_cli6(const struct destdb *db, const void *addr);
+
+#endif
+
@@ -12,6 +12,10 @@
 #include "destruct.h"
 #include "sock.h"
 #include "debug.h"
+#include "stats.h"
+#include "tstamp.h"
+#include "cycles.h"
+#include "thread.h"
 
 /**
  * \fn static void destruct()
@@ -126,6 +130,10 @@ void destruct() {
       die("mutex unlock");
    pthread_mutex_destroy(&lock);
 
+   tstamp_dump(prog_state);
+   cycles_dump();
+   thread_dump(prog_state);
+   stats_close();
    free_tun_state(prog_state);
 }
 
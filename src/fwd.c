@@ -0,0 +1,412 @@
+/**
+ * \file fwd.c
+ * \brief The forwarding core.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "fwd.h"
+#include "sock.h"
+#include "stats.h"
+#include "tstamp.h"
+#include "trace.h"
+#include "probes.h"
+#include "cycles.h"
+#include "watchdog.h"
+
+/**
+ * \def FWD_INLINE
+ * \brief Inlined in each variant, so that their mode arguments are
+ *        constants.
+ */
+#define FWD_INLINE static inline __attribute__((always_inline))
+
+/**
+ * \var static const char fwd_ppi[4]
+ * \brief The PlanetLab TUN PPI header.
+ */
+static const char fwd_ppi[4] = {0, 0, 8, 0};
+
+/**
+ * \fn static void fwd_in(const struct fwd_cfg *cfg, int fd_cli, int fd_serv,
+ *                        char *buf, int recvd, const int v6, const int role,
+ *                        const int ppi, const int l45)
+ * \brief Classify and tunnel a packet read from the tun interface
+ *        (fwd_in_fn). The PPI header is skipped and the layer 4.5
+ *        header, written once in front of the buffer (fwd_worker_init),
+ *        is pushed in front of the packet without moving it.
+ */
+FWD_INLINE void fwd_in(const struct fwd_cfg *cfg, int fd_cli, int fd_serv,
+                       char *buf, int recvd, const int v6, const int role,
+                       const int ppi, const int l45);
+
+/**
+ * \fn static void fwd_out(const struct fwd_cfg *cfg, int fd_net, int fd_tun,
+ *                         char *buf, const int v6, const int learn,
+ *                         const int ppi, const int l45, const int udp)
+ * \brief Receive, decapsulate and write a packet to the tun interface
+ *        (fwd_out_fn). The layer 4.5 header is skipped and the PPI
+ *        header, written once in front of the buffer, is pushed in
+ *        front of the packet without moving it.
+ */
+FWD_INLINE void fwd_out(const struct fwd_cfg *cfg, int fd_net, int fd_tun,
+                        char *buf, const int v6, const int learn,
+                        const int ppi, const int l45, const int udp);
+
+#if !defined(LOCKED)
+/**
+ * \fn static struct tun_rec *fwd_learn(const struct fwd_cfg *cfg,
+ *                                      const struct tun_rec *from, int sport, int v6)
+ * \brief Add a peer to the serv table of the current destination set,
+ *        up to fd_lim peers.
+ *
+ * \return The new record, or NULL
+ */
+static struct tun_rec *fwd_learn(const struct fwd_cfg *cfg,
+                                 const struct tun_rec *from, int sport, int v6);
+#endif
+
+/**
+ * \fn static void fwd_drop(const struct fwd_cfg *cfg, int fd_cli, int fd_serv,
+ *                          char *buf, int recvd)
+ * \brief Drop a non-IP packet (fwd_in_fn).
+ */
+static void fwd_drop(const struct fwd_cfg *cfg, int fd_cli, int fd_serv,
+                     char *buf, int recvd);
+
+void fwd_in(const struct fwd_cfg *cfg, int fd_cli, int fd_serv,
+            char *buf, int recvd, const int v6, const int role,
+            const int ppi, const int l45) {
+   CYCLES_START();
+
+   if (recvd <= MIN_PKT_SIZE) {
+      STATS_INC(ST_SHORT_PKT);
+      return;
+   }
+
+   /* Remove PlanetLab TUN PPI header */
+   if (ppi) {
+      buf += 4;
+      recvd -= 4;
+   }
+   CYCLES_STAGE(CY_ENCAP);
+
+   struct tun_rec *rec = NULL;
+   int sport = ntohs( *((uint16_t *)(buf + (v6 ? 40 : 20))) );
+   int dport = ntohs( *((uint16_t *)(buf + (v6 ? 42 : 22))) );
+   int fd    = fd_serv;
+   int probe = PROBE_LOOKUP_SERV;
+   CYCLES_STAGE(CY_PARSE);
+
+   /* lookup private addr (cli) or port (serv) */
+   if (role == FWD_CLI || (role == FWD_PEER && dport == cfg->private_port)) {
+      fd = fd_cli;
+      if (v6) {
+         char priv_addr6[16];
+         memcpy(priv_addr6, buf+24, 16);
+         probe = PROBE_LOOKUP_CLI6;
+         rec   = lookup_cli6(cfg, priv_addr6);
+      } else {
+         probe = PROBE_LOOKUP_CLI4;
+         rec   = lookup_cli4(cfg, *((uint32_t *)(buf+16)));
+      }
+   } else
+      rec = lookup_serv(cfg, dport);
+
+   if (!rec) {
+      /* e.g. a peer removed by a reload */
+      STATS_INC(ST_LOOKUP_MISS);
+      TRACE(TR_LOOKUP_MISS, (int) *((uint8_t *)(buf + (v6 ? 6 : 9))),
+            (sport << 16) | dport);
+      PROBE2(lookup, probe, -1);
+      return;
+   }
+   PROBE2(lookup, probe, rec->id);
+   CYCLES_STAGE(CY_LOOKUP);
+
+   /* Add layer 4.5 header */
+   if (l45) {
+      buf -= cfg->raw_header_size;
+      recvd += cfg->raw_header_size;
+      /* over the skipped PPI header */
+      if (ppi)
+         memcpy(buf, cfg->raw_header, cfg->raw_header_size);
+      PROBE1(header_push, recvd);
+   }
+
+   CYCLES_STAGE(CY_ENCAP);
+   int sent = v6 ? xsendto6(fd, TUN_SA6(rec), buf, recvd)
+                 : xsendto4(fd, TUN_SA4(rec), buf, recvd);
+   CYCLES_STAGE(CY_SYSCALL);
+   TRACE(TR_UDP_SEND, sent, rec->id);
+   PROBE2(udp_send, sent, rec->id);
+   if (sent < 0)
+      STATS_INC(ST_SEND_ERR);
+   else
+      STATS_IN(rec, sent);
+   CYCLES_END();
+}
+
+void fwd_out(const struct fwd_cfg *cfg, int fd_net, int fd_tun,
+             char *buf, const int v6, const int learn,
+             const int ppi, const int l45, const int udp) {
+   WATCHDOG_BEAT(WD_NET_OUT);
+   CYCLES_START();
+   struct tun_rec from;
+   int recvd;
+   if (learn) {
+      unsigned int slen = v6 ? sizeof(struct sockaddr_in6)
+                             : sizeof(struct sockaddr_in);
+      recvd = xrecvfrom(fd_net, v6 ? TUN_SA6(&from) : TUN_SA4(&from),
+                        &slen, buf, cfg->buf_length);
+   } else
+      recvd = xrecv(fd_net, buf, cfg->buf_length);
+   CYCLES_STAGE(CY_SYSCALL);
+
+   if (recvd < 0) {
+      /* recvd ICMP msg */
+      xrecverr(fd_net, buf, cfg->buf_length, 0, NULL);
+      return;
+   } else if (recvd <= MIN_PKT_SIZE) {
+      /* recvd unknown packet */
+      STATS_INC(ST_SHORT_PKT);
+      TRACE(TR_SHORT_PKT, recvd, 0);
+      return;
+   }
+   TRACE(TR_UDP_RECV, recvd, 0);
+   PROBE1(udp_recv, recvd);
+
+   /* Remove the outer IP header: v4 raw sockets only, v6 raw sockets
+      do not receive it */
+   if (!udp && !v6) {
+      int ihl = (buf[0] & 0x0f) << 2;
+      if (recvd <= ihl + cfg->raw_header_size + MIN_PKT_SIZE) {
+         STATS_INC(ST_SHORT_PKT);
+         TRACE(TR_SHORT_PKT, recvd, 0);
+         return;
+      }
+      buf   += ihl;
+      recvd -= ihl;
+   }
+   /* Remove layer 4.5 header */
+   if (l45) {
+      recvd -= cfg->raw_header_size;
+      buf += cfg->raw_header_size;
+      PROBE1(header_strip, recvd);
+   }
+   /* Add PlanetLab TUN PPI header */
+   if (ppi) {
+      buf -= 4;
+      recvd += 4;
+      /* over the skipped headers */
+      if (l45 || (!udp && !v6))
+         memcpy(buf, fwd_ppi, 4);
+   }
+   CYCLES_STAGE(CY_ENCAP);
+
+   struct tun_rec *rec = NULL;
+   if (learn) {
+      int sport = ntohs(v6 ? from.addr6.sin6_port : from.addr4.sin_port);
+      CYCLES_STAGE(CY_PARSE);
+      if ( (rec = lookup_serv(cfg, sport)) ) {
+         PROBE2(lookup, PROBE_LOOKUP_SERV, rec->id);
+      }
+#if !defined(LOCKED)
+      else if (fwd_learn(cfg, &from, sport, v6)) {
+         /* counted as unknown until its next packet */
+         PROBE2(lookup, PROBE_LOOKUP_SERV, -1);
+      }
+#endif
+      else {
+         TRACE(TR_UNKNOWN_PEER, sport, 0);
+         PROBE2(lookup, PROBE_LOOKUP_SERV, -1);
+         STATS_INC(ST_LOOKUP_MISS);
+         return;
+      }
+      CYCLES_STAGE(CY_LOOKUP);
+   }
+
+   struct pktio_buf pb;
+   pb.data    = buf;
+   pb.len     = recvd;
+   pb.addrlen = 0;
+   if (cfg->io->write_batch(fd_tun, &pb, 1) < 0)
+      die("write");
+   int sent = recvd;
+   CYCLES_STAGE(CY_SYSCALL);
+   TSTAMP_TUN_WRITE();
+   TRACE(TR_TUN_WRITE, sent, rec ? rec->id : TRACE_NO_PEER);
+   PROBE2(tun_write, sent, rec ? (int)rec->id : -1);
+   STATS_OUT(rec, sent);
+   CYCLES_END();
+}
+
+#if !defined(LOCKED)
+struct tun_rec *fwd_learn(const struct fwd_cfg *cfg,
+                          const struct tun_rec *from, int sport, int v6) {
+   struct dest_set *ds = fwd_dests(cfg);
+   if (g_hash_table_size(ds->serv) > cfg->fd_lim)
+      return NULL;
+
+   /* add new record to lookup tables */
+   struct tun_rec *nrec = init_tun_rec();
+   if (v6)
+      nrec->addr6 = from->addr6;
+   else
+      nrec->addr4 = from->addr4;
+   nrec->sport = sport;
+   /* past the per-peer counters, traced as TRACE_NO_PEER */
+   nrec->id    = TRACE_NO_PEER;
+   dest_set_learn(cfg->dests, nrec);
+   TRACE(TR_NEW_PEER, sport, 0);
+   return nrec;
+}
+#endif
+
+void fwd_drop(const struct fwd_cfg *UNUSED(cfg), int UNUSED(fd_cli),
+              int UNUSED(fd_serv), char *buf, int UNUSED(recvd)) {
+   TRACE(TR_NON_IP, buf[0], 0);
+   STATS_INC(ST_DROP);
+}
+
+/**
+ * \def FWD_IN(v6, role, ppi, l45, udp)
+ * \brief Define the tunnel variant fwd_in_<v6>_<role>_<ppi><l45><udp>.
+ */
+#define FWD_IN(v6, role, ppi, l45, udp) \
+   static void fwd_in_##v6##_##role##_##ppi##l45##udp(const struct fwd_cfg *cfg, \
+         int fd_cli, int fd_serv, char *buf, int recvd) { \
+      fwd_in(cfg, fd_cli, fd_serv, buf, recvd, v6, role, ppi, l45); \
+   }
+
+/**
+ * \def FWD_OUT(v6, learn, ppi, l45, udp)
+ * \brief Define the decapsulation variant fwd_out_<v6>_<learn>_<ppi><l45><udp>.
+ */
+#define FWD_OUT(v6, learn, ppi, l45, udp) \
+   static void fwd_out_##v6##_##learn##_##ppi##l45##udp(const struct fwd_cfg *cfg, \
+         int fd_net, int fd_tun, char *buf) { \
+      fwd_out(cfg, fd_net, fd_tun, buf, v6, learn, ppi, l45, udp); \
+   }
+
+/**
+ * \def FWD_OPS(ppi, l45, udp)
+ * \brief Define the variants of a mode and their table fwd_ops_<ppi><l45><udp>.
+ */
+#define FWD_OPS(ppi, l45, udp) \
+   FWD_IN(0, FWD_CLI,  ppi, l45, udp) \
+   FWD_IN(0, FWD_SERV, ppi, l45, udp) \
+   FWD_IN(0, FWD_PEER, ppi, l45, udp) \
+   FWD_IN(1, FWD_CLI,  ppi, l45, udp) \
+   FWD_IN(1, FWD_SERV, ppi, l45, udp) \
+   FWD_IN(1, FWD_PEER, ppi, l45, udp) \
+   FWD_OUT(0, 0, ppi, l45, udp) \
+   FWD_OUT(0, 1, ppi, l45, udp) \
+   FWD_OUT(1, 0, ppi, l45, udp) \
+   FWD_OUT(1, 1, ppi, l45, udp) \
+   static const struct fwd_ops fwd_ops_##ppi##l45##udp = { \
+      .in  = {{fwd_in_0_FWD_CLI_##ppi##l45##udp, \
+               fwd_in_0_FWD_SERV_##ppi##l45##udp, \
+               fwd_in_0_FWD_PEER_##ppi##l45##udp}, \
+              {fwd_in_1_FWD_CLI_##ppi##l45##udp, \
+               fwd_in_1_FWD_SERV_##ppi##l45##udp, \
+               fwd_in_1_FWD_PEER_##ppi##l45##udp}}, \
+      .out = {{fwd_out_0_0_##ppi##l45##udp, fwd_out_0_1_##ppi##l45##udp}, \
+              {fwd_out_1_0_##ppi##l45##udp, fwd_out_1_1_##ppi##l45##udp}}, \
+   };
+
+FWD_OPS(0, 0, 0)
+FWD_OPS(0, 0, 1)
+FWD_OPS(0, 1, 0)
+FWD_OPS(0, 1, 1)
+FWD_OPS(1, 0, 0)
+FWD_OPS(1, 0, 1)
+FWD_OPS(1, 1, 0)
+FWD_OPS(1, 1, 1)
+
+/**
+ * \var static const struct fwd_ops *const fwd_table[2][2][2]
+ * \brief The variants by [ppi][l45][udp].
+ */
+static const struct fwd_ops *const fwd_table[2][2][2] = {
+   {{&fwd_ops_000, &fwd_ops_001}, {&fwd_ops_010, &fwd_ops_011}},
+   {{&fwd_ops_100, &fwd_ops_101}, {&fwd_ops_110, &fwd_ops_111}},
+};
+
+const struct fwd_ops *fwd_select(const struct fwd_cfg *cfg) {
+   return fwd_table[!!cfg->planetlab][!!cfg->raw_header][!!cfg->udp];
+}
+
+void fwd_worker_init(struct fwd_worker *w, const struct fwd_cfg *cfg,
+                     enum fwd_role role, int fd_tun, int fd_cli4,
+                     int fd_serv4, int fd_cli6, int fd_serv6) {
+   w->cfg     = cfg;
+   w->ops     = cfg->ops;
+   w->fd_tun  = fd_tun;
+   w->ppi_len = cfg->planetlab ? 4 : 0;
+
+   struct fwd_in_slot in4 = {cfg->ops->in[0][role], fd_cli4, fd_serv4};
+   struct fwd_in_slot in6 = {cfg->ops->in[1][role], fd_cli6, fd_serv6};
+   for (int i = 0; i < 16; i++) {
+      if (cfg->dual_stack)
+         w->in_slot[i] = (struct fwd_in_slot) {fwd_drop, 0, 0};
+      else
+         w->in_slot[i] = cfg->ipv6 ? in6 : in4;
+   }
+   if (cfg->dual_stack) {
+      w->in_slot[4] = in4;
+      w->in_slot[6] = in6;
+   }
+
+   /* a smaller batch if the pool runs short */
+   if (!(w->out = pkt_alloc(cfg->pool))) {
+      errno = ENOBUFS;
+      die("packet pool");
+   }
+   for (w->nin = 0; w->nin < FWD_BATCH; w->nin++) {
+      if (!(w->in[w->nin] = pkt_alloc(cfg->pool)))
+         break;
+      w->in_io[w->nin].data = w->in[w->nin]->data;
+      if (cfg->raw_header)
+         memcpy(w->in_io[w->nin].data - cfg->raw_header_size, cfg->raw_header,
+                cfg->raw_header_size);
+   }
+   if (!w->nin) {
+      errno = ENOBUFS;
+      die("packet pool");
+   }
+   w->outbuf = w->out->data;
+   if (cfg->planetlab)
+      memcpy(w->outbuf - 4, fwd_ppi, 4);
+}
+
+void fwd_worker_free(struct fwd_worker *w) {
+   for (int i = 0; i < w->nin; i++)
+      pkt_free(w->cfg->pool, w->in[i]);
+   pkt_free(w->cfg->pool, w->out);
+}
+
+void fwd_tun_in(struct fwd_worker *w) {
+   WATCHDOG_BEAT(WD_TUN_IN);
+   for (int i = 0; i < w->nin; i++)
+      w->in_io[i].len = w->cfg->buf_length;
+   int n = w->cfg->io->read_batch(w->fd_tun, w->in_io, w->nin);
+   if (n < 0)
+      die("read");
+
+   for (int i = 0; i < n; i++) {
+      char *buf = w->in_io[i].data;
+      int recvd = w->in_io[i].len;
+      TSTAMP_TUN_READ();
+      TRACE(TR_TUN_READ, recvd, 0);
+      PROBE1(tun_read, recvd);
+
+      /* by IP version */
+      const struct fwd_in_slot *slot = &w->in_slot[(buf[w->ppi_len] >> 4) & 0xf];
+      slot->fn(w->cfg, slot->fd_cli, slot->fd_serv, buf, recvd);
+   }
+}
@@ -0,0 +1,166 @@
+/**
+ * \file fwd.h
+ * \brief The forwarding core.
+ *
+ *    The per-packet functions of the client, server and peer loops are
+ *    written once (fwd.c) and compiled into one variant per address
+ *    family, role, PlanetLab TUN PPI header, layer 4.5 header and outer
+ *    transport, in which these modes are constants. The variants of the
+ *    node modes are selected once by init_tun_state (fwd_select) and
+ *    per loop by fwd_worker_init, so that no mode is tested per packet.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_FWD_H
+#define UDPTUN_FWD_H
+
+#include "udptun.h"
+#include "state.h"
+#include "pktpool.h"
+#include "pktio.h"
+
+/**
+ * \def FWD_BATCH
+ * \brief The maximal number of packets read from the tun interface at once.
+ */
+#define FWD_BATCH 16
+
+/**
+ * \enum fwd_role
+ * \brief How a packet read from the tun interface is classified.
+ */
+enum fwd_role {
+   FWD_CLI,                     /*!< By private destination address */
+   FWD_SERV,                    /*!< By destination port (serv table) */
+   FWD_PEER,                    /*!< FWD_CLI towards private_port, else FWD_SERV */
+   FWD_ROLES
+};
+
+/**
+ * \typedef fwd_in_fn
+ * \brief Classify and tunnel a packet read from the tun interface.
+ *        The layer 4.5 header is pushed in front of buf.
+ *
+ * \param cfg The forwarding configuration.
+ * \param fd_cli The socket of FWD_CLI packets.
+ * \param fd_serv The socket of FWD_SERV packets.
+ * \param buf The packet.
+ * \param recvd The packet length.
+ */
+typedef void (*fwd_in_fn)(const struct fwd_cfg *cfg, int fd_cli, int fd_serv,
+                          char *buf, int recvd);
+
+/**
+ * \typedef fwd_out_fn
+ * \brief Receive a packet from a socket, decapsulate it and write it
+ *        to the tun interface (write_batch of the backend).
+ *
+ * \param cfg The forwarding configuration.
+ * \param fd_net The socket fd.
+ * \param fd_tun The tun interface fd.
+ * \param buf The buffer, with room for the PPI header in front.
+ */
+typedef void (*fwd_out_fn)(const struct fwd_cfg *cfg, int fd_net, int fd_tun,
+                           char *buf);
+
+/**
+ * \struct fwd_ops
+ * \brief The variants of one PPI, layer 4.5 header and transport mode.
+ */
+struct fwd_ops {
+   fwd_in_fn  in[2][FWD_ROLES]; /*!< [v6][role] */
+   fwd_out_fn out[2][2];        /*!< [v6][learn]: learn is 1 on server sockets
+                                     (lookup and learn the source port) */
+};
+
+/**
+ * \struct fwd_in_slot
+ * \brief The tunnel function of an IP version and its sockets.
+ */
+struct fwd_in_slot {
+   fwd_in_fn fn;                /*!< The variant, or the drop function */
+   int fd_cli;                  /*!< The socket of FWD_CLI packets */
+   int fd_serv;                 /*!< The socket of FWD_SERV packets */
+};
+
+/**
+ * \struct fwd_worker
+ *	\brief The mutable state of a forwarding loop, private to the
+ *        thread that runs it: sockets, variants and packet buffers
+ *        from the pool of the configuration. Tun interface reads and
+ *        writes go through the packet I/O backend of the configuration.
+ */
+struct fwd_worker {
+   const struct fwd_cfg *cfg;   /*!<  The forwarding configuration */
+   const struct fwd_ops *ops;   /*!<  The variants of the node modes */
+   int fd_tun;                  /*!<  The tun interface fd */
+   int ppi_len;                 /*!<  The PPI header length of tun packets */
+   struct fwd_in_slot in_slot[16]; /*!< By IP version nibble */
+   int nin;                     /*!<  The tun read batch size */
+   struct pkt_buf *in[FWD_BATCH]; /*!< Tunneled packets (pool buffers) */
+   struct pktio_buf in_io[FWD_BATCH]; /*!< Tun reads, past the layer 4.5 header */
+   struct pkt_buf *out;         /*!<  Decapsulated packets (pool buffer) */
+   char *outbuf;                /*!<  Socket reads, past the TUN PPI header */
+};
+
+/**
+ * \fn const struct fwd_ops *fwd_select(const struct fwd_cfg *cfg)
+ * \brief The variants of the PPI, layer 4.5 header and transport
+ *        modes of cfg.
+ */
+const struct fwd_ops *fwd_select(const struct fwd_cfg *cfg);
+
+/**
+ * \fn void fwd_worker_init(struct fwd_worker *w, const struct fwd_cfg *cfg,
+ *                          enum fwd_role role, int fd_tun, int fd_cli4,
+ *                          int fd_serv4, int fd_cli6, int fd_serv6)
+ * \brief Initialize a forwarding loop: select the tunnel variants of
+ *        its role, allocate its buffers (up to FWD_BATCH for tun reads),
+ *        write the layer 4.5 header once in the headroom of the tun
+ *        read buffers and the TUN PPI header in the headroom of outbuf. In single stack modes, every packet goes
+ *        to the variant of the node family.
+ *
+ * \param w The worker.
+ * \param cfg The forwarding configuration.
+ * \param role The loop role.
+ * \param fd_tun The tun interface fd.
+ * \param fd_cli4 The v4 socket of FWD_CLI packets, or 0.
+ * \param fd_serv4 The v4 socket of FWD_SERV packets, or 0.
+ * \param fd_cli6 The v6 socket of FWD_CLI packets, or 0.
+ * \param fd_serv6 The v6 socket of FWD_SERV packets, or 0.
+ */
+void fwd_worker_init(struct fwd_worker *w, const struct fwd_cfg *cfg,
+                     enum fwd_role role, int fd_tun, int fd_cli4,
+                     int fd_serv4, int fd_cli6, int fd_serv6);
+
+/**
+ * \fn void fwd_worker_free(struct fwd_worker *w)
+ * \brief Return the buffers of a forwarding loop to the pool.
+ */
+void fwd_worker_free(struct fwd_worker *w);
+
+/**
+ * \fn void fwd_tun_in(struct fwd_worker *w)
+ * \brief Read a batch of packets from the tun interface (read_batch of
+ *        the backend) and tunnel them.
+ */
+void fwd_tun_in(struct fwd_worker *w);
+
+/**
+ * \fn static inline void fwd_net_out(struct fwd_worker *w, int fd_net,
+ *                                    int v6, int learn)
+ * \brief Receive a packet from a socket and write it to the tun interface.
+ *
+ * \param w The worker.
+ * \param fd_net The socket fd.
+ * \param v6 1 for a v6 socket.
+ * \param learn 1 for a server socket.
+ */
+static inline void fwd_net_out(struct fwd_worker *w, int fd_net,
+                               int v6, int learn) {
+   w->ops->out[v6][learn](w->cfg, fd_net, w->fd_tun, w->outbuf);
+}
+
+#endif
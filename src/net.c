@@ -38,6 +38,8 @@
 #include "thread.h"
 #include "tunalloc.h"
 #include "udptun.h"
+#include "probes.h"
+#include "reload.h"
 
 /** 
  * \struct cli_thread_parallel_args
@@ -123,35 +125,38 @@ static void *serv_thread_public4(void *st);
 static void *serv_thread_public6(void *st);
 
 /**
- * \fn static void cli_thread_parallel4(struct tun_state *state, int index)
+ * \fn static void cli_thread_parallel4(struct tun_state *state, struct dest_set *ds, int index)
  * \brief Run the TCP file clients in parallel.
  *
  * \param state The node state 
+ * \param ds The destination set
  * \param index The peer index (cli_private & cli_public)
  */
-static void cli_thread_parallel4(struct tun_state *state, int index);
-static void cli_thread_parallel6(struct tun_state *state, int index);
-static void cli_thread_parallel46(struct tun_state *state, int index);
+static void cli_thread_parallel4(struct tun_state *state, struct dest_set *ds, int index);
+static void cli_thread_parallel6(struct tun_state *state, struct dest_set *ds, int index);
+static void cli_thread_parallel46(struct tun_state *state, struct dest_set *ds, int index);
 
 /**cli_thread_notun4
- * \fn static void cli_thread_notun4(struct tun_state *state, int index)
+ * \fn static void cli_thread_notun4(struct tun_state *state, struct dest_set *ds, int index)
  * \brief Run the TCP file clients sequentially, NOTUN flow first.
  *
  * \param state The node state 
+ * \param ds The destination set
  * \param index The peer index (cli_private & cli_public)
  */
-static void cli_thread_notun4(struct tun_state *state,  int index);
-static void cli_thread_notun6(struct tun_state *state,  int index);
+static void cli_thread_notun4(struct tun_state *state, struct dest_set *ds, int index);
+static void cli_thread_notun6(struct tun_state *state, struct dest_set *ds, int index);
 
 /**
- * \fn static void cli_thread_tun4(struct tun_state *state, int index)
+ * \fn static void cli_thread_tun4(struct tun_state *state, struct dest_set *ds, int index)
  * \brief Run the TCP file clients sequentially, TUN flow first.
  *
  * \param state The node state 
+ * \param ds The destination set
  * \param index The peer index (cli_private & cli_public)
  */
-static void cli_thread_tun4(struct tun_state *state, int index);
-static void cli_thread_tun6(struct tun_state *state, int index);
+static void cli_thread_tun4(struct tun_state *state, struct dest_set *ds, int index);
+static void cli_thread_tun6(struct tun_state *state, struct dest_set *ds, int index);
 
 /**
  * \fn  void *forked_cli4(void *arg)
@@ -175,11 +180,13 @@ void tun(struct tun_state *state, int *fd_tun) {
    if (args->ipv6 || args->dual_stack)
       new_if = create_tun46(state->private_addr4, state->private_mask4, 
                             state->private_addr6, state->private_mask6, 
-                            state->tun_if, fd_tun); 
+                            state->tun_if, state->tun_mtu, 
+                            state->tun_txqlen, fd_tun); 
    else
       new_if = create_tun4(state->private_addr4, 
                            state->private_mask4, 
-                           state->tun_if, fd_tun); 
+                           state->tun_if, state->tun_mtu, 
+                           state->tun_txqlen, fd_tun); 
 
    /* swap wished name with actual name */
    if (new_if) {
@@ -206,135 +213,135 @@ void *forked_cli6(void *arg) {
    return 0;
 }
 
-void cli_thread_parallel4(struct tun_state *state, int index) {
+void cli_thread_parallel4(struct tun_state *state, struct dest_set *ds, int index) {
    /* set thread arguments */
 
    struct cli_thread_parallel_args args_tun = {state, 
-                         state->cli_private[index]->sa4, 
+                         TUN_SA4(&ds->cli_private[index]), 
                          state->private_addr4, 
                          state->cli_file_tun4,
                          state->port, state->max_segment_size
                       };
    struct cli_thread_parallel_args args_notun = {state, 
-                         state->cli_public[index]->sa4, 
+                         TUN_SA4(&ds->cli_public[index]), 
                          state->public_addr4, 
                          state->cli_file_notun4,
                          state->port, 0
                       };
 
    /* launch threads */
-   pthread_t tid_tun   = xthread_create(forked_cli4, (void*)&args_tun, 0);
-   pthread_t tid_notun = xthread_create(forked_cli4, (void*)&args_notun, 0);
+   pthread_t tid_tun   = xthread_create(forked_cli4, (void*)&args_tun, 0, "cli4_tun");
+   pthread_t tid_notun = xthread_create(forked_cli4, (void*)&args_notun, 0, "cli4_notun");
    
    /* join threads */
    pthread_join(tid_tun, NULL);
    pthread_join(tid_notun, NULL);
 }
 
-void cli_thread_parallel6(struct tun_state *state, int index) {
+void cli_thread_parallel6(struct tun_state *state, struct dest_set *ds, int index) {
    /* set thread arguments */
 
    struct cli_thread_parallel_args args_tun = {state, 
-                         state->cli_private[index]->sa6, 
+                         TUN_SA6(&ds->cli_private[index]), 
                          state->private_addr6, 
                          state->cli_file_tun6,
                          state->port, state->max_segment_size
                       };
    struct cli_thread_parallel_args args_notun = {state, 
-                         state->cli_public[index]->sa6, 
+                         TUN_SA6(&ds->cli_public[index]), 
                          state->public_addr6, 
                          state->cli_file_notun6,
                          state->port, 0
                       };
 
    /* launch threads */
-   pthread_t tid_tun   = xthread_create(forked_cli6, (void*)&args_tun, 0);
-   pthread_t tid_notun = xthread_create(forked_cli6, (void*)&args_notun, 0);
+   pthread_t tid_tun   = xthread_create(forked_cli6, (void*)&args_tun, 0, "cli6_tun");
+   pthread_t tid_notun = xthread_create(forked_cli6, (void*)&args_notun, 0, "cli6_notun");
    
    /* join threads */
    pthread_join(tid_tun, NULL);
    pthread_join(tid_notun, NULL);
 }
 
-void cli_thread_parallel46(struct tun_state *state, int index) {
+void cli_thread_parallel46(struct tun_state *state, struct dest_set *ds, int index) {
    struct cli_thread_parallel_args args_tun4 = {state, 
-                         state->cli_private[index]->sa4, 
+                         TUN_SA4(&ds->cli_private[index]), 
                          state->private_addr4, 
                          state->cli_file_tun4,
                          state->port, state->max_segment_size,
                       };
    struct cli_thread_parallel_args args_notun4 = {state, 
-                         state->cli_public[index]->sa4, 
+                         TUN_SA4(&ds->cli_public[index]), 
                          state->public_addr4, 
                          state->cli_file_notun4,
                          state->port, 0
                       };
    struct cli_thread_parallel_args args_tun6 = {state, 
-                         state->cli_private[index]->sa6, 
+                         TUN_SA6(&ds->cli_private[index]), 
                          state->private_addr6, 
                          state->cli_file_tun6,
                          state->port, state->max_segment_size
                       };
    struct cli_thread_parallel_args args_notun6 = {state, 
-                         state->cli_public[index]->sa6, 
+                         TUN_SA6(&ds->cli_public[index]), 
                          state->public_addr6, 
                          state->cli_file_notun6,
                          state->port, 0
                       };
 
    /* launch IPv4 cli */
-   pthread_t tid4 = xthread_create(forked_cli4, (void*)&args_notun4, 0);
-   pthread_t tid6 = xthread_create(forked_cli6, (void*)&args_notun6, 0);
+   pthread_t tid4 = xthread_create(forked_cli4, (void*)&args_notun4, 0, "cli4_notun");
+   pthread_t tid6 = xthread_create(forked_cli6, (void*)&args_notun6, 0, "cli6_notun");
    
    /* join threads */
    pthread_join(tid4, NULL);
    pthread_join(tid6, NULL);
 
    /* launch IPv6 cli */
-   tid4 = xthread_create(forked_cli4, (void*)&args_tun4, 0);
-   tid6 = xthread_create(forked_cli6, (void*)&args_tun6, 0);
+   tid4 = xthread_create(forked_cli4, (void*)&args_tun4, 0, "cli4_tun");
+   tid6 = xthread_create(forked_cli6, (void*)&args_tun6, 0, "cli6_tun");
    
    /* join threads */
    pthread_join(tid4, NULL);
    pthread_join(tid6, NULL);
 }
 
-void cli_thread_tun4(struct tun_state *state, int index) {
+void cli_thread_tun4(struct tun_state *state, struct dest_set *ds, int index) {
    /* run tunneled flow */
-   tcp_cli(state, state->cli_private[index]->sa4,
+   tcp_cli(state, TUN_SA4(&ds->cli_private[index]),
            state->private_addr4, state->port, state->max_segment_size, 
             state->cli_file_tun4, AF_INET);
    /* run notun flow */
-   tcp_cli(state, state->cli_public[index]->sa4, 
+   tcp_cli(state, TUN_SA4(&ds->cli_public[index]), 
            NULL, state->port, 0, state->cli_file_notun4, AF_INET);
 }
 
-void cli_thread_tun6(struct tun_state *state, int index) {
+void cli_thread_tun6(struct tun_state *state, struct dest_set *ds, int index) {
    /* run tunneled flow */
-   tcp_cli(state, state->cli_private[index]->sa6,
+   tcp_cli(state, TUN_SA6(&ds->cli_private[index]),
            state->private_addr6, state->port, state->max_segment_size, 
            state->cli_file_tun6, AF_INET6);
    /* run notun flow */
-   tcp_cli(state, state->cli_public[index]->sa6, 
+   tcp_cli(state, TUN_SA6(&ds->cli_public[index]), 
            NULL, state->port, 0, state->cli_file_notun6, AF_INET6);
 }
 
-void cli_thread_notun4(struct tun_state *state, int index) {
+void cli_thread_notun4(struct tun_state *state, struct dest_set *ds, int index) {
    /* run notun flow */
-   tcp_cli(state, state->cli_public[index]->sa4, 
+   tcp_cli(state, TUN_SA4(&ds->cli_public[index]), 
            NULL, state->port, 0, state->cli_file_notun4, AF_INET);
    /* run tunneled flow */
-   tcp_cli(state, state->cli_private[index]->sa4, 
+   tcp_cli(state, TUN_SA4(&ds->cli_private[index]), 
            state->private_addr4, state->port, state->max_segment_size, 
            state->cli_file_tun4, AF_INET);
 }
 
-void cli_thread_notun6(struct tun_state *state, int index) {
+void cli_thread_notun6(struct tun_state *state, struct dest_set *ds, int index) {
    /* run notun flow */
-   tcp_cli(state, state->cli_public[index]->sa6, 
+   tcp_cli(state, TUN_SA6(&ds->cli_public[index]), 
            NULL, state->port, 0, state->cli_file_notun6, AF_INET6);
    /* run tunneled flow */
-   tcp_cli(state, state->cli_private[index]->sa6, 
+   tcp_cli(state, TUN_SA6(&ds->cli_private[index]), 
            state->private_addr6, state->port, state->max_segment_size, 
            state->cli_file_tun6, AF_INET6);
 }
@@ -344,7 +351,7 @@ void *cli_thread(void *st) {
    struct arguments *args = state->args;
 
    /* pick functions */
-   void (*cli_thread)(struct tun_state*, int);
+   void (*cli_thread)(struct tun_state*, struct dest_set*, int);
    switch (args->cli_mode) {
       case PARALLEL_MODE:
          if (state->dual_stack)
@@ -379,9 +386,14 @@ void *cli_thread(void *st) {
    /* initial sleep */
    sleep(state->initial_sleep);
 
-   /* Client loop */
-   for (int i=0; i<state->sa_len; i++) 
-      (*cli_thread)(state, i);
+   /* Client loop, over the destinations at its start */
+   reload_register("cli_thread");
+   RELOAD_ONLINE();
+   struct dest_set *ds = dest_set_get(dest_current(state));
+   RELOAD_OFFLINE();
+   for (uint32_t i=0; i<ds->sa_len; i++) 
+      (*cli_thread)(state, ds, i);
+   dest_set_put(ds);
 
    /* Shutdown client, not peer */
    if (args->mode == CLI_MODE)
@@ -396,16 +408,16 @@ void *serv_thread(void *st) {
 
    /* fork servers */
    if (state->dual_stack) {
-      xthread_create(serv_thread_private4, st, 1);
-      xthread_create(serv_thread_public4,  st, 1);
-      xthread_create(serv_thread_private6, st, 1);
-      xthread_create(serv_thread_public6,  st, 1);
+      xthread_create(serv_thread_private4, st, 1, "serv_private4");
+      xthread_create(serv_thread_public4,  st, 1, "serv_public4");
+      xthread_create(serv_thread_private6, st, 1, "serv_private6");
+      xthread_create(serv_thread_public6,  st, 1, "serv_public6");
    } else if (state->ipv6) {
-      xthread_create(serv_thread_private6, st, 1);
-      xthread_create(serv_thread_public6,  st, 1);
+      xthread_create(serv_thread_private6, st, 1, "serv_private6");
+      xthread_create(serv_thread_public6,  st, 1, "serv_public6");
    } else {
-      xthread_create(serv_thread_private4, st, 1);
-      xthread_create(serv_thread_public4,  st, 1);
+      xthread_create(serv_thread_private4, st, 1, "serv_private4");
+      xthread_create(serv_thread_public4,  st, 1, "serv_public4");
    }
 
    return 0;
@@ -499,7 +511,7 @@ int tcp_serv(char *addr, int port, struct tun_state *state,
 
 
       /* Fork worker thread */
-      xthread_create(serv_worker_thread, (void*) &ws, 1);
+      xthread_create(serv_worker_thread, (void*) &ws, 1, "serv_worker");
    }
 
    close(s);
@@ -526,6 +538,7 @@ void *serv_worker_thread(void *socket_desc) {
       }
       if (wsize < bsize) 
          die("file write\n");
+      PROBE2(tcp_chunk_send, s, wsize);
       memset(buf, 0, BUFF_SIZE);
    }
 
@@ -604,6 +617,7 @@ int tcp_cli(struct tun_state *st, struct sockaddr *sa,
    memset(buf, 0, BUFF_SIZE);
    int bsize = 0;
    while((bsize = xrecv(s, buf, BUFF_SIZE)) > 0) {
+       PROBE2(tcp_chunk_recv, s, bsize);
        xfwrite(fp, buf, sizeof(char), bsize);
        memset(buf, 0, BUFF_SIZE);
    } 
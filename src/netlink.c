@@ -0,0 +1,218 @@
+/**
+ * \file netlink.c
+ * \brief Interface configuration over rtnetlink.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "sysconfig.h"
+#include "netlink.h"
+#include "debug.h"
+
+#if defined(LINUX_OS)
+#  include <net/if.h>
+#  include <linux/netlink.h>
+#  include <linux/rtnetlink.h>
+
+/**
+ * \struct nl_req
+ *	\brief A batch of rtnetlink requests.
+ */
+struct nl_req {
+   char     buf[NL_BUFF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+   uint32_t len;                /*!< The length of the batch */
+   uint32_t count;              /*!< The number of requests */
+   int      err;                /*!< The request did not fit */
+};
+
+/**
+ * \fn static struct nlmsghdr *nl_msg(struct nl_req *req, int type, int flags,
+ *                                    const void *body, int len)
+ * \brief Append a request to the batch, acknowledged.
+ *
+ * \param req The batch.
+ * \param type The message type.
+ * \param flags The request flags, in addition to NLM_F_REQUEST|NLM_F_ACK.
+ * \param body The fixed header of the message (ifinfomsg, ifaddrmsg).
+ * \param len The fixed header length.
+ * \return The message, or NULL if the batch is full
+ */
+static struct nlmsghdr *nl_msg(struct nl_req *req, int type, int flags,
+                               const void *body, int len);
+
+/**
+ * \fn static void nl_attr(struct nl_req *req, struct nlmsghdr *nlh, int type,
+ *                         const void *data, int len)
+ * \brief Append an attribute to the last request of the batch.
+ */
+static void nl_attr(struct nl_req *req, struct nlmsghdr *nlh, int type,
+                    const void *data, int len);
+
+/**
+ * \fn static int nl_addr(struct nl_req *req, int ifindex, int family,
+ *                        const char *ip, const char *prefix)
+ * \brief Append an address request to the batch.
+ *
+ * \return 0 on success, -1 on a bad address
+ */
+static int nl_addr(struct nl_req *req, int ifindex, int family,
+                   const char *ip, const char *prefix);
+
+/**
+ * \fn static int nl_transact(struct nl_req *req)
+ * \brief Send the batch in one datagram and wait for its acknowledgments.
+ *
+ * \return 0 if every request succeeded, -1 otherwise (errno is filled)
+ */
+static int nl_transact(struct nl_req *req);
+
+struct nlmsghdr *nl_msg(struct nl_req *req, int type, int flags,
+                        const void *body, int len) {
+   if (req->len + NLMSG_SPACE(len) > NL_BUFF_SIZE) {
+      req->err = 1;
+      return NULL;
+   }
+   struct nlmsghdr *nlh = (struct nlmsghdr *)(req->buf + req->len);
+   memset(nlh, 0, NLMSG_SPACE(len));
+   nlh->nlmsg_len   = NLMSG_LENGTH(len);
+   nlh->nlmsg_type  = type;
+   nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+   nlh->nlmsg_seq   = ++req->count;
+   memcpy(NLMSG_DATA(nlh), body, len);
+   req->len += NLMSG_ALIGN(nlh->nlmsg_len);
+   return nlh;
+}
+
+void nl_attr(struct nl_req *req, struct nlmsghdr *nlh, int type,
+             const void *data, int len) {
+   if (!nlh)
+      return;
+   if (req->len + RTA_SPACE(len) > NL_BUFF_SIZE) {
+      req->err = 1;
+      return;
+   }
+   struct rtattr *rta = (struct rtattr *)(req->buf + req->len);
+   rta->rta_type = type;
+   rta->rta_len  = RTA_LENGTH(len);
+   memcpy(RTA_DATA(rta), data, len);
+   nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+   req->len += RTA_SPACE(len);
+}
+
+int nl_addr(struct nl_req *req, int ifindex, int family,
+            const char *ip, const char *prefix) {
+   struct in6_addr addr;
+   int len = family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+   if (inet_pton(family, ip, &addr) <= 0) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   struct ifaddrmsg ifa = {
+      .ifa_family    = family,
+      .ifa_prefixlen = strtol(prefix, NULL, 10),
+      .ifa_scope     = RT_SCOPE_UNIVERSE,
+      .ifa_index     = ifindex,
+   };
+   struct nlmsghdr *nlh = nl_msg(req, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+                                 &ifa, sizeof(ifa));
+   nl_attr(req, nlh, IFA_LOCAL, &addr, len);
+   nl_attr(req, nlh, IFA_ADDRESS, &addr, len);
+   return 0;
+}
+
+int nl_transact(struct nl_req *req) {
+   struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+   char buf[NL_BUFF_SIZE * 2] __attribute__((aligned(NLMSG_ALIGNTO)));
+   uint32_t acked = 0;
+   int fd, recvd, err = 0;
+
+   if (req->err) {
+      errno = ENOBUFS;
+      return -1;
+   }
+   if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+      return -1;
+   if (sendto(fd, req->buf, req->len, 0, (struct sockaddr *)&kernel,
+              sizeof(kernel)) < 0) {
+      err = errno;
+      goto out;
+   }
+
+   /* one acknowledgment per request, the first error is kept */
+   while (acked < req->count) {
+      if ((recvd = recv(fd, buf, sizeof(buf), 0)) < 0) {
+         if (errno == EINTR)
+            continue;
+         err = errno;
+         goto out;
+      }
+      for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf;
+           NLMSG_OK(nlh, (uint32_t)recvd); nlh = NLMSG_NEXT(nlh, recvd)) {
+         if (nlh->nlmsg_type != NLMSG_ERROR)
+            continue;
+         struct nlmsgerr *nle = NLMSG_DATA(nlh);
+         if (nle->error && !err) {
+            err = -nle->error;
+            debug_print("rtnetlink request %u: %s\n", nlh->nlmsg_seq,
+                        strerror(err));
+         }
+         acked++;
+      }
+   }
+
+out:
+   close(fd);
+   errno = err;
+   return err ? -1 : 0;
+}
+
+int nl_link_setup(const char *dev, const char *ip4, const char *prefix4,
+                  const char *ip6, const char *prefix6, int mtu, int txqlen) {
+   struct nl_req req = { .len = 0 };
+   int ifindex = if_nametoindex(dev);
+   if (!ifindex)
+      return -1;
+
+   /* link settings and up */
+   struct ifinfomsg ifi = {
+      .ifi_family = AF_UNSPEC,
+      .ifi_index  = ifindex,
+      .ifi_flags  = IFF_UP,
+      .ifi_change = IFF_UP,
+   };
+   struct nlmsghdr *nlh = nl_msg(&req, RTM_NEWLINK, 0, &ifi, sizeof(ifi));
+   if (mtu)
+      nl_attr(&req, nlh, IFLA_MTU, &mtu, sizeof(mtu));
+   if (txqlen)
+      nl_attr(&req, nlh, IFLA_TXQLEN, &txqlen, sizeof(txqlen));
+
+   /* addresses */
+   if (ip4 && nl_addr(&req, ifindex, AF_INET, ip4, prefix4) < 0)
+      return -1;
+   if (ip6 && nl_addr(&req, ifindex, AF_INET6, ip6, prefix6) < 0)
+      return -1;
+
+   if (nl_transact(&req) < 0)
+      return -1;
+   debug_print("%s configured: %u rtnetlink requests\n", dev, req.count);
+   return 0;
+}
+
+#else
+
+int nl_link_setup(const char *dev, const char *ip4, const char *prefix4,
+                  const char *ip6, const char *prefix6, int mtu, int txqlen) {
+   errno = ENOSYS;
+   return -1;
+}
+
+#endif // LINUX_OS
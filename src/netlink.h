@@ -0,0 +1,45 @@
+/**
+ * \file netlink.h
+ * \brief Interface configuration over rtnetlink.
+ *
+ *    The link settings (MTU, transmit queue length, up) and the
+ *    addresses of an interface are sent to the kernel as one batch of
+ *    rtnetlink requests, in a single datagram, and acknowledged
+ *    together: no process is forked and no ioctl socket is opened per
+ *    setting.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_NETLINK_H
+#define UDPTUN_NETLINK_H
+
+/**
+ * \def NL_BUFF_SIZE
+ * \brief The size of the request and acknowledgment buffers.
+ */
+#define NL_BUFF_SIZE 1024
+
+/**
+ * \fn int nl_link_setup(const char *dev, const char *ip4, const char *prefix4,
+ *                       const char *ip6, const char *prefix6, int mtu,
+ *                       int txqlen)
+ * \brief Set the MTU, transmit queue length and addresses of an
+ *        interface and bring it up, in one rtnetlink transaction.
+ *        Addresses are replaced if already set.
+ *
+ * \param dev The interface name.
+ * \param ip4 The v4 address, or NULL.
+ * \param prefix4 The v4 prefix length.
+ * \param ip6 The v6 address, or NULL.
+ * \param prefix6 The v6 prefix length.
+ * \param mtu The MTU, or 0 to keep it.
+ * \param txqlen The transmit queue length, or 0 to keep it.
+ * \return 0 on success, -1 on error (errno is filled with the first
+ *         request error)
+ */
+int nl_link_setup(const char *dev, const char *ip4, const char *prefix4,
+                  const char *ip6, const char *prefix6, int mtu, int txqlen);
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * \file parse.c
+ * \brief Memory-mapped text file tokenizer.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "parse.h"
+#include "sock.h"
+
+/**
+ * \fn static int is_blank(char c)
+ * \brief Token separators.
+ */
+static int is_blank(char c);
+
+int is_blank(char c) {
+   return c == ' ' || c == '\t' || c == '\r';
+}
+
+int map_file(const char *path, struct map_file *mf) {
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return -1;
+   if (fstat(fd, &st) < 0) {
+      close(fd);
+      return -1;
+   }
+
+   mf->len  = st.st_size;
+   mf->data = NULL;
+   if (mf->len) {
+      void *p = mmap(NULL, mf->len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+         close(fd);
+         return -1;
+      }
+      madvise(p, mf->len, MADV_SEQUENTIAL);
+      mf->data = p;
+   }
+   close(fd);
+   return 0;
+}
+
+void unmap_file(struct map_file *mf) {
+   if (mf->data)
+      munmap((void *)mf->data, mf->len);
+   mf->data = NULL;
+   mf->len  = 0;
+}
+
+const char *next_line(const char *pos, const char *end, const char **eol) {
+   const char *nl = memchr(pos, '\n', end - pos);
+   *eol = nl ? nl : end;
+   return nl ? nl + 1 : end;
+}
+
+uint32_t count_lines(const char *pos, const char *end) {
+   uint32_t n = 0;
+   const char *nl;
+   while (pos < end && (nl = memchr(pos, '\n', end - pos))) {
+      n++;
+      pos = nl + 1;
+   }
+   return n + (pos < end);
+}
+
+int split_line(const char *pos, const char *eol, struct token *tok, int max) {
+   int n = 0;
+   while (n < max) {
+      while (pos < eol && is_blank(*pos))
+         pos++;
+      if (pos == eol || *pos == '#')
+         break;
+      tok[n].s = pos;
+      while (pos < eol && !is_blank(*pos))
+         pos++;
+      tok[n].len = pos - tok[n].s;
+      n++;
+   }
+   return n;
+}
+
+int token_eq(const struct token *tok, const char *s) {
+   return strlen(s) == tok->len && !memcmp(tok->s, s, tok->len);
+}
+
+char *token_dup(const struct token *tok) {
+   char *ret = malloc(tok->len + 1);
+   if (!ret)
+      die("malloc");
+   memcpy(ret, tok->s, tok->len);
+   ret[tok->len] = 0;
+   return ret;
+}
+
+long token_long(const struct token *tok, int *ok) {
+   size_t i = 0;
+   long val = 0, sign = 1;
+   if (tok->len && tok->s[0] == '-') {
+      sign = -1;
+      i++;
+   }
+   if (ok)
+      *ok = i < tok->len;
+   for (; i < tok->len; i++) {
+      if (tok->s[i] < '0' || tok->s[i] > '9') {
+         if (ok)
+            *ok = 0;
+         break;
+      }
+      val = val * 10 + (tok->s[i] - '0');
+   }
+   return sign * val;
+}
+
+int token_addr4(const struct token *tok, in_addr_t *addr) {
+   uint32_t val = 0, octet = 0;
+   int dots = 0, digits = 0;
+   for (size_t i = 0; i < tok->len; i++) {
+      char c = tok->s[i];
+      if (c >= '0' && c <= '9') {
+         /* no leading zero, as inet_pton */
+         if (digits == 1 && octet == 0)
+            return 0;
+         octet = octet * 10 + (c - '0');
+         if (++digits > 3 || octet > 255)
+            return 0;
+      } else if (c == '.' && digits && dots < 3) {
+         val = (val << 8) | octet;
+         octet = digits = 0;
+         dots++;
+      } else
+         return 0;
+   }
+   if (dots != 3 || !digits)
+      return 0;
+   *addr = htonl((val << 8) | octet);
+   return 1;
+}
+
+int token_addr6(const struct token *tok, void *addr) {
+   char buf[INET6_ADDRSTRLEN];
+   if (tok->len >= sizeof(buf))
+      return 0;
+   memcpy(buf, tok->s, tok->len);
+   buf[tok->len] = 0;
+   return inet_pton(AF_INET6, buf, addr) == 1;
+}
+
@@ -0,0 +1,135 @@
+/**
+ * \file parse.h
+ * \brief Memory-mapped text file tokenizer.
+ *
+ *    The configuration and destination files are mapped read-only and
+ *    tokenized in place: a token is a (pointer, length) pair into the
+ *    mapping, nothing is copied or NUL-terminated. Addresses and
+ *    integers are converted straight from tokens, with a fast path for
+ *    dotted-quad v4 addresses.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_PARSE_H
+#define UDPTUN_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/**
+ * \def PARSE_MAX_TOKENS
+ * \brief The maximal number of tokens of a line.
+ */
+#define PARSE_MAX_TOKENS 8
+
+/**
+ * \struct map_file
+ *	\brief A read-only mapped file.
+ */
+struct map_file {
+   const char *data;            /*!< The file content (NULL if empty) */
+   size_t      len;             /*!< The file length */
+};
+
+/**
+ * \struct token
+ *	\brief A token of a mapped line.
+ */
+struct token {
+   const char *s;               /*!< The first character */
+   size_t      len;             /*!< The length */
+};
+
+/**
+ * \fn int map_file(const char *path, struct map_file *mf)
+ * \brief Map a file read-only.
+ *
+ * \param path The file location.
+ * \param mf The mapping, on return.
+ * \return 0 for success, -1 on error (errno is filled)
+ */
+int map_file(const char *path, struct map_file *mf);
+
+/**
+ * \fn void unmap_file(struct map_file *mf)
+ * \brief Unmap a file mapped with map_file.
+ */
+void unmap_file(struct map_file *mf);
+
+/**
+ * \fn const char *next_line(const char *pos, const char *end,
+ *                           const char **eol)
+ * \brief Find the line starting at pos.
+ *
+ * \param pos The line start.
+ * \param end The end of the mapping.
+ * \param eol The line end (its '\n' or end), on return.
+ * \return The start of the next line.
+ */
+const char *next_line(const char *pos, const char *end, const char **eol);
+
+/**
+ * \fn uint32_t count_lines(const char *pos, const char *end)
+ * \brief Count the lines between pos and end, including an
+ *        unterminated last line.
+ */
+uint32_t count_lines(const char *pos, const char *end);
+
+/**
+ * \fn int split_line(const char *pos, const char *eol, struct token *tok,
+ *                    int max)
+ * \brief Split a line in blank separated tokens. Empty lines and lines
+ *        starting with '#' have no token.
+ *
+ * \return The number of tokens, at most max.
+ */
+int split_line(const char *pos, const char *eol, struct token *tok, int max);
+
+/**
+ * \fn int token_eq(const struct token *tok, const char *s)
+ * \brief Compare a token to a string.
+ *
+ * \return 1 if equal, 0 otherwise
+ */
+int token_eq(const struct token *tok, const char *s);
+
+/**
+ * \fn char *token_dup(const struct token *tok)
+ * \brief Copy a token to a NUL-terminated string.
+ *
+ * \return The allocated string.
+ */
+char *token_dup(const struct token *tok);
+
+/**
+ * \fn long token_long(const struct token *tok, int *ok)
+ * \brief Convert a decimal token.
+ *
+ * \param ok Set to 0 on invalid token, if not NULL.
+ * \return The value.
+ */
+long token_long(const struct token *tok, int *ok);
+
+/**
+ * \fn int token_addr4(const struct token *tok, in_addr_t *addr)
+ * \brief Convert a dotted-quad token, without the inet_pton copy.
+ *
+ * \param addr The address in network byte order, on return.
+ * \return 1 for success, 0 for an invalid address
+ */
+int token_addr4(const struct token *tok, in_addr_t *addr);
+
+/**
+ * \fn int token_addr6(const struct token *tok, void *addr)
+ * \brief Convert a v6 address token (inet_pton).
+ *
+ * \param addr The 16 bytes address, on return.
+ * \return 1 for success, 0 for an invalid address
+ */
+int token_addr6(const struct token *tok, void *addr);
+
+#endif
+
@@ -19,5 +19,23 @@
  */ 
 void tun_peer(struct arguments *args);
 
+struct fwd_cfg;
+
+/**
+ * \fn void tun_peer_fwd(const struct fwd_cfg *cfg, int fd_tun, int fd_cli4, 
+ *                       int fd_serv4, int fd_cli6, int fd_serv6)
+ * \brief Run the peer forwarding loop until shutdown or inactivity
+ *        timeout. The unused sockets of single stack modes are 0.
+ *
+ * \param cfg The forwarding configuration.
+ * \param fd_tun The tun interface fd.
+ * \param fd_cli4 The v4 client socket fd.
+ * \param fd_serv4 The v4 server socket fd.
+ * \param fd_cli6 The v6 client socket fd.
+ * \param fd_serv6 The v6 server socket fd.
+ */ 
+void tun_peer_fwd(const struct fwd_cfg *cfg, int fd_tun, int fd_cli4, int fd_serv4,
+                  int fd_cli6, int fd_serv6);
+
 #endif
 
@@ -0,0 +1,221 @@
+/**
+ * \file pktio.c
+ * \brief Packet I/O backends.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "pktio.h"
+#include "state.h"
+#include "sock.h"
+#include "net.h"
+#include "destruct.h"
+#include "debug.h"
+
+/**
+ * \var static int fake_peers[PKTIO_MAX_FD]
+ * \brief The application side of fake tuns, indexed by copycat side.
+ */
+static int fake_peers[PKTIO_MAX_FD];
+
+/**
+ * \fn static void fake_tun(struct tun_state *state, int *fd_tun)
+ * \brief Open a fake tun (datagram socketpair).
+ */
+static void fake_tun(struct tun_state *state, int *fd_tun);
+
+/**
+ * \fn static int fake_udp4(int port, uint8_t register_gc, char *addr)
+ * \brief Open a v4 udp socket on the loopback.
+ */
+static int fake_udp4(int port, uint8_t register_gc, char *addr);
+
+/**
+ * \fn static int fake_udp6(int port, uint8_t register_gc, char *addr)
+ * \brief Open a v6 udp socket on the loopback.
+ */
+static int fake_udp6(int port, uint8_t register_gc, char *addr);
+
+/**
+ * \fn static int dev_read_batch(int fd, struct pktio_buf *bufs, int n)
+ * \brief Read one packet from a tun device: a device read returns one
+ *        packet, polling for the next would cost a syscall per packet.
+ */
+static int dev_read_batch(int fd, struct pktio_buf *bufs, int n);
+
+/**
+ * \fn static int dev_write_batch(int fd, struct pktio_buf *bufs, int n)
+ * \brief Write n packets to a tun device, one write each.
+ */
+static int dev_write_batch(int fd, struct pktio_buf *bufs, int n);
+
+/**
+ * \fn static int pktio_poll_fd(int fd)
+ * \brief Backend fds are selectable.
+ */
+static int pktio_poll_fd(int fd);
+
+const struct pktio_ops pktio_tun = {
+   .name        = "tun",
+   .open_tun    = tun,
+   .open_udp4   = udp_sock4,
+   .open_udp6   = udp_sock6,
+   .read_batch  = dev_read_batch,
+   .write_batch = dev_write_batch,
+   .poll_fd     = pktio_poll_fd,
+};
+
+const struct pktio_ops pktio_fake = {
+   .name        = "fake",
+   .open_tun    = fake_tun,
+   .open_udp4   = fake_udp4,
+   .open_udp6   = fake_udp6,
+   .read_batch  = pktio_read_batch,
+   .write_batch = pktio_write_batch,
+   .poll_fd     = pktio_poll_fd,
+};
+
+const struct pktio_ops *pktio_backend(const char *name) {
+   if (!name || !strcmp(name, pktio_tun.name))
+      return &pktio_tun;
+   if (!strcmp(name, pktio_fake.name))
+      return &pktio_fake;
+   return NULL;
+}
+
+void fake_tun(struct tun_state *UNUSED(state), int *fd_tun) {
+   int sv[2];
+   if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+      die("socketpair");
+   if (sv[0] >= PKTIO_MAX_FD) {
+      errno = EMFILE;
+      die("fake tun");
+   }
+   int buf = 1024*1024;
+   for (int i = 0; i < 2; i++) {
+      setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+      setsockopt(sv[i], SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+      set_fd(sv[i]);
+   }
+   fake_peers[sv[0]] = sv[1];
+   *fd_tun = sv[0];
+   debug_print("fake tun %d, peer %d\n", sv[0], sv[1]);
+}
+
+int fake_udp4(int port, uint8_t register_gc, char *UNUSED(addr)) {
+   return udp_sock4(port, register_gc, "127.0.0.1");
+}
+
+int fake_udp6(int port, uint8_t register_gc, char *UNUSED(addr)) {
+   return udp_sock6(port, register_gc, "::1");
+}
+
+int pktio_fake_peer(int fd_tun) {
+   if (fd_tun < 0 || fd_tun >= PKTIO_MAX_FD || !fake_peers[fd_tun])
+      return -1;
+   return fake_peers[fd_tun];
+}
+
+int pktio_poll_fd(int fd) {
+   return fd;
+}
+
+int dev_read_batch(int fd, struct pktio_buf *bufs, int UNUSED(n)) {
+   int len = read(fd, bufs[0].data, bufs[0].len);
+   if (len < 0)
+      return -1;
+   bufs[0].len     = len;
+   bufs[0].addrlen = 0;
+   return 1;
+}
+
+int dev_write_batch(int fd, struct pktio_buf *bufs, int n) {
+   int i;
+   for (i = 0; i < n; i++) {
+      if (write(fd, bufs[i].data, bufs[i].len) < 0)
+         return i ? i : -1;
+   }
+   return i;
+}
+
+int pktio_read_batch(int fd, struct pktio_buf *bufs, int n) {
+   struct mmsghdr msgs[PKTIO_BATCH];
+   struct iovec iovs[PKTIO_BATCH];
+   if (n > PKTIO_BATCH)
+      n = PKTIO_BATCH;
+
+   for (int i = 0; i < n; i++) {
+      iovs[i].iov_base = bufs[i].data;
+      iovs[i].iov_len  = bufs[i].len;
+      memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+      msgs[i].msg_hdr.msg_iov     = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen  = 1;
+      msgs[i].msg_hdr.msg_name    = &bufs[i].addr;
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+   }
+
+   int ret = recvmmsg(fd, msgs, n, MSG_WAITFORONE, NULL);
+   if (ret >= 0) {
+      for (int i = 0; i < ret; i++) {
+         bufs[i].len     = msgs[i].msg_len;
+         bufs[i].addrlen = msgs[i].msg_hdr.msg_namelen;
+      }
+      return ret;
+   }
+   if (errno != ENOTSOCK)
+      return -1;
+
+   /* devices: first read blocks, then read while readable */
+   struct pollfd pfd = { .fd = fd, .events = POLLIN };
+   int i;
+   for (i = 0; i < n; i++) {
+      if (i && poll(&pfd, 1, 0) <= 0)
+         break;
+      int len = read(fd, bufs[i].data, bufs[i].len);
+      if (len < 0)
+         return i ? i : -1;
+      bufs[i].len     = len;
+      bufs[i].addrlen = 0;
+   }
+   return i;
+}
+
+int pktio_write_batch(int fd, struct pktio_buf *bufs, int n) {
+   struct mmsghdr msgs[PKTIO_BATCH];
+   struct iovec iovs[PKTIO_BATCH];
+   if (n > PKTIO_BATCH)
+      n = PKTIO_BATCH;
+
+   for (int i = 0; i < n; i++) {
+      iovs[i].iov_base = bufs[i].data;
+      iovs[i].iov_len  = bufs[i].len;
+      memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+      msgs[i].msg_hdr.msg_iov     = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen  = 1;
+      if (bufs[i].addrlen) {
+         msgs[i].msg_hdr.msg_name    = &bufs[i].addr;
+         msgs[i].msg_hdr.msg_namelen = bufs[i].addrlen;
+      }
+   }
+
+   int ret = sendmmsg(fd, msgs, n, 0);
+   if (ret >= 0 || errno != ENOTSOCK)
+      return ret;
+
+   /* devices */
+   int i;
+   for (i = 0; i < n; i++) {
+      if (write(fd, bufs[i].data, bufs[i].len) < 0)
+         return i ? i : -1;
+   }
+   return i;
+}
+
@@ -0,0 +1,116 @@
+/**
+ * \file pktio.h
+ * \brief Packet I/O backends.
+ *
+ *    The forwarding loops open their tun interface and udp sockets
+ *    through a backend (io-backend in copycat.cfg):
+ *     - "tun": the tun device and udp sockets bound to the public
+ *       addresses (default),
+ *     - "fake": one end of a datagram socketpair in place of the tun
+ *       device (the other end, see pktio_fake_peer, is the application
+ *       side) and udp sockets bound to the loopback.
+ *    The fake backend needs neither privileges nor network, so the
+ *    forwarding loops can run in a benchmark binary (copycat-bench-fwd).
+ *    The forwarding loops read and write the tun interface through
+ *    the batch functions of their backend: the tun device returns one
+ *    packet per read, the fake tun a batch per recvmmsg. Udp sockets
+ *    are plain sockets with both backends.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_PKTIO_H
+#define UDPTUN_PKTIO_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/**
+ * \def PKTIO_BATCH
+ * \brief The maximal number of packets of a batch.
+ */
+#define PKTIO_BATCH 64
+
+/**
+ * \def PKTIO_MAX_FD
+ * \brief The maximal fd of a fake tun.
+ */
+#define PKTIO_MAX_FD 1024
+
+/**
+ * \struct pktio_buf
+ *	\brief A packet of a batch.
+ */
+struct pktio_buf {
+   char    *data;                  /*!< The packet */
+   int      len;                   /*!< Its length (in: capacity on read) */
+   struct sockaddr_storage addr;   /*!< Source (read) or destination (write) */
+   socklen_t addrlen;              /*!< 0 for connected sockets and tun */
+};
+
+struct tun_state;
+
+/**
+ * \struct pktio_ops
+ *	\brief A packet I/O backend.
+ */
+struct pktio_ops {
+   const char *name;                                      /*!< The backend name */
+   void (*open_tun)(struct tun_state *state, int *fd_tun); /*!< Open the tun interface */
+   int  (*open_udp4)(int port, uint8_t register_gc, char *addr); /*!< Open a v4 udp socket */
+   int  (*open_udp6)(int port, uint8_t register_gc, char *addr); /*!< Open a v6 udp socket */
+   int  (*read_batch)(int fd, struct pktio_buf *bufs, int n);    /*!< Read up to n packets from the tun */
+   int  (*write_batch)(int fd, struct pktio_buf *bufs, int n);   /*!< Write n packets to the tun */
+   int  (*poll_fd)(int fd);                               /*!< The tun fd to select on */
+};
+
+/**
+ * \var extern const struct pktio_ops pktio_tun
+ * \brief The tun device backend.
+ */
+extern const struct pktio_ops pktio_tun;
+
+/**
+ * \var extern const struct pktio_ops pktio_fake
+ * \brief The socketpair/loopback backend.
+ */
+extern const struct pktio_ops pktio_fake;
+
+/**
+ * \fn const struct pktio_ops *pktio_backend(const char *name)
+ * \brief Find a backend by name.
+ *
+ * \param name "tun" or "fake"
+ * \return The backend, NULL if unknown
+ */
+const struct pktio_ops *pktio_backend(const char *name);
+
+/**
+ * \fn int pktio_fake_peer(int fd_tun)
+ * \brief The application side of a fake tun.
+ *
+ * \param fd_tun The fd returned by pktio_fake.open_tun
+ * \return The peer fd, -1 if fd_tun is not a fake tun
+ */
+int pktio_fake_peer(int fd_tun);
+
+/**
+ * \fn int pktio_read_batch(int fd, struct pktio_buf *bufs, int n)
+ * \brief Read up to n packets, blocking for the first one only
+ *        (recvmmsg on sockets, read on devices).
+ *
+ * \return The number of packets read, -1 on error
+ */
+int pktio_read_batch(int fd, struct pktio_buf *bufs, int n);
+
+/**
+ * \fn int pktio_write_batch(int fd, struct pktio_buf *bufs, int n)
+ * \brief Write n packets (sendmmsg on sockets, write on devices).
+ *
+ * \return The number of packets written, -1 on error
+ */
+int pktio_write_batch(int fd, struct pktio_buf *bufs, int n);
+
+#endif
+
@@ -0,0 +1,177 @@
+/**
+ * \file pktpool.c
+ * \brief Packet buffer pool.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "pktpool.h"
+#include "debug.h"
+
+/**
+ * \var static uint32_t pkt_threads
+ * \brief The number of thread indexes given.
+ */
+static uint32_t pkt_threads;
+
+/**
+ * \var static __thread int pkt_index
+ * \brief The free list index of the calling thread, -1 until its first
+ *        allocation, PKTPOOL_MAX_THREADS past the limit.
+ */
+static __thread int pkt_index = -1;
+
+/**
+ * \fn static struct pkt_cache *pkt_cache(struct pkt_pool *pool)
+ * \brief The free lists of the calling thread, or NULL.
+ */
+static struct pkt_cache *pkt_cache(struct pkt_pool *pool);
+
+/**
+ * \fn static struct pkt_buf *pkt_refill(struct pkt_pool *pool, int n)
+ * \brief Take up to n buffers from the shared pool.
+ *
+ * \return A list of buffers, or NULL if the pool is exhausted
+ */
+static struct pkt_buf *pkt_refill(struct pkt_pool *pool, int n);
+
+/**
+ * \fn static void *pkt_map(size_t len, int huge)
+ * \brief Map anonymous memory, on huge pages if huge and possible.
+ */
+static void *pkt_map(size_t len, int huge);
+
+struct pkt_cache *pkt_cache(struct pkt_pool *pool) {
+   if (pkt_index < 0) {
+      pkt_index = __atomic_fetch_add(&pkt_threads, 1, __ATOMIC_RELAXED);
+      if (pkt_index > PKTPOOL_MAX_THREADS)
+         pkt_index = PKTPOOL_MAX_THREADS;
+   }
+   return pkt_index < PKTPOOL_MAX_THREADS ? &pool->caches[pkt_index] : NULL;
+}
+
+void *pkt_map(size_t len, int huge) {
+   void *mem = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+   if (huge)
+      mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+   if (mem == MAP_FAILED) {
+      mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+      if (huge && mem != MAP_FAILED)
+         madvise(mem, len, MADV_HUGEPAGE);
+#endif
+   } else {
+      debug_print("packet pool on huge pages\n");
+   }
+   return mem == MAP_FAILED ? NULL : mem;
+}
+
+struct pkt_pool *pkt_pool_create(uint32_t count, uint32_t size,
+                                 uint32_t headroom, int huge) {
+   if (!count || !size) {
+      errno = EINVAL;
+      return NULL;
+   }
+   struct pkt_pool *pool;
+   if (posix_memalign((void **)&pool, 64, sizeof(struct pkt_pool)))
+      return NULL;
+   memset(pool, 0, sizeof(struct pkt_pool));
+
+   /* one cache line aligned stride: header, headroom, data */
+   pool->count    = count;
+   pool->headroom = headroom;
+   pool->size     = size;
+   pool->slot     = (sizeof(struct pkt_buf) + headroom + size + 63) & ~63u;
+   pool->mem_len  = (size_t)count * pool->slot;
+   if (huge)
+      pool->mem_len = (pool->mem_len + PKTPOOL_HUGEPAGE - 1)
+                    & ~((size_t)PKTPOOL_HUGEPAGE - 1);
+   pool->huge = huge;
+
+   if (!(pool->mem = pkt_map(pool->mem_len, huge))) {
+      free(pool);
+      return NULL;
+   }
+   pthread_mutex_init(&pool->lock, NULL);
+   return pool;
+}
+
+void pkt_pool_destroy(struct pkt_pool *pool) {
+   if (!pool)
+      return;
+   munmap(pool->mem, pool->mem_len);
+   pthread_mutex_destroy(&pool->lock);
+   free(pool);
+}
+
+struct pkt_buf *pkt_refill(struct pkt_pool *pool, int n) {
+   struct pkt_buf *list = NULL, *buf;
+   pthread_mutex_lock(&pool->lock);
+   for (; n > 0; n--) {
+      if ((buf = pool->free))
+         pool->free = buf->next;
+      else if (pool->carved < pool->count)
+         buf = (struct pkt_buf *)(pool->mem + (size_t)pool->carved++ * pool->slot);
+      else
+         break;
+      buf->next = list;
+      list      = buf;
+   }
+   pthread_mutex_unlock(&pool->lock);
+   return list;
+}
+
+struct pkt_buf *pkt_alloc(struct pkt_pool *pool) {
+   struct pkt_cache *c = pkt_cache(pool);
+   struct pkt_buf *buf;
+
+   if (!c)
+      buf = pkt_refill(pool, 1);
+   else {
+      /* buffers returned by other threads first, then the pool */
+      if (!c->free)
+         c->free = __atomic_exchange_n(&c->ret, NULL, __ATOMIC_ACQUIRE);
+      if (!c->free)
+         c->free = pkt_refill(pool, PKTPOOL_BATCH);
+      if ((buf = c->free))
+         c->free = buf->next;
+   }
+   if (!buf)
+      return NULL;
+
+   buf->next  = NULL;
+   buf->owner = c;
+   buf->data  = pkt_head(buf) + pool->headroom;
+   buf->len   = 0;
+   return buf;
+}
+
+void pkt_free(struct pkt_pool *pool, struct pkt_buf *buf) {
+   struct pkt_cache *c = buf->owner;
+
+   if (!c) {
+      pthread_mutex_lock(&pool->lock);
+      buf->next  = pool->free;
+      pool->free = buf;
+      pthread_mutex_unlock(&pool->lock);
+   } else if (pkt_index >= 0 && c == &pool->caches[pkt_index]) {
+      buf->next = c->free;
+      c->free   = buf;
+   } else {
+      /* push only, the owner takes the whole list: no ABA */
+      struct pkt_buf *head = __atomic_load_n(&c->ret, __ATOMIC_RELAXED);
+      do {
+         buf->next = head;
+      } while (!__atomic_compare_exchange_n(&c->ret, &head, buf, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+   }
+}
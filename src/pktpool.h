@@ -0,0 +1,142 @@
+/**
+ * \file pktpool.h
+ * \brief Packet buffer pool.
+ *
+ *    Fixed-size packet buffers carved from one mapping (huge pages if
+ *    available and requested), each with headroom in front of its data
+ *    for the headers pushed on the way (layer 4.5 header, TUN PPI
+ *    header). A thread allocates from its own free list, refilled by
+ *    batches from the shared pool. A buffer goes back to the free list
+ *    of the thread that allocated it: the owner pushes it directly,
+ *    other threads push it without lock on the owner's return list,
+ *    which the owner takes at once when its free list runs out.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_PKTPOOL_H
+#define UDPTUN_PKTPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/**
+ * \def PKTPOOL_MAX_THREADS
+ * \brief The maximal number of threads with a free list, others
+ *        allocate from the shared pool.
+ */
+#define PKTPOOL_MAX_THREADS 16
+
+/**
+ * \def PKTPOOL_BATCH
+ * \brief The number of buffers a free list takes from the shared pool.
+ */
+#define PKTPOOL_BATCH 32
+
+/**
+ * \def PKTPOOL_BUFFERS
+ * \brief The default number of buffers (pool-buffers).
+ */
+#define PKTPOOL_BUFFERS 512
+
+/**
+ * \def PKTPOOL_HEADROOM
+ * \brief The default headroom (pool-headroom).
+ */
+#define PKTPOOL_HEADROOM 64
+
+/**
+ * \def PKTPOOL_HUGEPAGE
+ * \brief The huge page size.
+ */
+#define PKTPOOL_HUGEPAGE (2 << 20)
+
+struct pkt_cache;
+
+/**
+ * \struct pkt_buf
+ *	\brief A packet buffer, followed by its headroom and data.
+ */
+struct pkt_buf {
+   struct pkt_buf   *next;      /*!< The next free buffer */
+   struct pkt_cache *owner;     /*!< The free list it returns to, or NULL */
+   char             *data;      /*!< The packet, past the headroom after pkt_alloc */
+   int               len;       /*!< The packet length */
+} __attribute__((aligned(64)));
+
+/**
+ * \struct pkt_cache
+ *	\brief The free lists of a thread.
+ */
+struct pkt_cache {
+   struct pkt_buf *free;        /*!< Written by the owner only */
+   struct pkt_buf *ret __attribute__((aligned(64))); /*!< Returned by other threads */
+} __attribute__((aligned(64)));
+
+/**
+ * \struct pkt_pool
+ *	\brief A pool of packet buffers.
+ */
+struct pkt_pool {
+   char    *mem;                /*!< The buffers */
+   size_t   mem_len;            /*!< The mapping length */
+   uint32_t count;              /*!< The number of buffers */
+   uint32_t slot;               /*!< The stride of the buffers */
+   uint32_t headroom;           /*!< The room in front of data */
+   uint32_t size;               /*!< The data size */
+   uint8_t  huge;               /*!< Mapped on huge pages */
+
+   pthread_mutex_t lock;        /*!< Protects free and carved */
+   struct pkt_buf *free;        /*!< Buffers returned to the pool */
+   uint32_t carved;             /*!< Buffers handed out once, never touched past it */
+
+   struct pkt_cache caches[PKTPOOL_MAX_THREADS]; /*!< By thread index */
+};
+
+/**
+ * \fn struct pkt_pool *pkt_pool_create(uint32_t count, uint32_t size,
+ *                                      uint32_t headroom, int huge)
+ * \brief Map a pool of buffers. The memory is touched as buffers are
+ *        first allocated.
+ *
+ * \param count The number of buffers.
+ * \param size The data size of a buffer.
+ * \param headroom The room in front of data.
+ * \param huge Try huge pages first (MAP_HUGETLB, then transparent).
+ * \return The pool, or NULL on error (errno is filled)
+ */
+struct pkt_pool *pkt_pool_create(uint32_t count, uint32_t size,
+                                 uint32_t headroom, int huge);
+
+/**
+ * \fn void pkt_pool_destroy(struct pkt_pool *pool)
+ * \brief Unmap a pool. Its buffers must not be used anymore.
+ */
+void pkt_pool_destroy(struct pkt_pool *pool);
+
+/**
+ * \fn struct pkt_buf *pkt_alloc(struct pkt_pool *pool)
+ * \brief Allocate a buffer, data past the headroom and len 0.
+ *
+ * \return The buffer, or NULL if the pool is exhausted
+ */
+struct pkt_buf *pkt_alloc(struct pkt_pool *pool);
+
+/**
+ * \fn void pkt_free(struct pkt_pool *pool, struct pkt_buf *buf)
+ * \brief Return a buffer to the free list of the thread that allocated
+ *        it. Any thread can free a buffer.
+ */
+void pkt_free(struct pkt_pool *pool, struct pkt_buf *buf);
+
+/**
+ * \fn static inline char *pkt_head(struct pkt_buf *buf)
+ * \brief The start of the headroom of a buffer.
+ */
+static inline char *pkt_head(struct pkt_buf *buf) {
+   return (char *)(buf + 1);
+}
+
+#endif
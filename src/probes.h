@@ -0,0 +1,73 @@
+/**
+ * \file probes.h
+ * \brief USDT static probes of the data path.
+ *
+ *    Probes of provider "copycat", usable with bpftrace/perf/systemtap
+ *    when sys/sdt.h is available at build time, e.g.
+ *       bpftrace -e 'usdt:./copycat:copycat:udp_send { @[arg1] = count(); }'
+ *    A disabled probe is a nop instruction; without sys/sdt.h they
+ *    are removed and their arguments discarded.
+ *
+ *    tun_read(len), tun_write(len, peer), header_push(len),
+ *    header_strip(len), lookup(table, peer), udp_send(len, peer),
+ *    udp_recv(len), icmp(type, code), tcp_chunk_send(fd, len),
+ *    tcp_chunk_recv(fd, len).
+ *    peer is the destination index (tun_rec.id), TRACE_NO_PEER for
+ *    learned peers, or -1 without known peer. table is one of
+ *    PROBE_LOOKUP_*.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_PROBES_H
+#define UDPTUN_PROBES_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+/**
+ * \def PROBE_LOOKUP_SERV
+ * \brief lookup probe table argument, source port table.
+ */
+#define PROBE_LOOKUP_SERV 0
+
+/**
+ * \def PROBE_LOOKUP_CLI4
+ * \brief lookup probe table argument, IPv4 private address table.
+ */
+#define PROBE_LOOKUP_CLI4 4
+
+/**
+ * \def PROBE_LOOKUP_CLI6
+ * \brief lookup probe table argument, IPv6 private address table.
+ */
+#define PROBE_LOOKUP_CLI6 6
+
+#if defined(HAVE_SYS_SDT_H)
+
+#include <sys/sdt.h>
+
+/**
+ * \def PROBE1(name, a)
+ * \brief Fire probe copycat:name with one argument.
+ */
+#define PROBE1(name, a) DTRACE_PROBE1(copycat, name, a)
+
+/**
+ * \def PROBE2(name, a, b)
+ * \brief Fire probe copycat:name with two arguments.
+ */
+#define PROBE2(name, a, b) DTRACE_PROBE2(copycat, name, a, b)
+
+#else
+
+/* arguments are still referenced, without code */
+#define PROBE1(name, a) do { (void)(a); } while (0)
+#define PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif
+
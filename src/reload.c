@@ -0,0 +1,195 @@
+/**
+ * \file reload.c
+ * \brief Destination set reload.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "reload.h"
+#include "state.h"
+#include "thread.h"
+#include "sock.h"
+#include "debug.h"
+#include "udptun.h"
+
+/**
+ * \var static struct reload_reader *readers
+ * \brief The list of readers, new ones are pushed in front.
+ */
+static struct reload_reader *readers;
+
+/**
+ * \var static pthread_mutex_t readers_lock
+ * \brief Protects loop registration.
+ */
+static pthread_mutex_t readers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var static pthread_key_t readers_key
+ * \brief Releases the reader of an exiting thread.
+ */
+static pthread_key_t readers_key;
+
+/**
+ * \var static pthread_once_t readers_once
+ * \brief Creates readers_key.
+ */
+static pthread_once_t readers_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \var static pthread_mutex_t reload_lock
+ * \brief Serializes reloads.
+ */
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var static struct reload_reader reload_private
+ * \brief The epoch of unregistered threads.
+ */
+static struct reload_reader reload_private;
+
+__thread struct reload_reader *reload_local = &reload_private;
+
+uint64_t reload_epoch = 1;
+
+/**
+ * \fn static void *reload_thread(void *arg)
+ * \brief Reload the destination set on SIGHUP.
+ */
+static void *reload_thread(void *arg);
+
+/**
+ * \fn static void reload_key_init()
+ * \brief Create readers_key (pthread_once).
+ */
+static void reload_key_init();
+
+/**
+ * \fn static void reload_release(void *reader)
+ * \brief Mark the reader of an exiting thread offline and free.
+ */
+static void reload_release(void *reader);
+
+/**
+ * \fn static void reload_synchronize()
+ * \brief Wait until every registered loop is offline or online at
+ *        an epoch past the last swap.
+ */
+static void reload_synchronize();
+
+static inline uint64_t now_ns() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void reload_init(struct tun_state *state) {
+   if (!state->args->dest_file)
+      return;
+
+   /* inherited by the threads created from now on */
+   sigset_t set;
+   sigemptyset(&set);
+   sigaddset(&set, SIGHUP);
+   pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+   xthread_create(reload_thread, state, 1, "reload");
+   debug_print("destination reload on SIGHUP\n");
+}
+
+void reload_key_init() {
+   if (pthread_key_create(&readers_key, reload_release))
+      die("pthread_key_create");
+}
+
+void reload_release(void *reader) {
+   struct reload_reader *r = reader;
+   __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+   pthread_mutex_lock(&readers_lock);
+   r->used = 0;
+   pthread_mutex_unlock(&readers_lock);
+}
+
+void reload_register(const char *name) {
+   if (reload_local != &reload_private)
+      return;
+   pthread_once(&readers_once, reload_key_init);
+   pthread_mutex_lock(&readers_lock);
+   struct reload_reader *r = readers;
+   while (r && r->used)
+      r = r->next;
+   if (!r) {
+      if (posix_memalign((void **)&r, 64, sizeof(struct reload_reader)))
+         die("posix_memalign");
+      memset(r, 0, sizeof(struct reload_reader));
+      r->next = readers;
+      __atomic_store_n(&readers, r, __ATOMIC_RELEASE);
+   }
+   r->used = 1;
+   memset(r->name, 0, sizeof(r->name));
+   strncpy(r->name, name, sizeof(r->name) - 1);
+   pthread_mutex_unlock(&readers_lock);
+   pthread_setspecific(readers_key, r);
+   reload_local = r;
+}
+
+void reload_synchronize() {
+   struct timespec ts = { .tv_nsec = RELOAD_POLL };
+   uint64_t epoch = __atomic_add_fetch(&reload_epoch, 1, __ATOMIC_SEQ_CST);
+
+   /* readers pushed meanwhile go online past the swap */
+   for (struct reload_reader *r = __atomic_load_n(&readers, __ATOMIC_ACQUIRE);
+        r; r = r->next) {
+      uint64_t e;
+      while ((e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST)) &&
+             e < epoch)
+         nanosleep(&ts, NULL);
+   }
+}
+
+int reload_dests(struct tun_state *state) {
+   pthread_mutex_lock(&reload_lock);
+   uint64_t start = now_ns();
+
+   /* built aside, the loops keep forwarding on the current set */
+   struct dest_set *ds = load_dest_set(state);
+   if (!ds) {
+      perror("destination reload");
+      pthread_mutex_unlock(&reload_lock);
+      return -1;
+   }
+
+   /* publish with the learned peers, then free the old set when no
+      loop can hold it */
+   struct dest_set *old = dest_set_swap(state, ds);
+   reload_synchronize();
+   dest_set_put(old);
+
+   if (!state->args->silent)
+      printf("%u destinations reloaded in %.2fms\n", ds->sa_len,
+             (now_ns() - start) / 1e6);
+   fflush(stdout);
+   pthread_mutex_unlock(&reload_lock);
+   return 0;
+}
+
+void *reload_thread(void *arg) {
+   struct tun_state *state = arg;
+   sigset_t set;
+   sigemptyset(&set);
+   sigaddset(&set, SIGHUP);
+
+   for (;;) {
+      int sig;
+      if (!sigwait(&set, &sig))
+         reload_dests(state);
+   }
+   return NULL;
+}
@@ -0,0 +1,108 @@
+/**
+ * \file reload.h
+ * \brief Destination set reload.
+ *
+ *    On SIGHUP, a reload thread builds a new destination set from the
+ *    destination file (or database) aside from the data path, swaps it
+ *    in the state and frees the old set once no forwarding loop can
+ *    still hold a pointer to it. The loops take no lock: they are
+ *    offline while waiting in select() and online, at the current
+ *    reload epoch, while they forward (quiescent state based
+ *    reclamation). A set that fails to load is reported and the
+ *    current one is kept. Peers learned by servers are copied to the new
+ *    set, unless it has a record for their source port.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_RELOAD_H
+#define UDPTUN_RELOAD_H
+
+#include <stdint.h>
+
+/**
+ * \def RELOAD_POLL
+ * \brief The grace period polling interval (ns).
+ */
+#define RELOAD_POLL 100000
+
+/**
+ * \struct reload_reader
+ *	\brief The reload epoch of a loop, on its own cache line. Readers
+ *        are never freed, the block of an exited thread is reused by
+ *        the next one to register.
+ */
+struct reload_reader {
+   uint64_t epoch;              /*!< The epoch it went online at, 0 if offline */
+   struct reload_reader *next;  /*!< The next registered reader */
+   int      used;               /*!< Held by a running thread */
+   char     name[16];           /*!< The loop name */
+} __attribute__((aligned(64)));
+
+/**
+ * \var extern uint64_t reload_epoch
+ * \brief The reload epoch, incremented after each swap (starts at 1).
+ */
+extern uint64_t reload_epoch;
+
+/**
+ * \var extern __thread struct reload_reader *reload_local
+ * \brief The epoch of the calling thread. Points to a private
+ *        (unwaited) block until the thread registers.
+ */
+extern __thread struct reload_reader *reload_local;
+
+/**
+ * \def RELOAD_ONLINE()
+ * \brief Enter a read-side section: destination sets loaded from the
+ *        state (dest_current) are valid until RELOAD_OFFLINE.
+ */
+#define RELOAD_ONLINE() do { \
+      __atomic_store_n(&reload_local->epoch, \
+                       __atomic_load_n(&reload_epoch, __ATOMIC_RELAXED), \
+                       __ATOMIC_RELAXED); \
+      __atomic_thread_fence(__ATOMIC_SEQ_CST); \
+   } while (0)
+
+/**
+ * \def RELOAD_OFFLINE()
+ * \brief Leave a read-side section (e.g. before blocking in select).
+ */
+#define RELOAD_OFFLINE() \
+      __atomic_store_n(&reload_local->epoch, 0, __ATOMIC_RELEASE)
+
+struct tun_state;
+
+/**
+ * \fn void reload_init(struct tun_state *state)
+ * \brief Start the reload thread if there is a destination file.
+ *        SIGHUP is blocked in the calling thread and in the threads
+ *        it creates later on, and waited for by the reload thread.
+ *
+ * \param state The program state
+ */
+void reload_init(struct tun_state *state);
+
+/**
+ * \fn void reload_register(const char *name)
+ * \brief Register the calling thread as a destination set reader
+ *        (once per thread, offline). The reader is released when the
+ *        thread exits.
+ *
+ * \param name The loop name
+ */
+void reload_register(const char *name);
+
+/**
+ * \fn int reload_dests(struct tun_state *state)
+ * \brief Load the destination set, swap it in and free the previous
+ *        one after a grace period. Reloads are serialized.
+ *
+ * \param state The program state
+ * \return 0 for success, -1 on error (errno is filled, the current
+ *         set is kept)
+ */
+int reload_dests(struct tun_state *state);
+
+#endif
@@ -19,5 +19,20 @@
  */ 
 void tun_serv(struct arguments *args);
 
+struct fwd_cfg;
+
+/**
+ * \fn void tun_serv_fwd(const struct fwd_cfg *cfg, int fd_tun, 
+ *                       int fd_net4, int fd_net6)
+ * \brief Run the server forwarding loop until shutdown or inactivity
+ *        timeout. The unused socket of single stack modes is 0.
+ *
+ * \param cfg The forwarding configuration.
+ * \param fd_tun The tun interface fd.
+ * \param fd_net4 The v4 socket fd.
+ * \param fd_net6 The v6 socket fd.
+ */ 
+void tun_serv_fwd(const struct fwd_cfg *cfg, int fd_tun, int fd_net4, int fd_net6);
+
 #endif
 
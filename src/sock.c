@@ -46,6 +46,12 @@
 #include "net.h"
 #include "xpcap.h"
 #include "destruct.h"
+#include "stats.h"
+#include "tstamp.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "probes.h"
+#include "bpf.h"
 
 /**
  * \fn static build_sel(fd_set *input_set, int *fds_raw, int len, int *max_fd_raw)
@@ -117,6 +123,8 @@ int udp_sock6(int port, uint8_t register_gc, char *addr) {
    if (setsockopt(s, SOL_IPV6, IPV6_RECVERR, (char*)&on, sizeof(on))) 
       die("IPV6_RECVERR");
 #endif
+   if (tstamp_enabled)
+      tstamp_sock(s);
    debug_print("udp socket created at %s:%d\n", addr, port);
    return s;
 }
@@ -152,6 +160,8 @@ int udp_sock4(int port, uint8_t register_gc, char *addr) {
    if (setsockopt(s, SOL_IP, IP_RECVERR, (char*)&on, sizeof(on))) 
       die("IP_RECVERR");
 #endif
+   if (tstamp_enabled)
+      tstamp_sock(s);
    debug_print("udp socket created at %s:%d\n", addr, port);
    return s;
 }
@@ -177,10 +187,10 @@ int raw_sock4(int port, char *addr, const struct sock_fprog * bpf, const char *d
 #  endif
 #  if defined(SO_ATTACH_FILTER)
    /* set bpf */
-   if (bpf && (proto == IPPROTO_UDP || proto == IPPROTO_TCP) && 
-          setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, 
+   if (bpf && setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, 
                          bpf, sizeof(struct sock_fprog)) < 0 ) 
        die("attach filter");
+   bpf_release(bpf);
 #  endif
    memset(&sin, 0, sizeof(sin));
    sin.sin_family = AF_INET;
@@ -199,7 +209,7 @@ int raw_sock6(int port, char *addr, const struct sock_fprog * bpf, const char *d
              int proto, uint8_t register_gc, int planetlab) {
    int s;
    struct sockaddr_in6 sin;
-   if ((s=socket(PF_INET, SOCK_RAW, proto)) == -1) 
+   if ((s=socket(PF_INET6, SOCK_RAW, proto)) == -1) 
       die("socket");
    if (register_gc)
       set_fd(s);
@@ -210,10 +220,10 @@ int raw_sock6(int port, char *addr, const struct sock_fprog * bpf, const char *d
 #  endif
 #  if defined(SO_ATTACH_FILTER)
    /* set bpf */
-   if (bpf && (proto == IPPROTO_UDP || proto == IPPROTO_TCP) && 
-         setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, 
+   if (bpf && setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, 
                          bpf, sizeof(struct sock_fprog)) < 0 ) 
        die("attach filter");
+   bpf_release(bpf);
 #  endif
    memset(&sin, 0, sizeof(sin));
    sin.sin6_family = AF_INET6;
@@ -245,20 +255,18 @@ int xselect(fd_set *input_set, int fd_max, struct timeval *tv, int timeout) {
 int xsendto4(int fd, struct sockaddr *sa, const void *buf, 
             size_t buflen) {
    int sent = 0;
-   if ((sent = sendto(fd, buf, buflen, 0, sa, sizeof(struct sockaddr_in))) < 0) {
-       //die("sendto");
-      return sent;
-    }
+   sent = sendto(fd, buf, buflen, 0, sa, sizeof(struct sockaddr_in));
+   if (tstamp_enabled)
+      tstamp_sent(fd, sent);
    return sent;
 }
 
 int xsendto6(int fd, struct sockaddr *sa, const void *buf, 
             size_t buflen) {
    int sent = 0;
-   if ((sent = sendto(fd, buf, buflen, 0, sa, sizeof(struct sockaddr_in6))) < 0) {
-       //die("sendto");
-      return sent;
-    }
+   sent = sendto(fd, buf, buflen, 0, sa, sizeof(struct sockaddr_in6));
+   if (tstamp_enabled)
+      tstamp_sent(fd, sent);
    return sent;
 }
 
@@ -269,50 +277,86 @@ int xrecverr(int fd, void *buf, size_t buflen, int fd_out, struct tun_state *sta
    struct cmsghdr *cmsg;                   
    struct sock_extended_err *sock_err;     
    struct icmphdr icmph;  
-   struct sockaddr_in remote;
-
-   /* init structs */
-   iov.iov_base       = &icmph;
-   iov.iov_len        = sizeof(icmph);
-   msg.msg_name       = (void*)&remote;
-   msg.msg_namelen    = sizeof(remote);
-   msg.msg_iov        = &iov;
-   msg.msg_iovlen     = 1;
-   msg.msg_flags      = 0;
-   msg.msg_control    = buf;
-   msg.msg_controllen = buflen;
-
-   /* recv msg */
-   if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
-      die("recvmsg");
-
-   /* parse msg */
-   for (cmsg = CMSG_FIRSTHDR(&msg);cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-      /* ip level and error */
-      if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
-         sock_err = (struct sock_extended_err*)CMSG_DATA(cmsg); 
-         /* icmp msgs */
-         if (sock_err && sock_err->ee_origin == SO_EE_ORIGIN_ICMP) 
-            print_icmp_type(sock_err->ee_type, sock_err->ee_code);
-         else debug_print("non-icmp err msg\n");
-
-         if (state) {
-            /* re-build icmp msg and forward it */
-            int pkt_len; 
-            char *pkt = forge_icmp(&pkt_len, sock_err, &iov, state);
-            xwrite(fd_out, pkt, pkt_len);
-            free(pkt); 
+   struct sockaddr_in6 remote;
+   int ret = -1;
+
+   /* drain error queue */
+   for (;;) {
+      struct timespec *ts = NULL;
+      int tx_tstamp = 0;
+      uint32_t tx_id = 0;
+
+      /* init structs */
+      iov.iov_base       = &icmph;
+      iov.iov_len        = sizeof(icmph);
+      msg.msg_name       = (void*)&remote;
+      msg.msg_namelen    = sizeof(remote);
+      msg.msg_iov        = &iov;
+      msg.msg_iovlen     = 1;
+      msg.msg_flags      = 0;
+      msg.msg_control    = buf;
+      msg.msg_controllen = buflen;
+
+      /* recv msg */
+      if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+         die("recvmsg");
+      }
+      ret = 0;
+
+      /* parse msg */
+      for (cmsg = CMSG_FIRSTHDR(&msg);cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+#  if defined(SO_TIMESTAMPING)
+         /* TX timestamp */
+         if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            ts = ((struct scm_timestamping *)CMSG_DATA(cmsg))->ts;
+            continue;
          }
-      } 
+#  endif
+         /* ip level and error */
+         if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+             (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+            sock_err = (struct sock_extended_err*)CMSG_DATA(cmsg); 
+#  if defined(SO_EE_ORIGIN_TIMESTAMPING)
+            if (sock_err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+               tx_tstamp = 1;
+               tx_id     = sock_err->ee_data;
+               continue;
+            }
+#  endif
+            STATS_INC(ST_ICMP_ERR);
+            TRACE(TR_ICMP, sock_err->ee_type, sock_err->ee_code);
+            PROBE2(icmp, sock_err->ee_type, sock_err->ee_code);
+            /* icmp msgs */
+            if (sock_err->ee_origin == SO_EE_ORIGIN_ICMP) 
+               print_icmp_type(sock_err->ee_type, sock_err->ee_code);
+            else debug_print("non-icmp err msg\n");
+
+            if (state && cmsg->cmsg_level == SOL_IP) {
+               /* re-build icmp msg and forward it */
+               int pkt_len; 
+               char *pkt = forge_icmp(&pkt_len, sock_err, &iov, state);
+               xwrite(fd_out, pkt, pkt_len);
+               free(pkt); 
+            }
+         } 
+      }
+      if (tx_tstamp && ts)
+         tstamp_completed(fd, tx_id, ts);
    }
+   return ret;
 #else
    debug_print("recvd icmp\n");
-#endif
+   STATS_INC(ST_ICMP_ERR);
    return 0;
+#endif
 }
 
 int xrecv(int fd, void *buf, size_t buflen) {
    int recvd = 0;
+   if (tstamp_enabled && tstamp_is_sock(fd))
+      return xrecvts(fd, NULL, NULL, buf, buflen);
    if ((recvd = recvfrom(fd, buf, buflen, 0, NULL, 0)) < 0) {
       debug_print("%s\n",strerror(errno));
       return -1;
@@ -324,6 +368,8 @@ int xrecvfrom(int fd, struct sockaddr *sa,
               unsigned int *salen, 
               void *buf, size_t buflen) {
    int recvd = 0;
+   if (tstamp_enabled && tstamp_is_sock(fd))
+      return xrecvts(fd, sa, salen, buf, buflen);
    if ((recvd = recvfrom(fd, buf, buflen, 0, sa, salen)) < 0) {
       debug_print("%s\n",strerror(errno));
       return -1;
@@ -331,6 +377,31 @@ int xrecvfrom(int fd, struct sockaddr *sa,
    return recvd;
 }
 
+int xrecvts(int fd, struct sockaddr *sa, 
+            unsigned int *salen, 
+            void *buf, size_t buflen) {
+   char control[CMSG_SPACE(3*sizeof(struct timespec))];
+   struct iovec iov = {.iov_base = buf, .iov_len = buflen};
+   struct msghdr msg = {
+      .msg_name       = sa,
+      .msg_namelen    = salen ? *salen : 0,
+      .msg_iov        = &iov,
+      .msg_iovlen     = 1,
+      .msg_control    = control,
+      .msg_controllen = sizeof(control),
+   };
+   /* select also wakes up on error queue (TX timestamps): do not block */
+   int recvd = recvmsg(fd, &msg, MSG_DONTWAIT);
+   if (recvd < 0) {
+      debug_print("%s\n",strerror(errno));
+      return -1;
+   }
+   if (salen)
+      *salen = msg.msg_namelen;
+   tstamp_recvd(&msg);
+   return recvd;
+}
+
 int xread(int fd, char *buf, int buflen) {
    int nread;
    if((nread=read(fd, buf, buflen)) < 0) 
@@ -353,6 +424,7 @@ int xfwrite(FILE *fp, char *buf, int size, int nmemb) {
 }
 
 void die(char *s) {
+    WATCHDOG_STAGE(WD_EXIT);
     perror(s);
     exit(1);
 }
@@ -102,7 +102,7 @@ int udp_sock6(int port, uint8_t register_gc, char *addr);
  *
  * \param port The port for the bind call.
  * \param addr The adr for the bind call.
- * \param bpf A pointer to a BPF to be attached or NULL.
+ * \param bpf A pointer to a BPF to be attached and released or NULL.
  * \param dev A pointer to the name of the device to bind. 
  * \param planetlab if running on a PL OS 1 else 0
  * \return The socket fd.
@@ -117,7 +117,7 @@ int raw_tcp_sock4(int port, char *addr, const struct sock_fprog * bpf,
  *
  * \param port The port for the bind call.
  * \param addr The adr for the bind call.
- * \param bpf A pointer to a BPF to be attached or NULL.
+ * \param bpf A pointer to a BPF to be attached and released or NULL.
  * \param dev A pointer to the name of the device to bind. 
  * \param proto The protocol of the raw socket (planetlab-specific).
  * \param register_gc Register fd to garbage collector
@@ -179,10 +179,26 @@ int xselect(fd_set *input_set, int fd_max, struct timeval *tv, int timeout);
  */ 
 int xrecvfrom(int fd, struct sockaddr *sa, unsigned int *salen, void *buf, size_t buflen);
 
+/**
+ * \fn int xrecvts(int fd, struct sockaddr *sa, unsigned int *salen, void *buf, size_t buflen)
+ * \brief recvmsg wrapper for timestamped sockets, that does not block 
+ *        and records the RX timestamp. xrecv and xrecvfrom fall back
+ *        to it on timestamped sockets.
+ *
+ * \param fd The file descriptor of the receiving socket. 
+ * \param sa modified on return to indicate the source address, or NULL.
+ * \param salen modified on return to indicate the actual size of the source address.
+ * \param buf A pointer to the buffer.
+ * \param buflen The size of the buffer.
+ * \return The amount of bytes received, -1 on error.
+ */ 
+int xrecvts(int fd, struct sockaddr *sa, unsigned int *salen, void *buf, size_t buflen);
+
 /**
  * \fn int xrecverr(int fd, void *buf, size_t buflen)
- * \brief Receive an error msg from MSG_ERRQUEUE and print a description 
- *        of it via the debug macro.
+ * \brief Receive all error msgs from MSG_ERRQUEUE and print a description 
+ *        of them via the debug macro. TX timestamps are accounted 
+ *        with tstamp_completed.
  *
  * \param fd The socket fd
  * \param buf The buffer to write err msg to
@@ -191,7 +207,7 @@ int xrecvfrom(int fd, struct sockaddr *sa, unsigned int *salen, void *buf, size_
  * \param state udptun state to forward or NULL
  * 
  * \return 0 if an error msg was received, 
- *         a negative value if an error happened
+ *         a negative value if the queue was empty
  */ 
 int xrecverr(int fd, void *buf, size_t buflen, int fd_out, struct tun_state *state);
 
@@ -235,7 +251,7 @@ int xfwrite(FILE *fp, char *buf, int size, int nmemb);
  *
  * \param s The error message.
  */ 
-void die(char *s);
+void die(char *s) __attribute__((noreturn));
 
 void *xmalloc(size_t size);
 
@@ -13,6 +13,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "state.h"
 #include "debug.h"
@@ -21,26 +24,81 @@
 #include "net.h"
 #include "xpcap.h"
 #include "thread.h"
+#include "bpf.h"
+#include "stats.h"
+#include "tstamp.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "reload.h"
+#include "pktio.h"
+#include "parse.h"
+#include "fwd.h"
+#include "pktpool.h"
 
 /**
- * \fn static int parse_dest_file4(struct arguments *args, struct tun_state *state)
- * \brief Parse destination file and file hash table with sockaddr's.
+ * \def PARSE_CHUNK_MIN
+ * \brief The minimal destination file chunk of a parser thread (bytes).
+ */
+#define PARSE_CHUNK_MIN (1 << 20)
+
+/**
+ * \def PARSE_MAX_THREADS
+ * \brief The maximal number of destination file parser threads.
+ */
+#define PARSE_MAX_THREADS 8
+
+/**
+ * \struct dest_chunk
+ *	\brief A destination file chunk, parsed by one thread.
+ */
+struct dest_chunk {
+   struct tun_state *state;     /*!< The state */
+   struct dest_set *ds;         /*!< The destination set */
+   struct tun_rec *serv_recs;   /*!< The serv table records, or NULL */
+   const char     *pos;         /*!< The first line */
+   const char     *end;         /*!< The end of the last line */
+   uint32_t        first;       /*!< Lines before the chunk (first record slot) */
+   uint32_t        count;       /*!< Parsed destinations */
+   uint32_t        err_line;    /*!< Line (in chunk) of an invalid destination, or 0 */
+};
+
+/**
+ * \fn static int parse_dest_file(struct arguments *args, struct tun_state *state,
+ *                                struct dest_set *ds)
+ * \brief Parse destination file and fill the record arena and hash tables,
+ *        in one sweep over the mapped file. Lines have 5 fields with
+ *        a cli6 table, 3 otherwise.
+ *
+ *    Files larger than 2*PARSE_CHUNK_MIN are split in chunks at line
+ *    boundaries and parsed by parallel threads into the arena slots of
+ *    their lines; the hash tables are filled in line order afterwards.
  *
  * \param args
  * \param state
+ * \param ds The destination set to fill.
  * \return 0 for success, -1 on error (errno is filled)
  */
-static int parse_dest_file4(struct arguments *args, struct tun_state *state);
+static int parse_dest_file(struct arguments *args, struct tun_state *state,
+                           struct dest_set *ds);
 
 /**
- * \fn static int parse_dest_file(struct arguments *args, struct tun_state *state)
- * \brief Parse destination file and file hash table with sockaddr's.
+ * \fn static int load_dest_db(struct arguments *args, struct tun_state *state,
+ *                             struct dest_set *ds)
+ * \brief Map a destination database in place of the destination file.
  *
  * \param args
  * \param state
+ * \param ds The destination set to fill.
  * \return 0 for success, -1 on error (errno is filled)
  */
-static int parse_dest_file(struct arguments *args, struct tun_state *state);
+static int load_dest_db(struct arguments *args, struct tun_state *state,
+                        struct dest_set *ds);
+
+/**
+ * \fn static void *parse_dest_chunk(void *arg)
+ * \brief Parse the destinations of a chunk (struct dest_chunk).
+ */
+static void *parse_dest_chunk(void *arg);
 
 /**
  * \fn static int parse_cfg_file(struct tun_state *state)
@@ -51,6 +109,22 @@ static int parse_dest_file(struct arguments *args, struct tun_state *state);
  */
 static int parse_cfg_file(struct tun_state *state);
 
+/**
+ * \fn static void init_mtu(struct tun_state *state)
+ * \brief Make the tun MTU, tunnel MTU and buffer size consistent: the
+ *        tun MTU defaults to the tunnel MTU less the encapsulation
+ *        (outer IP and udp headers, layer 4.5 header) and may not
+ *        exceed it, buffers hold a tunnel MTU packet and a PPI header.
+ */
+static void init_mtu(struct tun_state *state);
+
+/**
+ * \fn static struct fwd_cfg *init_fwd_cfg(struct tun_state *state)
+ * \brief Copy the forwarding configuration of the state in its own
+ *        cache line.
+ */
+static struct fwd_cfg *init_fwd_cfg(struct tun_state *state);
+
 /**
  * \fn static void free_tun_rec_aux(gpointer key,
  *                                  gpointer value,
@@ -59,23 +133,82 @@ static int parse_cfg_file(struct tun_state *state);
  *
  * \param key unused
  * \param value A pointer to a valid struct free_tun_rec
- * \param user_data unused
+ * \param user_data The destination set, records of its arena are not freed
  */
 static void free_tun_rec_aux(gpointer key,
                       gpointer value,
                       gpointer user_data);
 
+/**
+ * \fn static void carry_learned(gpointer key, gpointer value,
+ *                               gpointer user_data)
+ * \brief Copy a peer learned in the previous set to the new one,
+ *        unless the new one has a record for its source port.
+ *
+ * \param key unused
+ * \param value A serv record of the previous set
+ * \param user_data The previous and the new set
+ */
+static void carry_learned(gpointer key, gpointer value, gpointer user_data);
+
+/**
+ * \var static pthread_mutex_t learn_lock
+ * \brief Serializes learned peer inserts and destination set swaps.
+ */
+static pthread_mutex_t learn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \fn static struct tun_rec *alloc_recs(size_t count)
+ * \brief Allocate count zeroed, cache line aligned records.
+ */
+static struct tun_rec *alloc_recs(size_t count);
+
+/**
+ * \fn static struct tun_rec *init_recs(struct dest_set *ds, uint32_t count)
+ * \brief Allocate the records of count destinations in one arena:
+ *        cli_public, cli_private, then the serv table records (and
+ *        the cli6 keys, with a cli6 table).
+ *
+ * \param ds The destination set.
+ * \param count The number of destinations.
+ * \return The serv table records, or NULL without serv table.
+ */
+static struct tun_rec *init_recs(struct dest_set *ds, uint32_t count);
+
+/**
+ * \fn static guint addr6_hash(gconstpointer key)
+ * \brief Hash a 16 bytes v6 address key (g_str_hash stops at its
+ *        first zero byte).
+ */
+static guint addr6_hash(gconstpointer key);
+
+/**
+ * \fn static gboolean addr6_equal(gconstpointer a, gconstpointer b)
+ * \brief Compare two 16 bytes v6 address keys.
+ */
+static gboolean addr6_equal(gconstpointer a, gconstpointer b);
+
 static GHashTable *init_table(int v);
 
+guint addr6_hash(gconstpointer key) {
+   uint32_t w[4];
+   memcpy(w, key, 16);
+   return w[0] ^ w[1] ^ w[2] ^ (w[3] * 2654435761u);
+}
+
+gboolean addr6_equal(gconstpointer a, gconstpointer b) {
+   return !memcmp(a, b, 16);
+}
+
 GHashTable *init_table(int v) {
    GHashTable *htable = NULL;
 #if defined(GLIB2)
    //htable = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, 
    //                              (GDestroyNotify) free_tun_rec);
    //XXX: g_hash_table_new_full does not work with duplicated data
-   htable = g_hash_table_new((v==4) ? g_int_hash : g_str_hash, (v==4) ? g_int_equal : g_str_equal);
+   htable = g_hash_table_new((v==4) ? g_int_hash : addr6_hash, (v==4) ? g_int_equal : addr6_equal);
 #elif defined(GLIB1)
-   htable = g_hash_table_new((v==4) ? g_int_hash : g_str_hash, (v==4) ? g_int_equal : g_str_equal);
+   htable = g_hash_table_new((v==4) ? g_int_hash : addr6_hash, (v==4) ? g_int_equal : addr6_equal);
 #endif
    return htable;
 }
@@ -86,22 +219,14 @@ struct tun_state *init_tun_state(struct arguments *args) {
    if (parse_cfg_file(state) < 0)
       die("configuration file");
 
-   /* create htables */
-   if (args->mode == SERV_MODE || args->mode == FULLMESH_MODE) {
-      state->serv = init_table(4);
-   }
-   if (args->mode == CLI_MODE || args->mode == FULLMESH_MODE) {
-       state->cli4 = init_table(4);
-
-      if (args->ipv6 || args->dual_stack) {
-         state->cli6 = init_table(6);
-         if (parse_dest_file(args, state) < 0)
-            die("destination file");
-      } else {
-         if (parse_dest_file4(args, state) < 0)
-            die("destination file");
-      }
-   }
+   /* destinations & htables */
+   if (!(state->dests = load_dest_set(state)))
+      die("destination file");
+
+   /* map data path counters */
+   if (stats_init(state) < 0)
+      die("stats file");
+   tstamp_init(state);
 
    /* Replace cfg value with args */
    if (args->inactivity_timeout)
@@ -116,6 +241,14 @@ struct tun_state *init_tun_state(struct arguments *args) {
       state->dual_stack = 1; 
    state->udp = args->udp;
    state->protocol_num = args->protocol_num;
+
+   /* packet I/O backend */
+   if (!state->io)
+      state->io = &pktio_tun;
+   if (state->io == &pktio_fake && !state->udp) {
+      errno = EINVAL;
+      die("io-backend fake requires udp mode");
+   }
    state->raw_header_size = args->raw_header_size;
 
    if (args->raw_header) {
@@ -142,6 +275,23 @@ struct tun_state *init_tun_state(struct arguments *args) {
       state->snaplen = NOTUN_SNAPLEN4;
    state->snaplen += state->raw_header_size;
 
+   /* tun & tunnel MTUs, buffer size */
+   init_mtu(state);
+
+   /* packet buffers, room for the layer 4.5 and PPI headers */
+   if (!state->pool_buffers)
+      state->pool_buffers = PKTPOOL_BUFFERS;
+   if (!state->pool_headroom)
+      state->pool_headroom = PKTPOOL_HEADROOM;
+   if (state->pool_headroom < state->raw_header_size + 4u)
+      state->pool_headroom = (state->raw_header_size + 4 + 63) & ~63;
+   if (!(state->pool = pkt_pool_create(state->pool_buffers, state->buf_length,
+                                       state->pool_headroom, state->hugepages)))
+      die("packet pool");
+
+   /* forwarding configuration, read-only from now on */
+   state->fwd = init_fwd_cfg(state);
+
    /* File locations */
    state->cli_file_tun4   = xmalloc(STR_SIZE);
    state->cli_file_notun4 = xmalloc(STR_SIZE);
@@ -166,33 +316,83 @@ struct tun_state *init_tun_state(struct arguments *args) {
    init_barrier(2);
    init_destructors(state);
 
+   /* reload destinations on SIGHUP, blocked in the threads below */
+   reload_init(state);
+
+   /* start counters time series */
+   if (state->stats_interval)
+      xthread_create(stats_sampler, (void *)state, 1, "stats_sampler");
+   /* start event trace collector */
+   trace_init(state);
+   /* start event loop watchdog */
+   watchdog_init(state);
+
    return state;
 }
 
+void init_mtu(struct tun_state *state) {
+   /* v6 outer header in dual stack mode, the larger one */
+   uint32_t encap = (state->ipv6 || state->dual_stack ? 40 : 20) 
+                  + (state->udp ? 8 : 0) + state->raw_header_size;
+
+   if (!state->tunnel_mtu)
+      state->tunnel_mtu = TUNNEL_MTU;
+   if (state->tunnel_mtu > MAX_PKT_SIZE || state->tunnel_mtu <= encap + MIN_PKT_SIZE) {
+      errno = EINVAL;
+      die("tunnel-mtu");
+   }
+   if (!state->tun_mtu)
+      state->tun_mtu = state->tunnel_mtu - encap;
+   else if (state->tun_mtu + encap > state->tunnel_mtu) {
+      errno = EINVAL;
+      die("tun-mtu exceeds tunnel-mtu less encapsulation");
+   }
+
+   if (!state->buf_length)
+      state->buf_length = BUFF_SIZE;
+   if (state->buf_length < state->tunnel_mtu + 4) {
+      debug_print("buffer-length %u raised to %u\n", state->buf_length,
+                  state->tunnel_mtu + 4);
+      state->buf_length = state->tunnel_mtu + 4;
+   }
+   debug_print("tun mtu %u, tunnel mtu %u, buffers %u\n", state->tun_mtu,
+               state->tunnel_mtu, state->buf_length);
+}
+
+struct fwd_cfg *init_fwd_cfg(struct tun_state *state) {
+   struct fwd_cfg *cfg;
+   if (posix_memalign((void **)&cfg, 64, sizeof(struct fwd_cfg)))
+      die("posix_memalign");
+   memset(cfg, 0, sizeof(struct fwd_cfg));
+
+   cfg->planetlab          = state->planetlab;
+   cfg->ipv6               = state->ipv6;
+   cfg->dual_stack         = state->dual_stack;
+   cfg->udp                = state->udp;
+   cfg->raw_header_size    = state->raw_header_size;
+   cfg->inactivity_timeout = state->inactivity_timeout;
+   cfg->private_port       = state->private_port;
+   cfg->fd_lim             = state->fd_lim;
+   cfg->buf_length         = state->buf_length;
+   cfg->raw_header         = state->raw_header;
+   cfg->io                 = state->io;
+   cfg->pool               = state->pool;
+   cfg->dests              = &state->dests;
+   cfg->ops                = fwd_select(cfg);
+   return cfg;
+}
+
 void free_tun_state(struct tun_state *state) {
 
 #if defined(GLIB1)
 #endif
-   /* Free HTables (GLIB 1 && GLIB 2 < 2.12)  */
-   if (state->serv) 
-      g_hash_table_foreach (state->serv, 
-                            (GHFunc) free_tun_rec_aux,
-                            NULL);
-   if (state->cli4) 
-      g_hash_table_foreach (state->cli4, 
-                            (GHFunc) free_tun_rec_aux,
-                            NULL);
-   /*if (state->cli6) 
-      g_hash_table_foreach (state->cli6, 
-                            (GHFunc) free_tun_rec_aux,
-                            NULL);*/
-//#endif
-   if (state->serv) 
-      g_hash_table_destroy(state->serv); 
-   if (state->cli4)
-      g_hash_table_destroy(state->cli4); 
-   if (state->cli6)
-      g_hash_table_destroy(state->cli6);
+   if (state->fwd)
+      free(state->fwd);
+   pkt_pool_destroy(state->pool);
+
+   /* Free destinations & HTables */
+   if (state->dests)
+      dest_set_put(state->dests);
 
    /* Free mallocs */
    if (state->private_addr4)
@@ -227,80 +427,185 @@ void free_tun_state(struct tun_state *state) {
       free(state->out_dir);
    if (state->raw_header)
       free(state->raw_header);
+   if (state->l45_filter_value)
+      free(state->l45_filter_value);
+#if defined(LINUX_OS)
+   bpf_cache_flush();
+#endif
 
-   /* Free tun_rec's */
-   if (state->cli_private) {
-      int i;
-      for (i=0; i<state->sa_len; i++) 
-         free_tun_rec(state->cli_private[i]);
-      free(state->cli_private);
-   }
-   if (state->cli_public) {
-      int i;
-      for (i=0; i<state->sa_len; i++) 
-         free_tun_rec(state->cli_public[i]);
-      free(state->cli_public);
-   }
    free(state);
 
    destroy_barrier();
 }
 
-struct tun_rec *init_tun_rec(struct tun_state *state) {
-   struct tun_rec *ret = calloc(1, sizeof(struct tun_rec));
+struct tun_rec *alloc_recs(size_t count) {
+   void *recs;
+   if (posix_memalign(&recs, sizeof(struct tun_rec), 
+                      (count ? count : 1) * sizeof(struct tun_rec)))
+      die("posix_memalign");
+   memset(recs, 0, (count ? count : 1) * sizeof(struct tun_rec));
+   return recs;
+}
+
+struct tun_rec *init_tun_rec() {
+   return alloc_recs(1);
+}
 
-   /* IPv4 sockaddr */
-   if (state->dual_stack || !state->ipv6) {
-      ret->sa4        = xmalloc(sizeof(struct sockaddr_in));
-      ret->slen4      = sizeof(struct sockaddr_in);
-   } else {
-      ret->sa4 = NULL;
-      ret->slen4 = 0;
+void set_tun_rec(struct tun_rec *rec, const in_addr_t *addr4, 
+                 const struct in6_addr *addr6, int port) {
+   if (addr4) {
+      rec->addr4.sin_family      = AF_INET;
+      rec->addr4.sin_addr.s_addr = *addr4;
+      rec->addr4.sin_port        = htons(port);
+   }
+   if (addr6) {
+      rec->addr6.sin6_family = AF_INET6;
+      rec->addr6.sin6_addr   = *addr6;
+      rec->addr6.sin6_port   = htons(port);
+   }
+}
+
+struct tun_rec *init_recs(struct dest_set *ds, uint32_t count) {
+   /* public (cli4 & cli6), private and serv records */
+   ds->recs_len    = (ds->serv ? 3 : 2) * count;
+   ds->recs        = alloc_recs(ds->recs_len);
+   if (ds->cli6 && !(ds->priv_addr6 = calloc(count ? count : 1, 16)))
+      die("calloc");
+   ds->cli_public  = ds->recs;
+   ds->cli_private = ds->recs + count;
+   ds->sa_len      = count;
+   return ds->serv ? ds->recs + 2*count : NULL;
+}
+
+struct dest_set *load_dest_set(struct tun_state *state) {
+   struct arguments *args = state->args;
+   struct dest_set *ds    = calloc(1, sizeof(struct dest_set));
+   if (!ds)
+      die("calloc");
+   ds->refs = 1;
+
+   /* create htables */
+   if (args->mode == SERV_MODE || args->mode == FULLMESH_MODE) {
+      ds->serv = init_table(4);
+   }
+   /* servers load the optional destination file of their clients */
+   if (args->mode == CLI_MODE || args->mode == FULLMESH_MODE || 
+       (args->mode == SERV_MODE && args->dest_file)) {
+      ds->cli4 = init_table(4);
+
+      if (args->ipv6 || args->dual_stack)
+         ds->cli6 = init_table(6);
+      int ret = destdb_probe(args->dest_file) ? load_dest_db(args, state, ds)
+                                              : parse_dest_file(args, state, ds);
+      if (ret < 0) {
+         int err = errno;
+         dest_set_put(ds);
+         errno = err;
+         return NULL;
+      }
    }
+   return ds;
+}
 
-   /* IPv6 sockaddr */
-   if (state->dual_stack || state->ipv6) {
-      ret->sa6        = xmalloc(sizeof(struct sockaddr_in6));
-      ret->slen6      = sizeof(struct sockaddr_in6);
-   } else {
-      ret->sa6 = NULL;
-      ret->slen6 = 0;
+struct dest_set *dest_set_get(struct dest_set *ds) {
+   __atomic_add_fetch(&ds->refs, 1, __ATOMIC_RELAXED);
+   return ds;
+}
+
+void dest_set_put(struct dest_set *ds) {
+   if (__atomic_sub_fetch(&ds->refs, 1, __ATOMIC_ACQ_REL))
+      return;
+
+   /* Free HTables (GLIB 1 && GLIB 2 < 2.12)  */
+   /* learned peers only, cli4 & cli6 values are in recs */
+   if (ds->serv) {
+      g_hash_table_foreach (ds->serv, 
+                            (GHFunc) free_tun_rec_aux,
+                            ds);
+      g_hash_table_destroy(ds->serv); 
    }
+   if (ds->cli4)
+      g_hash_table_destroy(ds->cli4); 
+   if (ds->cli6)
+      g_hash_table_destroy(ds->cli6);
 
-   return ret;
+   /* Free tun_rec's */
+   if (ds->recs)
+      free(ds->recs);
+   if (ds->db)
+      destdb_close(ds->db);
+   else if (ds->priv_addr6)
+      free(ds->priv_addr6);
+   free(ds);
+}
+
+void dest_set_learn(struct dest_set **dests, struct tun_rec *rec) {
+   pthread_mutex_lock(&learn_lock);
+   struct dest_set *ds = __atomic_load_n(dests, __ATOMIC_RELAXED);
+   g_hash_table_insert(ds->serv, &rec->sport, rec);
+   pthread_mutex_unlock(&learn_lock);
+}
+
+struct dest_set *dest_set_swap(struct tun_state *state, struct dest_set *ds) {
+   pthread_mutex_lock(&learn_lock);
+   struct dest_set *old = state->dests;
+   if (old->serv && ds->serv) {
+      struct dest_set *sets[2] = {old, ds};
+      g_hash_table_foreach(old->serv, (GHFunc) carry_learned, sets);
+   }
+   __atomic_store_n(&state->dests, ds, __ATOMIC_SEQ_CST);
+   pthread_mutex_unlock(&learn_lock);
+   return old;
+}
+
+void carry_learned(gpointer UNUSED(key), gpointer value, gpointer user_data) {
+   struct dest_set **sets = user_data;
+   struct tun_rec *rec = value;
+   int sport = rec->sport;
+
+   /* destination file records are replaced by the new file */
+   if (rec >= sets[0]->recs && rec < sets[0]->recs + sets[0]->recs_len)
+      return;
+   if ((sets[1]->db && destdb_lookup_serv(sets[1]->db, sport)) ||
+       g_hash_table_lookup(sets[1]->serv, &sport))
+      return;
+   struct tun_rec *nrec = init_tun_rec();
+   *nrec = *rec;
+   g_hash_table_insert(sets[1]->serv, &nrec->sport, nrec);
 }
 
 void free_tun_rec_aux(gpointer UNUSED(key),
                       gpointer value,
-                      gpointer UNUSED(user_data)) { 
-   free_tun_rec((struct tun_rec *)value); 
+                      gpointer user_data) { 
+   struct dest_set *ds = user_data;
+   struct tun_rec *rec = value;
+   if (rec < ds->recs || rec >= ds->recs + ds->recs_len)
+      free_tun_rec(rec); 
 }
 
 void free_tun_rec(struct tun_rec *rec) { 
-   if (rec->sa4) free(rec->sa4);
-   if (rec->sa6) free(rec->sa6);
    if (rec) free(rec); 
 }
 
 int parse_cfg_file(struct tun_state *state) {
-   FILE *fp = fopen(state->args->config_file, "r");
-   if(!fp) {
+   struct map_file mf;
+   if (map_file(state->args->config_file, &mf) < 0) {
       errno=ENOENT;
       return -1;
    }
 
-   char key[256], val[256], c;
-   int ret;
-   /* build port to public addr lookup table */
-   while ((c =fgetc(fp)) != EOF) {
-
-      if (c == '\n') continue;
-      if (c != '#') {   
-         ungetc(c, fp);
-         ret =fscanf(fp, "%s %s", key, val);
-         if (ret < 0)
-            die("configuration file");
-         else if (ret != 2) break;
+   char key[256], val[256];
+   struct token tok[2];
+   const char *pos = mf.data, *end = mf.data + mf.len, *eol;
+   while (pos < end) {
+      const char *line = pos;
+      pos = next_line(pos, end, &eol);
+
+      int ret = split_line(line, eol, tok, 2);
+      if (ret) {   
+         if (ret != 2) break;
+         snprintf(key, sizeof(key), "%.*s", (int)tok[0].len, tok[0].s);
+         snprintf(val, sizeof(val), "%.*s", (int)tok[1].len, tok[1].s);
          debug_print("%s %s\n", key, val); 
          /* networking parameters */
          if (!strcmp(key, "public-server-port")) 
@@ -340,169 +645,269 @@ int parse_cfg_file(struct tun_state *state) {
          /* system settings */
          else if (!strcmp(key, "buffer-length")) 
             state->buf_length = strtol(val, NULL, 10);
+         else if (!strcmp(key, "tun-mtu")) 
+            state->tun_mtu = strtol(val, NULL, 10);
+         else if (!strcmp(key, "tunnel-mtu")) 
+            state->tunnel_mtu = strtol(val, NULL, 10);
+         else if (!strcmp(key, "tun-txqueuelen")) 
+            state->tun_txqlen = strtol(val, NULL, 10);
+         else if (!strcmp(key, "pool-buffers")) 
+            state->pool_buffers = strtol(val, NULL, 10);
+         else if (!strcmp(key, "pool-headroom")) 
+            state->pool_headroom = strtol(val, NULL, 10);
+         else if (!strcmp(key, "hugepages")) 
+            state->hugepages = strtol(val, NULL, 10);
          else if (!strcmp(key, "backlog-size")) 
             state->backlog_size = strtol(val, NULL, 10);
          else if (!strcmp(key, "fd-lim")) 
             state->fd_lim = strtol(val, NULL, 10);
+         else if (!strcmp(key, "stats-interval")) 
+            state->stats_interval = strtol(val, NULL, 10);
+         else if (!strcmp(key, "timestamping")) 
+            state->timestamping = strtol(val, NULL, 10);
+         else if (!strcmp(key, "trace")) 
+            state->trace = strtol(val, NULL, 10);
+         else if (!strcmp(key, "stall-threshold")) 
+            state->stall_threshold = strtol(val, NULL, 10);
+         else if (!strcmp(key, "io-backend")) {
+            if (!(state->io = pktio_backend(val))) {
+               errno = EINVAL;
+               die("io-backend");
+            }
+         }
          else if (!strcmp(key, "tun-tcp-mss")) 
             state->max_segment_size = strtol(val, NULL, 10);
          /* interfaces */
          else if (!strcmp(key, "tun-if")) 
             state->tun_if = strdup(val);
+         /* raw socket filters */
+         else if (!strcmp(key, "l45-filter-offset")) 
+            state->l45_filter_offset = strtol(val, NULL, 10);
+         else if (!strcmp(key, "l45-filter-value")) {
+            /* 1 to BPF_L45_MAX hex-encoded bytes */
+            size_t len = strlen(val);
+            for (size_t i = 0; i < len; i++)
+               if (!isxdigit((unsigned char)val[i]))
+                  len = 0;
+            if (!len || len % 2 || len > 2*BPF_L45_MAX) {
+               errno = EINVAL;
+               die("l45-filter-value");
+            }
+            if (state->l45_filter_value)
+               free(state->l45_filter_value);
+            state->l45_filter_len   = len/2;
+            state->l45_filter_value = xmalloc(state->l45_filter_len);
+            for (int i = 0; i < state->l45_filter_len; i++) {
+               char buf[3] = {val[2*i], val[2*i+1], 0};
+               state->l45_filter_value[i] = strtol(buf, NULL, 16);
+            }
+         }
       
          /* NOTE: add cfg parameters here */
       } 
-      /* dump rest of line */ 
-      do {
-         c =fgetc(fp);
-      } while (c != EOF && c != '\n');
    }
 
-   fclose(fp);
+   unmap_file(&mf);
    return 0;
 }
 
-int parse_dest_file(struct arguments *args, struct tun_state *state) {
+void *parse_dest_chunk(void *arg) {
+   struct dest_chunk *chunk = arg;
+   struct tun_state *state  = chunk->state;
+   struct dest_set *ds      = chunk->ds;
+   int v6 = ds->cli6 != NULL;
+
+   /**
+    * IPv4: <unique port> <public addr> <private addr>
+    * IPv6: <unique port> <public addr> <private addr>
+    * both: <unique port> <public addr4> <private addr4> <public addr6> <private addr6>
+    */
+   struct token tok[PARSE_MAX_TOKENS];
+   const char *pos = chunk->pos, *eol;
+   uint32_t line = 0;
+   while (pos < chunk->end) {
+      const char *start = pos;
+      pos = next_line(pos, chunk->end, &eol);
+      line++;
+
+      int n = split_line(start, eol, tok, PARSE_MAX_TOKENS);
+      if (!n)
+         continue;
+
+      int ok;
+      in_addr_t public4, private4;
+      struct in6_addr public6, private6;
+      long sport = token_long(&tok[0], &ok);
+      if (n != (v6 ? 5 : 3) || !ok ||
+          !token_addr4(&tok[1], &public4) || !token_addr4(&tok[2], &private4) ||
+          (v6 && (!token_addr6(&tok[3], &public6) ||
+                  !token_addr6(&tok[4], &private6)))) {
+         chunk->err_line = line;
+         break;
+      }
+
+      /* slots of the chunk lines, compacted later */
+      uint32_t i = chunk->first + chunk->count++;
+
+      /* public sockaddr, keyed by private address */
+      struct tun_rec *nrec_pub = &ds->cli_public[i];
+      set_tun_rec(nrec_pub, &public4, v6 ? &public6 : NULL, state->public_port);
+      nrec_pub->sport      = sport;
+      nrec_pub->priv_addr4 = private4;
+      if (v6)
+         memcpy(ds->priv_addr6[i], &private6, 16);
+
+      /* private sockaddr */
+      struct tun_rec *nrec_priv = &ds->cli_private[i];
+      set_tun_rec(nrec_priv, &private4, v6 ? &private6 : NULL, state->private_port);
+      nrec_priv->sport = sport;
+
+      /* public sockaddr, keyed by source port */
+      if (chunk->serv_recs) {
+         struct tun_rec *nrec_serv = &chunk->serv_recs[i];
+         set_tun_rec(nrec_serv, &public4, v6 ? &public6 : NULL, sport);
+         nrec_serv->sport = sport;
+      }
+   }
+   return NULL;
+}
+
+int parse_dest_file(struct arguments *args, struct tun_state *state,
+                    struct dest_set *ds) {
    if (!args->dest_file) {
       errno=ENOENT;
       return -1;
    }
 
-   /*<unique port> <public addr4> <private addr4> <public addr6> <private addr6> */
-   FILE *fp = fopen(args->dest_file, "r");
-   if(!fp) {
+   struct map_file mf;
+   if (map_file(args->dest_file, &mf) < 0) {
       errno=ENOENT;
       return -1;
    }
 
-   int sport, count=0;
-   char public4[INET_ADDRSTRLEN], private4[INET_ADDRSTRLEN]; 
-   char public6[INET6_ADDRSTRLEN], private6[INET6_ADDRSTRLEN];
-   struct tun_rec *nrec_priv = NULL;
-   /* build port to public addr lookup table */
-   while (fscanf(fp, "%d %s %s %s %s", &sport, public4, private4, 
-                                               public6, private6) == 5) {
-      nrec_priv        = init_tun_rec(state);
-      nrec_priv->sa4   = (struct sockaddr *)get_addr4(public4, state->public_port);
-      nrec_priv->sa6   = (struct sockaddr *)get_addr6(public6, state->public_port);
-      nrec_priv->sport = sport;  
-
-      /* add to Htables by n-ordered addresses */
-      if (!inet_pton(AF_INET, private4, &nrec_priv->priv_addr4))
-         die("inet_pton");      
-      if (!inet_pton(AF_INET6, private6, nrec_priv->priv_addr6))
-         die("inet_pton");  
-      g_hash_table_insert(state->cli4, &nrec_priv->priv_addr4, nrec_priv);
-      g_hash_table_insert(state->cli6, nrec_priv->priv_addr6, nrec_priv);
-
-      if (state->serv) {
-         struct tun_rec *nrec_pub  = init_tun_rec(state);
-         nrec_pub->sa4    = (struct sockaddr *)get_addr4(public4, sport);
-         nrec_pub->sa6    = (struct sockaddr *)get_addr6(public6, sport);
-         nrec_pub->sport = sport;  
-         g_hash_table_insert(state->serv, &nrec_pub->sport, nrec_pub);
+   /* split in chunks at line boundaries */
+   long nproc  = sysconf(_SC_NPROCESSORS_ONLN);
+   int nchunks = mf.len / PARSE_CHUNK_MIN;
+   if (nchunks > PARSE_MAX_THREADS)
+      nchunks = PARSE_MAX_THREADS;
+   if (nchunks > nproc)
+      nchunks = nproc;
+   if (nchunks < 2)
+      nchunks = 1;
+
+   struct dest_chunk chunks[PARSE_MAX_THREADS];
+   const char *pos = mf.data, *end = mf.data + mf.len, *eol;
+   uint32_t lines = 0;
+   for (int k = 0; k < nchunks; k++) {
+      const char *cend = end;
+      if (k < nchunks - 1) {
+         cend = mf.data + mf.len / nchunks * (k + 1);
+         cend = cend < pos ? pos : next_line(cend, end, &eol);
       }
+      chunks[k] = (struct dest_chunk) {
+         .state = state, .ds = ds, .pos = pos, .end = cend, .first = lines,
+      };
+      lines += count_lines(pos, cend);
+      pos    = cend;
+   }
 
-      debug_print("%s:%d\n", public4, sport);
-      debug_print("%s:%d\n", public6, sport);
-
-      count++;
-   }   
-  
-   /* browse twice because of array malloc */
-   rewind(fp);
-
-   /* build destination list */
-   state->cli_private = xmalloc(count * sizeof(struct tun_rec *));
-   state->cli_public  = xmalloc(count * sizeof(struct tun_rec *));
-   state->sa_len      = count;
-   int i = 0, ret; 
-   while (fscanf(fp, "%d %s %s %s %s", &sport, public4, private4, 
-                                               public6, private6) == 5) {
-      struct tun_rec *nrec_priv = init_tun_rec(state);
-      struct tun_rec *nrec_pub  = init_tun_rec(state);
-
-      /* add private sockaddr */
-      nrec_priv->sa4    = (struct sockaddr *)get_addr4(private4, state->private_port);
-      nrec_priv->sa6    = (struct sockaddr *)get_addr6(private6, state->private_port);
-      nrec_priv->sport = sport;  
-      state->cli_private[i] = nrec_priv;
-
-      /* add public sockaddr */
-      nrec_pub->sa4    = (struct sockaddr *)get_addr4(public4, state->public_port);
-      nrec_pub->sa6    = (struct sockaddr *)get_addr6(public6, state->public_port);
-      nrec_pub->sport = sport;  
-      state->cli_public[i++] = nrec_pub;
+   /* one arena slot per line */
+   struct tun_rec *serv_recs = init_recs(ds, lines);
+   for (int k = 0; k < nchunks; k++)
+      chunks[k].serv_recs = serv_recs;
+   if (nchunks == 1)
+      parse_dest_chunk(&chunks[0]);
+   else {
+      pthread_t tids[PARSE_MAX_THREADS];
+      for (int k = 0; k < nchunks; k++)
+         tids[k] = xthread_create(parse_dest_chunk, &chunks[k], 0, "dest_parse");
+      for (int k = 0; k < nchunks; k++)
+         pthread_join(tids[k], NULL);
    }
-   
-   fclose(fp);
 
+   /* compact & build lookup tables, in line order */
+   uint32_t count = 0;
+   for (int k = 0; k < nchunks; k++) {
+      if (chunks[k].err_line) {
+         fprintf(stderr, "%s:%u: invalid destination\n", args->dest_file,
+                 chunks[k].first + chunks[k].err_line);
+         unmap_file(&mf);
+         errno=EINVAL;
+         return -1;
+      }
+      for (uint32_t j = 0; j < chunks[k].count; j++, count++) {
+         uint32_t i = chunks[k].first + j;
+         struct tun_rec *nrec_pub  = &ds->cli_public[count];
+         struct tun_rec *nrec_priv = &ds->cli_private[count];
+         *nrec_pub  = ds->cli_public[i];
+         *nrec_priv = ds->cli_private[i];
+         nrec_pub->id  = count;
+         nrec_priv->id = count;
+         g_hash_table_insert(ds->cli4, &nrec_pub->priv_addr4, nrec_pub);
+         if (ds->cli6) {
+            memmove(ds->priv_addr6[count], ds->priv_addr6[i], 16);
+            g_hash_table_insert(ds->cli6, ds->priv_addr6[count], nrec_pub);
+         }
+
+         if (serv_recs) {
+            struct tun_rec *nrec_serv = &serv_recs[count];
+            *nrec_serv = serv_recs[i];
+            nrec_serv->id = count;
+            g_hash_table_insert(ds->serv, &nrec_serv->sport, nrec_serv);
+         }
+         debug_print("%d\n", nrec_pub->sport);
+      }
+   }
+   ds->sa_len = count;
+
+   unmap_file(&mf);
    return 0;
 }
 
-int parse_dest_file4(struct arguments *args, struct tun_state *state) {
-   if (!args->dest_file) {
-      errno=ENOENT;
+int load_dest_db(struct arguments *args, struct tun_state *state,
+                 struct dest_set *ds) {
+   struct destdb *db = destdb_open(args->dest_file);
+   if (!db)
       return -1;
-   }
 
-   /** 
-    * IPv4: <unique port> <public addr> <private addr> 
-    * IPv6: <unique port> <public addr> <private addr> 
-    * both: <unique port> <public addr4> <private addr4> <public addr6> <private addr6> 
-    */
-   FILE *fp = fopen(args->dest_file, "r");
-   if(!fp) {
-      errno=ENOENT;
+   /* records hold the ports of the compiling configuration */
+   if (db->hdr->public_port != state->public_port ||
+       db->hdr->private_port != state->private_port ||
+       (ds->cli6 && !db->idx_cli6)) {
+      destdb_close(db);
+      errno=EINVAL;
       return -1;
    }
-
-   int sport, count=0;
-   char public[INET_ADDRSTRLEN], private[INET_ADDRSTRLEN];
-   /* build port to public addr lookup table */
-   while (fscanf(fp, "%d %s %s", &sport, public, private) == 3) {
-      struct tun_rec *nrec_priv = init_tun_rec(state);
-      nrec_priv->sa4   = (struct sockaddr *)get_addr4(public, state->public_port);
-      nrec_priv->sport = sport;  
-      if (!inet_pton(AF_INET, private, &nrec_priv->priv_addr4))
-         die("inet_pton");
-      g_hash_table_insert(state->cli4, &nrec_priv->priv_addr4, nrec_priv);
-      debug_print("%s:%d\n", public, sport);
-
-      if (state->serv) {
-         struct tun_rec *nrec_pub  = init_tun_rec(state);
-         nrec_pub->sa4   = (struct sockaddr *)get_addr4(public, sport);
-         nrec_pub->sport = sport;  
-         g_hash_table_insert(state->serv, &nrec_pub->sport, nrec_pub);
-      }
-      count++;
-   }   
-  
-   /* browse twice because of array malloc */
-   rewind(fp);
-
-   /* build destination list */
-   state->cli_private = xmalloc(count * sizeof(struct tun_rec *));
-   state->cli_public  = xmalloc(count * sizeof(struct tun_rec *));
-   state->sa_len      = count;
-   int i = 0, ret; 
-   while ( (ret = fscanf(fp, "%d %s %s", &sport, public, private)) == 3) {
-      struct tun_rec *nrec_priv = init_tun_rec(state);
-      struct tun_rec *nrec_pub  = init_tun_rec(state);
-
-      /* add private sockaddr */
-      nrec_priv->sa4   = (struct sockaddr *)get_addr4(private, state->private_port);
-      nrec_priv->sport = sport;  
-      state->cli_private[i] = nrec_priv;
-
-      /* add public sockaddr */
-      nrec_pub->sa4   = (struct sockaddr *)get_addr4(public, state->public_port);
-      nrec_pub->sport = sport;  
-      state->cli_public[i++] = nrec_pub;
-   }
-   
-   fclose(fp);
-
+   ds->db          = db;
+   ds->priv_addr6  = db->priv_addr6;
+   ds->cli_public  = db->pub;
+   ds->cli_private = db->priv;
+   ds->sa_len      = db->hdr->count;
    return 0;
 }
 
+int compile_dest_db(struct arguments *args) {
+   struct tun_state *state = calloc(1, sizeof(struct tun_state));
+   struct dest_set *ds     = calloc(1, sizeof(struct dest_set));
+   state->args      = args;
+   args->dest_file  = args->compile_dest;
+   if (parse_cfg_file(state) < 0)
+      die("configuration file");
+
+   /* all tables, for any mode */
+   ds->refs = 1;
+   ds->serv = init_table(4);
+   ds->cli4 = init_table(4);
+   if (args->ipv6 || args->dual_stack)
+      ds->cli6 = init_table(6);
+   if (parse_dest_file(args, state, ds) < 0)
+      die("destination file");
+
+   int ret = destdb_write(args->compile_out, state, ds);
+   if (!ret && !args->silent)
+      printf("%u destinations compiled to %s\n", ds->sa_len, args->compile_out);
+
+   dest_set_put(ds);
+   free(state);
+   return ret;
+}
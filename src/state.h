@@ -13,23 +13,85 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 
+#include "destdb.h"
+
 /** 
  * \struct tun_rec
- *	\brief Represents a peer of the node.
+ *	\brief Represents a peer of the node, in one cache line: the
+ *        sockaddr's a forwarded packet is sent to, the lookup keys
+ *        compared on the way and the stats index. Records hold no
+ *        pointer, so that they can be mapped from a destination database.
  */
 struct tun_rec {
-   struct sockaddr *sa4;        /*!<  The v4 address of the client. */
-   unsigned int     slen4;      /*!<  The size of the v4 sockaddr. */
-   in_addr_t        priv_addr4; /*!<  The private v4 address in network byte order to be used as a key */
+   struct sockaddr_in  addr4;   /*!<  The v4 address of the client (TUN_SA4). */
+   struct sockaddr_in6 addr6;   /*!<  The v6 address of the client (TUN_SA6). */
+   uint32_t         id;         /*!<  The destination index, below sa_len (stats index). */
+   int              sport;      /*!<  The udp source port (serv key). */
+   in_addr_t        priv_addr4; /*!<  The private v4 address in network byte order (cli4 key). */
+} __attribute__((aligned(64)));
+
+/**
+ * \def TUN_SA4(rec)
+ * \brief The v4 sockaddr of a tun_rec.
+ */
+#define TUN_SA4(rec) ((struct sockaddr *)&(rec)->addr4)
 
-   struct sockaddr *sa6;        /*!<  The v6 address of the client. */
-   unsigned int     slen6;      /*!<  The size of the v6 sockaddr. */
-   unsigned char   priv_addr6[16];
-   //struct in6_addr  priv_addr6;  /*!<  The private v6 address in network byte order to be used as a key */
+/**
+ * \def TUN_SA6(rec)
+ * \brief The v6 sockaddr of a tun_rec.
+ */
+#define TUN_SA6(rec) ((struct sockaddr *)&(rec)->addr6)
 
-   int              sport;     /*!<  The udp source port. */
+/** 
+ * \struct dest_set
+ *	\brief The destinations of the node and their lookup tables. The
+ *        forwarding loops read the current set of the state
+ *        (dest_current); a reload builds a new set aside and swaps it
+ *        in (reload.h).
+ */
+struct dest_set {
+   GHashTable      *serv;        /*!<  Source port to public address lookup table. */
+   GHashTable      *cli4;        /*!<  Private IPv4 address to public address lookup table. */
+   GHashTable      *cli6;        /*!<  Private IPv6 address to public address lookup table. */
+   struct tun_rec  *cli_private; /*!<  Destination list. (private sockaddr's) */
+   struct tun_rec  *cli_public;  /*!<  Destination list. (public sockaddr's, cli4 & cli6 values) */ 
+   uint8_t (*priv_addr6)[16];    /*!<  Private v6 addresses of cli_public (cli6 keys), or NULL. */
+   uint32_t sa_len;              /*!<  Number of destinations. */
+   struct tun_rec  *recs;        /*!<  The records of the destination file, contiguous. */
+   uint32_t recs_len;            /*!<  Number of records in recs. */
+   struct destdb   *db;          /*!<  The mapped destination database, or NULL. */
+   uint32_t refs;                /*!<  References (the state, pinned readers). */
 };
 
+struct pktio_ops;
+struct fwd_ops;
+struct pkt_pool;
+
+/** 
+ * \struct fwd_cfg
+ *	\brief The forwarding configuration: the fields of the state read
+ *        per packet, copied once by init_tun_state in one cache line
+ *        that is never written again and is shared by the forwarding
+ *        loops. The per-packet functions (fwd.h) take it instead of the
+ *        state.
+ */
+struct fwd_cfg {
+   uint8_t planetlab;            /*!<  PlanetLab mode (4 bytes TUN PPI header) */
+   uint8_t ipv6;                 /*!<  IPv6 mode */
+   uint8_t dual_stack;           /*!<  Dual stack mode */
+   uint8_t udp;                  /*!<  UDP mode:1 non-UDP mode:0 */
+   uint8_t raw_header_size;      /*!<  Layer 4.5 header size */
+   int16_t inactivity_timeout;   /*!<  Inactivity timeout */
+   uint16_t private_port;        /*!<  The tcp listen port (peer classification) */
+   uint32_t fd_lim;              /*!<  Max number of learned peers */
+   uint32_t buf_length;          /*!<  The packet buffer size */
+   const char *raw_header;       /*!<  Layer 4.5 header, or NULL */
+   const struct pktio_ops *io;   /*!<  The packet I/O backend */
+   const struct fwd_ops *ops;    /*!<  The forwarding variants of the modes (fwd.h) */
+   struct pkt_pool *pool;        /*!<  The packet buffers */
+   struct dest_set **dests;      /*!<  The current destinations of the state (fwd_dests). */
+} __attribute__((aligned(64)));
+
 /** 
  * \struct tun_state 
  *	\brief The state of the node.
@@ -47,14 +109,15 @@ struct tun_state {
    char *raw_header;        /*!<  raw header hexstring */
    uint8_t raw_header_size;    /*!<  raw header size */
    uint8_t protocol_num;       /*!<  protocol number */
+   int16_t l45_filter_offset;  /*!<  offset of the l4.5 field matched by raw sockets */
+   char   *l45_filter_value;   /*!<  value of the l4.5 field matched by raw sockets */
+   uint8_t l45_filter_len;     /*!<  size of the l4.5 field matched by raw sockets */
 
    /* From destination file */
-   GHashTable      *serv;        /*!<  Source port to public address lookup table. */
-   GHashTable      *cli4;        /*!<  Private IPv4 address to public address lookup table. */
-   GHashTable      *cli6;        /*!<  Private IPv6 address to public address lookup table. */
-   struct tun_rec **cli_private; /*!<  Destination list. (private sockaddr's) */
-   struct tun_rec **cli_public;  /*!<  Destination list. (public sockaddr's) */ 
-   uint8_t sa_len;               /*!<  Number of destinations. */
+   struct dest_set *dests;       /*!<  The current destinations (dest_current). */
+
+   /* Built from the above */
+   struct fwd_cfg  *fwd;         /*!<  The forwarding configuration. */
 
    /* From cfg file */
    char    *tun_if;            /*!< The tun interface name. */
@@ -84,9 +147,21 @@ struct tun_state {
    char    *cli_file_tun6;       /*!< The client file location */
    char    *cli_file_notun6;     /*!< The client file location */
 
-   uint32_t buf_length;         /*!< buffer length */
+   uint32_t buf_length;         /*!< packet buffer size, at least tunnel_mtu + 4 */
+   uint32_t tun_mtu;            /*!< tun interface MTU */
+   uint32_t tun_txqlen;         /*!< tun interface transmit queue length, 0 for default */
+   uint32_t tunnel_mtu;         /*!< MTU of the path between endpoints */
+   uint32_t pool_buffers;       /*!< packet buffers in the pool */
+   uint32_t pool_headroom;      /*!< room in front of packet buffers */
+   uint8_t  hugepages;          /*!< packet pool on huge pages */
+   struct pkt_pool *pool;       /*!< The packet buffers */
    uint32_t backlog_size;       /*!< backlog size  */
    uint32_t fd_lim;             /*!< max simultaneously open fd */
+   uint32_t stats_interval;     /*!< counters sampling interval (ms), 0 to disable */
+   uint8_t  timestamping;       /*!< kernel timestamping of udp sockets */
+   uint8_t  trace;              /*!< event tracing enabled at start */
+   uint32_t stall_threshold;    /*!< event loop stall threshold (ms), 0 to disable */
+   const struct pktio_ops *io;  /*!< The packet I/O backend */
    
    uint32_t max_segment_size;   /*!< The value passed as TCP_MAXSEG 
                                      optval (max mss) for tun flow */
@@ -103,6 +178,59 @@ struct tun_state {
  */ 
 struct tun_state *init_tun_state(struct arguments *args);
 
+/**
+ * \fn int compile_dest_db(struct arguments *args)
+ * \brief Compile the destination file args->compile_dest to the
+ *        destination database args->compile_out (copycat -C).
+ *
+ * \param args The arguments (configuration file, -6/-2).
+ * \return 0 for success, -1 on error (errno is filled)
+ */ 
+int compile_dest_db(struct arguments *args);
+
+/**
+ * \fn struct dest_set *load_dest_set(struct tun_state *state)
+ * \brief Build the destination set of the state mode from its
+ *        destination file or database, aside from the current set.
+ *
+ * \param state The node state.
+ * \return The set (one reference), or NULL on error (errno is filled)
+ */ 
+struct dest_set *load_dest_set(struct tun_state *state);
+
+/**
+ * \fn struct dest_set *dest_set_get(struct dest_set *ds)
+ * \brief Take a reference to a destination set, e.g. to use its
+ *        records outside of a reload read-side section.
+ *
+ * \return ds
+ */ 
+struct dest_set *dest_set_get(struct dest_set *ds);
+
+/**
+ * \fn void dest_set_put(struct dest_set *ds)
+ * \brief Drop a reference to a destination set, free it with the
+ *        last one (records, tables and learned peers).
+ */ 
+void dest_set_put(struct dest_set *ds);
+
+/**
+ * \fn void dest_set_learn(struct dest_set **dests, struct tun_rec *rec)
+ * \brief Insert a learned peer in the serv table of the current set
+ *        (*dests), serialized with dest_set_swap.
+ */ 
+void dest_set_learn(struct dest_set **dests, struct tun_rec *rec);
+
+/**
+ * \fn struct dest_set *dest_set_swap(struct tun_state *state,
+ *                                   struct dest_set *ds)
+ * \brief Copy the peers learned in the current set to ds, unless
+ *        ds has a record for their source port, and publish ds.
+ *
+ * \return The previous set, to be put after a grace period
+ */ 
+struct dest_set *dest_set_swap(struct tun_state *state, struct dest_set *ds);
+
 /**
  * \fn void free_tun_state(struct tun_state *state)
  * \brief Free the server state.
@@ -113,11 +241,24 @@ void free_tun_state(struct tun_state *state);
 
 /**
  * \fn struct tun_rec *init_tun_rec()
- * \brief Allocate a tun_rec structure.
+ * \brief Allocate a zeroed, cache line aligned tun_rec structure.
  *
  * \return The allocated structure. 
  */
-struct tun_rec *init_tun_rec(struct tun_state *state);
+struct tun_rec *init_tun_rec();
+
+/**
+ * \fn void set_tun_rec(struct tun_rec *rec, const in_addr_t *addr4, 
+ *                      const struct in6_addr *addr6, int port)
+ * \brief Set the sockaddr's of a tun_rec structure.
+ *
+ * \param rec The tun_rec structure.
+ * \param addr4 The v4 address, or NULL for no v4 sockaddr.
+ * \param addr6 The v6 address, or NULL for no v6 sockaddr.
+ * \param port The port of both sockaddr's.
+ */
+void set_tun_rec(struct tun_rec *rec, const in_addr_t *addr4, 
+                 const struct in6_addr *addr6, int port);
 
 /**
  * \fn void free_tun_rec(struct tun_rec *rec)
@@ -127,5 +268,57 @@ struct tun_rec *init_tun_rec(struct tun_state *state);
  */
 void free_tun_rec(struct tun_rec *rec);
 
+/**
+ * \fn static inline struct dest_set *dest_current(struct tun_state *state)
+ * \brief The current destination set. Valid until the calling loop
+ *        leaves its reload read-side section (RELOAD_OFFLINE).
+ */
+static inline struct dest_set *dest_current(struct tun_state *state) {
+   return __atomic_load_n(&state->dests, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * \fn static inline struct dest_set *fwd_dests(const struct fwd_cfg *cfg)
+ * \brief The current destination set, see dest_current.
+ */
+static inline struct dest_set *fwd_dests(const struct fwd_cfg *cfg) {
+   return __atomic_load_n(cfg->dests, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * \fn static inline struct tun_rec *lookup_serv(const struct fwd_cfg *cfg, int sport)
+ * \brief Look up the serv record of a source port: destination database,
+ *        then serv table (destination file and learned peers).
+ */
+static inline struct tun_rec *lookup_serv(const struct fwd_cfg *cfg, int sport) {
+   struct dest_set *ds = fwd_dests(cfg);
+   struct tun_rec *rec;
+   if (ds->db && (rec = destdb_lookup_serv(ds->db, sport)))
+      return rec;
+   return g_hash_table_lookup(ds->serv, &sport);
+}
+
+/**
+ * \fn static inline struct tun_rec *lookup_cli4(const struct fwd_cfg *cfg, in_addr_t addr)
+ * \brief Look up the public record of a private v4 address.
+ */
+static inline struct tun_rec *lookup_cli4(const struct fwd_cfg *cfg, in_addr_t addr) {
+   struct dest_set *ds = fwd_dests(cfg);
+   if (ds->db)
+      return destdb_lookup_cli4(ds->db, addr);
+   return g_hash_table_lookup(ds->cli4, &addr);
+}
+
+/**
+ * \fn static inline struct tun_rec *lookup_cli6(const struct fwd_cfg *cfg, const void *addr)
+ * \brief Look up the public record of a private v6 address.
+ */
+static inline struct tun_rec *lookup_cli6(const struct fwd_cfg *cfg, const void *addr) {
+   struct dest_set *ds = fwd_dests(cfg);
+   if (ds->db)
+      return destdb_lookup_cli6(ds->db, addr);
+   return g_hash_table_lookup(ds->cli6, addr);
+}
+
 #endif
 
@@ -0,0 +1,244 @@
+/**
+ * \file stats.c
+ * \brief Data path statistics.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+#include "state.h"
+#include "debug.h"
+#include "udptun.h"
+
+const char *stats_names[ST_COUNTERS] = {
+   "in_pkts", "in_bytes", "out_pkts", "out_bytes", "lookup_miss",
+   "send_err", "short_pkt", "icmp_err", "drop", "stall"
+};
+
+/**
+ * \var static struct stats_thread stats_private
+ * \brief Counters of unregistered threads (or of all threads when
+ *        there is no stats file).
+ */
+static struct stats_thread stats_private;
+
+__thread struct stats_thread *stats_local = &stats_private;
+
+struct stats_peer *stats_peers;
+
+uint32_t stats_npeers;
+
+/**
+ * \var static struct stats_header *stats_map
+ * \brief The mapped stats file.
+ */
+static struct stats_header *stats_map;
+
+/**
+ * \var static size_t stats_map_len
+ * \brief The size of the mapped stats file.
+ */
+static size_t stats_map_len;
+
+int stats_init(struct tun_state *state) {
+   char file_loc[STR_SIZE];
+   if (state->args->run_id)
+      snprintf(file_loc, STR_SIZE, "%s%s.%s%s", state->out_dir, STATS_FILE,
+               state->args->run_id, STATS_FILE_EXT);
+   else
+      snprintf(file_loc, STR_SIZE, "%s%s%s", state->out_dir, STATS_FILE,
+               STATS_FILE_EXT);
+
+   size_t thread_off = sizeof(struct stats_header);
+   size_t peer_off   = thread_off + STATS_MAX_THREADS*sizeof(struct stats_thread);
+   stats_map_len     = peer_off + state->dests->sa_len*sizeof(struct stats_peer);
+
+   int fd = open(file_loc, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0)
+      return -1;
+   if (ftruncate(fd, stats_map_len) < 0) {
+      close(fd);
+      return -1;
+   }
+   stats_map = mmap(NULL, stats_map_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+   close(fd);
+   if (stats_map == MAP_FAILED) {
+      stats_map = NULL;
+      return -1;
+   }
+
+   /* zero-filled by ftruncate */
+   stats_map->version     = STATS_VERSION;
+   stats_map->max_threads = STATS_MAX_THREADS;
+   stats_map->npeers      = state->dests->sa_len;
+   stats_map->pid         = getpid();
+   stats_map->start_time  = time(NULL);
+   stats_map->thread_off  = thread_off;
+   stats_map->peer_off    = peer_off;
+   if (state->dests->sa_len) {
+      stats_peers  = (struct stats_peer *)((char *)stats_map + peer_off);
+      stats_npeers = state->dests->sa_len;
+   }
+
+   /* readers check magic last */
+   __atomic_store_n(&stats_map->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+   debug_print("stats file %s mapped\n", file_loc);
+   return 0;
+}
+
+struct stats_thread *stats_register(const char *name) {
+   if (!stats_map)
+      return stats_local;
+
+   uint32_t i = __atomic_fetch_add(&stats_map->nthreads, 1, __ATOMIC_ACQ_REL);
+   if (i >= STATS_MAX_THREADS) {
+      debug_print("no stats block left for %s\n", name);
+      return stats_local;
+   }
+
+   struct stats_thread *blocks = (struct stats_thread *)
+                                 ((char *)stats_map + stats_map->thread_off);
+   strncpy(blocks[i].name, name, sizeof(blocks[i].name) - 1);
+   stats_local = &blocks[i];
+   return stats_local;
+}
+
+void stats_snapshot(struct stats_record *rec) {
+   memset(rec->cnt, 0, sizeof(rec->cnt));
+   if (!stats_map) {
+      for (int c = 0; c < ST_COUNTERS; c++)
+         rec->cnt[c] = __atomic_load_n(&stats_private.cnt[c], __ATOMIC_RELAXED);
+      return;
+   }
+
+   const struct stats_thread *blocks = (const struct stats_thread *)
+                                       ((char *)stats_map + stats_map->thread_off);
+   uint32_t nthreads = __atomic_load_n(&stats_map->nthreads, __ATOMIC_ACQUIRE);
+   if (nthreads > STATS_MAX_THREADS)
+      nthreads = STATS_MAX_THREADS;
+   for (uint32_t i = 0; i < nthreads; i++)
+      for (int c = 0; c < ST_COUNTERS; c++)
+         rec->cnt[c] += __atomic_load_n(&blocks[i].cnt[c], __ATOMIC_RELAXED);
+}
+
+/**
+ * \struct sampler_ctx
+ *	\brief The sampler thread context, shared with its cleanup handler.
+ */
+struct sampler_ctx {
+   int fd;                      /*!< The time series file */
+   struct timespec start;       /*!< The start time (CLOCK_MONOTONIC) */
+};
+
+/**
+ * \fn static void sampler_write(struct sampler_ctx *ctx)
+ * \brief Append a snapshot of the counters to the time series file.
+ *
+ * \param ctx The sampler context
+ */
+static void sampler_write(struct sampler_ctx *ctx);
+
+/**
+ * \fn static void sampler_cleanup(void *arg)
+ * \brief Write a last record and close the file when the sampler
+ *        is canceled.
+ *
+ * \param arg The sampler context
+ */
+static void sampler_cleanup(void *arg);
+
+void sampler_write(struct sampler_ctx *ctx) {
+   struct stats_record rec;
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   rec.time = (now.tv_sec - ctx->start.tv_sec) * 1000000000ULL
+              + now.tv_nsec - ctx->start.tv_nsec;
+   stats_snapshot(&rec);
+   if (write(ctx->fd, &rec, sizeof(rec)) != sizeof(rec)) {
+      debug_print("stats series: short write\n");
+   }
+}
+
+void sampler_cleanup(void *arg) {
+   struct sampler_ctx *ctx = arg;
+   sampler_write(ctx);
+   close(ctx->fd);
+}
+
+void *stats_sampler(void *st) {
+   struct tun_state *state = st;
+   struct sampler_ctx ctx;
+   char file_loc[STR_SIZE];
+   if (state->args->run_id)
+      snprintf(file_loc, STR_SIZE, "%s%s.%s%s", state->out_dir, STATS_FILE,
+               state->args->run_id, STATS_SERIES_EXT);
+   else
+      snprintf(file_loc, STR_SIZE, "%s%s%s", state->out_dir, STATS_FILE,
+               STATS_SERIES_EXT);
+
+   ctx.fd = open(file_loc, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+   if (ctx.fd < 0) {
+      perror(file_loc);
+      return NULL;
+   }
+
+   uint32_t interval = state->stats_interval;
+   if (interval < STATS_MIN_INTERVAL)
+      interval = STATS_MIN_INTERVAL;
+
+   struct timespec real;
+   clock_gettime(CLOCK_REALTIME, &real);
+   clock_gettime(CLOCK_MONOTONIC, &ctx.start);
+   struct stats_series_header hdr = {
+      .magic      = STATS_SERIES_MAGIC,
+      .version    = STATS_VERSION,
+      .interval   = interval,
+      .counters   = ST_COUNTERS,
+      .start_time = real.tv_sec * 1000000000ULL + real.tv_nsec,
+   };
+   if (write(ctx.fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+      perror(file_loc);
+      close(ctx.fd);
+      return NULL;
+   }
+   debug_print("sampling counters every %u ms to %s\n", interval, file_loc);
+
+   pthread_cleanup_push(sampler_cleanup, &ctx);
+   /* absolute deadlines, sampling does not drift with write latency */
+   struct timespec next = ctx.start;
+   for (;;) {
+      next.tv_nsec += interval * 1000000L;
+      while (next.tv_nsec >= 1000000000L) {
+         next.tv_nsec -= 1000000000L;
+         next.tv_sec++;
+      }
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+         ;
+      sampler_write(&ctx);
+   }
+   pthread_cleanup_pop(0);
+   return NULL;
+}
+
+void stats_close() {
+   if (!stats_map)
+      return;
+   stats_npeers = 0;
+   stats_peers  = NULL;
+   stats_local = &stats_private;
+   munmap(stats_map, stats_map_len);
+   stats_map = NULL;
+}
+
@@ -0,0 +1,265 @@
+/**
+ * \file stats.h
+ * \brief Data path statistics.
+ *
+ *    Counters live in a memory-mapped file (see stats_init) so that
+ *    external tools (copycat-stat) can read them without any syscall
+ *    into copycat. Each forwarding thread owns a cache-line padded
+ *    block of counters it is the only writer of, per-peer counters are
+ *    written by the forwarding thread of the peer.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_STATS_H
+#define UDPTUN_STATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * \def CACHE_LINE_SIZE
+ * \brief The size of a cache line in bytes.
+ */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * \def STATS_MAGIC
+ * \brief The stats file magic number ("CCST").
+ */
+#define STATS_MAGIC 0x43435354
+
+/**
+ * \def STATS_VERSION
+ * \brief The stats file layout version.
+ */
+#define STATS_VERSION 2
+
+/**
+ * \def STATS_MAX_THREADS
+ * \brief The maximal number of forwarding threads with counters.
+ */
+#define STATS_MAX_THREADS 16
+
+/**
+ * \def STATS_FILE
+ * \brief The stats file name (in output directory).
+ */
+#define STATS_FILE "stats"
+
+/**
+ * \def STATS_FILE_EXT
+ * \brief The stats file name extension.
+ */
+#define STATS_FILE_EXT ".mmap"
+
+/**
+ * \def STATS_SERIES_MAGIC
+ * \brief The time series file magic number ("CCTS").
+ */
+#define STATS_SERIES_MAGIC 0x43435453
+
+/**
+ * \def STATS_SERIES_EXT
+ * \brief The time series file name extension.
+ */
+#define STATS_SERIES_EXT ".bin"
+
+/**
+ * \def STATS_MIN_INTERVAL
+ * \brief The minimal sampling interval (ms).
+ */
+#define STATS_MIN_INTERVAL 10
+
+/**
+ * \enum stats_counter
+ * \brief Per-thread data path counters. "in" is the direction from
+ *        tun to network (into the tunnel), "out" from network to tun.
+ */
+enum stats_counter {
+   ST_IN_PKTS = 0,   /*!< packets forwarded from tun to network */
+   ST_IN_BYTES,      /*!< bytes forwarded from tun to network */
+   ST_OUT_PKTS,      /*!< packets forwarded from network to tun */
+   ST_OUT_BYTES,     /*!< bytes forwarded from network to tun */
+   ST_LOOKUP_MISS,   /*!< destination lookup failures */
+   ST_SEND_ERR,      /*!< xsendto4/xsendto6 errors */
+   ST_SHORT_PKT,     /*!< received packets of at most MIN_PKT_SIZE bytes */
+   ST_ICMP_ERR,      /*!< error queue messages (ICMP) */
+   ST_DROP,          /*!< other dropped packets */
+   ST_STALL,         /*!< event loop stalls (see watchdog.h) */
+   ST_COUNTERS       /*!< number of counters */
+};
+
+/**
+ * \var extern const char *stats_names[ST_COUNTERS]
+ * \brief Counter names, indexed by enum stats_counter.
+ */
+extern const char *stats_names[ST_COUNTERS];
+
+/**
+ * \struct stats_thread
+ *	\brief The counters of a forwarding thread, on their own cache lines.
+ */
+struct stats_thread {
+   char     name[16];           /*!< The thread name */
+   uint64_t cnt[ST_COUNTERS];   /*!< The counters */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/**
+ * \struct stats_peer
+ *	\brief The counters of a peer (destination file line).
+ */
+struct stats_peer {
+   uint64_t in_pkts;            /*!< packets sent to this peer */
+   uint64_t in_bytes;           /*!< bytes sent to this peer */
+   uint64_t out_pkts;           /*!< packets received from this peer */
+   uint64_t out_bytes;          /*!< bytes received from this peer */
+};
+
+/**
+ * \struct stats_header
+ *	\brief The stats file header. Followed by max_threads struct
+ *        stats_thread at thread_off, and npeers struct stats_peer
+ *        at peer_off.
+ */
+struct stats_header {
+   uint32_t magic;              /*!< STATS_MAGIC */
+   uint32_t version;            /*!< STATS_VERSION */
+   uint32_t nthreads;           /*!< The number of registered threads */
+   uint32_t max_threads;        /*!< The number of thread blocks */
+   uint32_t npeers;             /*!< The number of peer blocks */
+   uint32_t pid;                /*!< The pid of copycat */
+   uint64_t start_time;         /*!< The start time (unix time, sec) */
+   uint64_t thread_off;         /*!< The offset of the thread blocks */
+   uint64_t peer_off;           /*!< The offset of the peer blocks */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/**
+ * \struct stats_series_header
+ *	\brief The time series file header, followed by fixed-size
+ *        struct stats_record.
+ */
+struct stats_series_header {
+   uint32_t magic;              /*!< STATS_SERIES_MAGIC */
+   uint32_t version;            /*!< STATS_VERSION */
+   uint32_t interval;           /*!< The sampling interval (ms) */
+   uint32_t counters;           /*!< ST_COUNTERS */
+   uint64_t start_time;         /*!< The start time (unix time, ns) */
+};
+
+/**
+ * \struct stats_record
+ *	\brief A snapshot of the counters summed over all threads.
+ */
+struct stats_record {
+   uint64_t time;               /*!< Time since start_time (ns) */
+   uint64_t cnt[ST_COUNTERS];   /*!< The counters */
+};
+
+/**
+ * \var extern __thread struct stats_thread *stats_local
+ * \brief The counters of the calling thread. Points to a private
+ *        block until the thread registers with stats_register().
+ */
+extern __thread struct stats_thread *stats_local;
+
+/**
+ * \var extern struct stats_peer *stats_peers
+ * \brief The per-peer counters, indexed by struct tun_rec id.
+ */
+extern struct stats_peer *stats_peers;
+
+/**
+ * \var extern uint32_t stats_npeers
+ * \brief The number of per-peer counters (destinations at startup).
+ *        Peers of a reloaded destination set past it are not counted
+ *        individually.
+ */
+extern uint32_t stats_npeers;
+
+/**
+ * \def STATS_INC(c)
+ * \brief Increment counter c of the calling thread.
+ */
+#define STATS_INC(c) (stats_local->cnt[(c)]++)
+
+/**
+ * \def STATS_ADD(c, n)
+ * \brief Add n to counter c of the calling thread.
+ */
+#define STATS_ADD(c, n) (stats_local->cnt[(c)] += (n))
+
+/**
+ * \def STATS_IN(rec, n)
+ * \brief Account a n-byte packet forwarded to peer rec (may be NULL).
+ *        Peers past stats_npeers only count in the thread totals.
+ */
+#define STATS_IN(rec, n) do { \
+      const struct tun_rec *_rec = (rec); \
+      STATS_INC(ST_IN_PKTS); STATS_ADD(ST_IN_BYTES, (n)); \
+      if (_rec && _rec->id < stats_npeers) { \
+         stats_peers[_rec->id].in_pkts++; \
+         stats_peers[_rec->id].in_bytes += (n); \
+      } \
+   } while (0)
+
+/**
+ * \def STATS_OUT(rec, n)
+ * \brief Account a n-byte packet received from peer rec (may be NULL).
+ *        Peers past stats_npeers only count in the thread totals.
+ */
+#define STATS_OUT(rec, n) do { \
+      const struct tun_rec *_rec = (rec); \
+      STATS_INC(ST_OUT_PKTS); STATS_ADD(ST_OUT_BYTES, (n)); \
+      if (_rec && _rec->id < stats_npeers) { \
+         stats_peers[_rec->id].out_pkts++; \
+         stats_peers[_rec->id].out_bytes += (n); \
+      } \
+   } while (0)
+
+struct tun_state;
+
+/**
+ * \fn int stats_init(struct tun_state *state)
+ * \brief Create and map the stats file <out_dir>/stats[.<run_id>].mmap
+ *
+ * \param state The program state (destinations must be parsed)
+ * \return 0 for success, -1 on error (errno is filled)
+ */
+int stats_init(struct tun_state *state);
+
+/**
+ * \fn struct stats_thread *stats_register(const char *name)
+ * \brief Attach a block of counters to the calling thread.
+ *
+ * \param name The thread name
+ * \return The counters of the thread
+ */
+struct stats_thread *stats_register(const char *name);
+
+/**
+ * \fn void stats_snapshot(struct stats_record *rec)
+ * \brief Sum the counters of all threads, without locking.
+ *
+ * \param rec The record to fill (time is not set)
+ */
+void stats_snapshot(struct stats_record *rec);
+
+/**
+ * \fn void *stats_sampler(void *st)
+ * \brief Append a struct stats_record to <out_dir>/stats.<run_id>.bin
+ *        every stats-interval ms.
+ *
+ * \param st The program state (struct tun_state *)
+ */
+void *stats_sampler(void *st);
+
+/**
+ * \fn void stats_close()
+ * \brief Unmap the stats file. The file is kept for post-mortem reading.
+ */
+void stats_close();
+
+#endif
+
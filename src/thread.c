@@ -5,9 +5,29 @@
  * \version 0.1
  */
 
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
 #include "thread.h"
 #include "destruct.h"
 #include "sock.h"
+#include "state.h"
+#include "udptun.h"
+
+/**
+ * \struct thread_start
+ *	\brief The arguments of thread_main.
+ */
+struct thread_start {
+   void *(*start_routine) (void *); /*!< The thread function */
+   void *args;                      /*!< Its arguments */
+   struct thread_acct *acct;        /*!< The thread accounting, or NULL */
+   char name[16];                   /*!< The thread name */
+};
 
 /**
  * \var pthread_barrier_t barr
@@ -15,6 +35,72 @@
  */
 pthread_barrier_t barr;
 
+/**
+ * \var static struct thread_acct accts[THREAD_MAX_ACCT]
+ * \brief The running threads, free slots have no name.
+ */
+static struct thread_acct accts[THREAD_MAX_ACCT];
+
+/**
+ * \var static unsigned int nacct
+ * \brief The number of slots ever used.
+ */
+static unsigned int nacct;
+
+/**
+ * \var static struct thread_acct exited[THREAD_MAX_NAMES]
+ * \brief The exited threads, by name.
+ */
+static struct thread_acct exited[THREAD_MAX_NAMES];
+
+/**
+ * \var static unsigned int nexited
+ * \brief The number of names of exited threads.
+ */
+static unsigned int nexited;
+
+/**
+ * \var static pthread_mutex_t acct_lock
+ * \brief Protects accts.
+ */
+static pthread_mutex_t acct_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \fn static struct thread_acct *new_acct(const char *name)
+ * \brief Allocate an accounting slot.
+ *
+ * \return The slot, NULL if THREAD_MAX_ACCT threads are running
+ */
+static struct thread_acct *new_acct(const char *name);
+
+/**
+ * \fn static void add_acct(struct thread_acct *sum, const struct thread_acct *a)
+ * \brief Add the resource usage of a to sum.
+ */
+static void add_acct(struct thread_acct *sum, const struct thread_acct *a);
+
+/**
+ * \fn static int read_acct(struct thread_acct *acct)
+ * \brief Read the resource usage of thread acct->tid from /proc.
+ *
+ * \return 0 for success, -1 if the thread is gone
+ */
+static int read_acct(struct thread_acct *acct);
+
+/**
+ * \fn static void thread_exit(void *acct)
+ * \brief Add the final resource usage of the calling thread to the
+ *        exited threads of its name and free its slot (cleanup
+ *        handler, also run on cancellation).
+ */
+static void thread_exit(void *acct);
+
+/**
+ * \fn static void *thread_main(void *ts)
+ * \brief Name and account the thread, then run its start routine.
+ */
+static void *thread_main(void *ts);
+
 void init_barrier(int nthreads) {
    pthread_barrier_init(&barr, NULL, nthreads);
    debug_print("barrier initialized with %d threads\n", nthreads);
@@ -30,12 +116,202 @@ void synchronize() {
       die("pthread_barrier_wait");
 }
 
-pthread_t xthread_create(void *(*start_routine) (void *), void *args, int garbage) {
+pthread_t xthread_create(void *(*start_routine) (void *), void *args, 
+                         int garbage, const char *name) {
    pthread_t thread_id;
-   if (pthread_create(&thread_id, NULL, start_routine, args) < 0) 
+   struct thread_start *ts = malloc(sizeof(struct thread_start));
+   if (!ts)
+      die("malloc");
+   ts->start_routine = start_routine;
+   ts->args          = args;
+   ts->acct          = new_acct(name);
+   strncpy(ts->name, name, sizeof(ts->name) - 1);
+   ts->name[sizeof(ts->name) - 1] = 0;
+
+   if (pthread_create(&thread_id, NULL, thread_main, ts) != 0) 
       die("pthread_create");
    if (garbage)
       set_pthread(thread_id);
    return thread_id;
 }
 
+void *thread_main(void *arg) {
+   struct thread_start ts = *(struct thread_start *)arg;
+   void *ret;
+   free(arg);
+
+   pthread_setname_np(pthread_self(), ts.name);
+   if (ts.acct)
+      __atomic_store_n(&ts.acct->tid, syscall(SYS_gettid), __ATOMIC_RELEASE);
+
+   pthread_cleanup_push(thread_exit, ts.acct);
+   ret = ts.start_routine(ts.args);
+   pthread_cleanup_pop(1);
+   return ret;
+}
+
+void thread_register(const char *name) {
+   char tname[16];
+   strncpy(tname, name, sizeof(tname) - 1);
+   tname[sizeof(tname) - 1] = 0;
+   pthread_setname_np(pthread_self(), tname);
+
+   struct thread_acct *acct = new_acct(name);
+   if (acct)
+      __atomic_store_n(&acct->tid, syscall(SYS_gettid), __ATOMIC_RELEASE);
+}
+
+struct thread_acct *new_acct(const char *name) {
+   struct thread_acct *acct = NULL;
+   pthread_mutex_lock(&acct_lock);
+   /* a slot freed by an exited thread, else a new one */
+   for (unsigned int i = 0; i < nacct && !acct; i++)
+      if (!accts[i].name[0])
+         acct = &accts[i];
+   if (!acct && nacct < THREAD_MAX_ACCT)
+      acct = &accts[nacct++];
+   if (acct) {
+      memset(acct, 0, sizeof(struct thread_acct));
+      strncpy(acct->name, name[0] ? name : "-", sizeof(acct->name) - 1);
+      acct->nthreads = 1;
+   }
+   pthread_mutex_unlock(&acct_lock);
+   return acct;
+}
+
+void add_acct(struct thread_acct *sum, const struct thread_acct *a) {
+   sum->nthreads += a->nthreads;
+   sum->cpu_ns   += a->cpu_ns;
+   sum->utime    += a->utime;
+   sum->stime    += a->stime;
+   sum->vcsw     += a->vcsw;
+   sum->ivcsw    += a->ivcsw;
+   if (sum->migrations >= 0)
+      sum->migrations = a->migrations < 0 ? -1 : sum->migrations + a->migrations;
+}
+
+void thread_exit(void *arg) {
+   struct thread_acct *acct = arg;
+   if (!acct)
+      return;
+   /* thread_dump may read the slot meanwhile */
+   struct thread_acct fin = { .nthreads = 1 };
+   fin.tid = __atomic_load_n(&acct->tid, __ATOMIC_ACQUIRE);
+   read_acct(&fin);
+
+   pthread_mutex_lock(&acct_lock);
+   unsigned int i;
+   for (i = 0; i < nexited; i++)
+      if (!strcmp(exited[i].name, acct->name))
+         break;
+   if (i == THREAD_MAX_NAMES)
+      i = THREAD_MAX_NAMES - 1;
+   else if (i == nexited) {
+      /* the last row takes the further names */
+      strcpy(exited[i].name, i < THREAD_MAX_NAMES - 1 ? acct->name : "other");
+      nexited++;
+   }
+   add_acct(&exited[i], &fin);
+   acct->name[0] = 0;
+   pthread_mutex_unlock(&acct_lock);
+}
+
+int read_acct(struct thread_acct *acct) {
+   char path[STR_SIZE], line[STR_SIZE];
+   FILE *fp;
+   pid_t tid = __atomic_load_n(&acct->tid, __ATOMIC_ACQUIRE);
+   if (!tid)
+      return -1;
+
+   /* on-cpu time */
+   snprintf(path, STR_SIZE, "/proc/self/task/%d/schedstat", tid);
+   if (!(fp = fopen(path, "r")))
+      return -1;
+   if (fscanf(fp, "%lu", (unsigned long *)&acct->cpu_ns) != 1)
+      acct->cpu_ns = 0;
+   fclose(fp);
+
+   /* user & system time, fields 14 & 15 after the command name */
+   snprintf(path, STR_SIZE, "/proc/self/task/%d/stat", tid);
+   if ((fp = fopen(path, "r"))) {
+      unsigned long utime = 0, stime = 0;
+      long hz = sysconf(_SC_CLK_TCK);
+      if (fgets(line, STR_SIZE, fp)) {
+         char *p = strrchr(line, ')');
+         if (p && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                         &utime, &stime) == 2 && hz > 0) {
+            acct->utime = utime * 1000 / hz;
+            acct->stime = stime * 1000 / hz;
+         }
+      }
+      fclose(fp);
+   }
+
+   /* context switches */
+   snprintf(path, STR_SIZE, "/proc/self/task/%d/status", tid);
+   if ((fp = fopen(path, "r"))) {
+      while (fgets(line, STR_SIZE, fp)) {
+         if (!strncmp(line, "voluntary_ctxt_switches:", 24))
+            acct->vcsw = strtoull(line + 24, NULL, 10);
+         else if (!strncmp(line, "nonvoluntary_ctxt_switches:", 27))
+            acct->ivcsw = strtoull(line + 27, NULL, 10);
+      }
+      fclose(fp);
+   }
+
+   /* migrations (CONFIG_SCHED_DEBUG) */
+   acct->migrations = -1;
+   snprintf(path, STR_SIZE, "/proc/self/task/%d/sched", tid);
+   if ((fp = fopen(path, "r"))) {
+      while (fgets(line, STR_SIZE, fp)) {
+         char *p = strchr(line, ':');
+         if (p && !strncmp(line, "se.nr_migrations", 16)) {
+            acct->migrations = strtoll(p + 1, NULL, 10);
+            break;
+         }
+      }
+      fclose(fp);
+   }
+   return 0;
+}
+
+void thread_dump(struct tun_state *state) {
+   char file_loc[STR_SIZE];
+   if (state->args->run_id)
+      snprintf(file_loc, STR_SIZE, "%s%s.%s.txt", state->out_dir, THREAD_FILE,
+               state->args->run_id);
+   else
+      snprintf(file_loc, STR_SIZE, "%s%s.txt", state->out_dir, THREAD_FILE);
+
+   FILE *fp = fopen(file_loc, "w");
+   if (!fp) {
+      perror(file_loc);
+      return;
+   }
+
+   pthread_mutex_lock(&acct_lock);
+   struct thread_acct total = { .name = "total" };
+   fprintf(fp, "# name tid|exited cpu(ms) user(ms) sys(ms) voluntary_cs involuntary_cs migrations\n");
+   for (unsigned int i = 0; i < nacct + nexited; i++) {
+      struct thread_acct *a = i < nacct ? &accts[i] : &exited[i - nacct];
+      if (!a->name[0])
+         continue;
+      /* running threads: tid, exited threads: xcount */
+      char id[16];
+      if (i < nacct) {
+         read_acct(a);
+         snprintf(id, sizeof(id), "%d", a->tid);
+      } else
+         snprintf(id, sizeof(id), "x%u", a->nthreads);
+      fprintf(fp, "%-15s %6s %10.3f %8lu %8lu %12lu %14lu %10ld\n", a->name, id, 
+              a->cpu_ns / 1e6, (unsigned long)a->utime, (unsigned long)a->stime, 
+              (unsigned long)a->vcsw, (unsigned long)a->ivcsw, (long)a->migrations);
+      add_acct(&total, a);
+   }
+   fprintf(fp, "%-15s %6s %10.3f %8lu %8lu %12lu %14lu %10ld\n", total.name, "-", 
+           total.cpu_ns / 1e6, (unsigned long)total.utime, (unsigned long)total.stime, 
+           (unsigned long)total.vcsw, (unsigned long)total.ivcsw, (long)total.migrations);
+   pthread_mutex_unlock(&acct_lock);
+   fclose(fp);
+}
+
@@ -7,18 +7,81 @@
 #ifndef UDPTUN_THREAD_H
 #define UDPTUN_THREAD_H
 
+#include <stdint.h>
 #include <pthread.h>
+#include <sys/types.h>
 
 /**
- * \fn void xthread_create(void *(*start_routine) (void *), void *args)
+ * \def THREAD_FILE
+ * \brief The per-thread accounting file name (in output directory).
+ */
+#define THREAD_FILE "threads"
+
+/**
+ * \def THREAD_MAX_ACCT
+ * \brief The maximal number of running accounted threads.
+ */
+#define THREAD_MAX_ACCT 1024
+
+/**
+ * \def THREAD_MAX_NAMES
+ * \brief The maximal number of thread names of exited threads, the
+ *        exited threads of further names are summed in one row.
+ */
+#define THREAD_MAX_NAMES 64
+
+/**
+ * \struct thread_acct
+ *	\brief The resource usage of a running thread, read from /proc at
+ *        program exit, or of the exited threads of a name, summed at
+ *        thread exit (the slot of an exited thread is reused).
+ */
+struct thread_acct {
+   char     name[16];           /*!< The thread name */
+   pid_t    tid;                /*!< The kernel thread id, 0 for exited threads */
+   uint32_t nthreads;           /*!< 1 for a running thread, the number of exited threads */
+   uint64_t cpu_ns;             /*!< On-cpu time (schedstat, ns) */
+   uint64_t utime;              /*!< User time (ms) */
+   uint64_t stime;              /*!< System time (ms) */
+   uint64_t vcsw;               /*!< Voluntary context switches */
+   uint64_t ivcsw;              /*!< Involuntary context switches */
+   int64_t  migrations;         /*!< CPU migrations, -1 if unavailable */
+};
+
+/**
+ * \fn void xthread_create(void *(*start_routine) (void *), void *args, 
+ *                         int garbage, const char *name)
  * \brief run a thread (pthread.h)
  *
  * \param start_routine A pointer to the thread function
  * \param args Arguments to be passed to the thread function
  * \param garbage 1 to add to garbage collector, 0 not to
+ * \param name The thread name (15 chars max), for ps/top and accounting
  * \return pthread_t
  */ 
-pthread_t xthread_create(void *(*start_routine) (void *), void *args, int garbage);
+pthread_t xthread_create(void *(*start_routine) (void *), void *args, 
+                         int garbage, const char *name);
+
+/**
+ * \fn void thread_register(const char *name)
+ * \brief Name and account the calling thread (for threads not
+ *        created with xthread_create, e.g. the main thread).
+ *
+ * \param name The thread name
+ */
+void thread_register(const char *name);
+
+struct tun_state;
+
+/**
+ * \fn void thread_dump(struct tun_state *state)
+ * \brief Write the accounting of all threads to
+ *        <out_dir>/threads[.<run_id>].txt, one row per running thread
+ *        and one per name of exited threads.
+ *
+ * \param state The program state
+ */
+void thread_dump(struct tun_state *state);
 
 /**
  * \fn void init_barrier(int nthreads)
@@ -0,0 +1,255 @@
+/**
+ * \file trace.c
+ * \brief Runtime binary event tracing.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "state.h"
+#include "thread.h"
+#include "sock.h"
+#include "debug.h"
+#include "udptun.h"
+
+/**
+ * \struct trace_ring
+ *	\brief A single-producer single-consumer ring of records.
+ */
+struct trace_ring {
+   uint32_t head __attribute__((aligned(64))); /*!< Written by the producer */
+   uint64_t lost;                              /*!< Dropped records */
+   uint32_t tail __attribute__((aligned(64))); /*!< Written by the collector */
+   uint64_t lost_seen;                         /*!< Dropped records reported */
+   uint16_t tid;                               /*!< The thread index */
+   char     name[8];                           /*!< The thread name (not terminated) */
+   struct trace_rec rec[TRACE_RING];           /*!< The records */
+};
+
+volatile sig_atomic_t trace_enabled;
+
+/**
+ * \var static struct trace_ring *rings[TRACE_MAX_THREADS]
+ * \brief The registered rings.
+ */
+static struct trace_ring *rings[TRACE_MAX_THREADS];
+
+/**
+ * \var static uint32_t nrings
+ * \brief The number of registered rings.
+ */
+static uint32_t nrings;
+
+/**
+ * \var static pthread_mutex_t rings_lock
+ * \brief Protects ring registration.
+ */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var static __thread struct trace_ring *local
+ * \brief The ring of the calling thread.
+ */
+static __thread struct trace_ring *local;
+
+/**
+ * \var static char file_loc[STR_SIZE]
+ * \brief The trace file location.
+ */
+static char file_loc[STR_SIZE];
+
+/**
+ * \fn static void trace_toggle(int sig)
+ * \brief SIGUSR1 handler.
+ */
+static void trace_toggle(int sig);
+
+/**
+ * \fn static struct trace_ring *new_ring()
+ * \brief Allocate and register the ring of the calling thread.
+ *
+ * \return The ring, NULL if TRACE_MAX_THREADS are registered
+ */
+static struct trace_ring *new_ring();
+
+/**
+ * \fn static void ring_push(struct trace_ring *r, uint16_t ev, uint32_t a0, uint64_t a1)
+ * \brief Append a record to a ring, or count it as lost if full.
+ */
+static void ring_push(struct trace_ring *r, uint16_t ev, uint32_t a0, uint64_t a1);
+
+/**
+ * \fn static void *trace_collector(void *arg)
+ * \brief Drain the rings to the trace file every TRACE_PERIOD ms.
+ */
+static void *trace_collector(void *arg);
+
+/**
+ * \fn static void trace_drain(FILE **fp)
+ * \brief Write the pending records of all rings, open the file
+ *        on first records.
+ */
+static void trace_drain(FILE **fp);
+
+/**
+ * \fn static void trace_cleanup(void *arg)
+ * \brief Drain the rings and close the trace file on exit.
+ */
+static void trace_cleanup(void *arg);
+
+static inline uint64_t now_ns() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void trace_toggle(int UNUSED(sig)) {
+   trace_enabled = !trace_enabled;
+}
+
+void trace_init(struct tun_state *state) {
+   if (state->args->run_id)
+      snprintf(file_loc, STR_SIZE, "%s%s.%s.bin", state->out_dir, TRACE_FILE,
+               state->args->run_id);
+   else
+      snprintf(file_loc, STR_SIZE, "%s%s.bin", state->out_dir, TRACE_FILE);
+
+   signal(SIGUSR1, trace_toggle);
+   trace_enabled = state->trace;
+   xthread_create(trace_collector, NULL, 1, "trace");
+   debug_print("tracing to %s (SIGUSR1 to toggle)\n", file_loc);
+}
+
+void trace_register(const char *name) {
+   if (!local && !new_ring())
+      return;
+   memset(local->name, 0, sizeof(local->name));
+   memcpy(local->name, name, strnlen(name, sizeof(local->name)));
+
+   /* names the thread in the trace, even if tracing is disabled */
+   uint64_t n = 0;
+   memcpy(&n, local->name, sizeof(n));
+   ring_push(local, TR_THREAD, local->tid, n);
+}
+
+void trace_event(uint16_t ev, uint32_t a0, uint64_t a1) {
+   if (!local && !new_ring())
+      return;
+   ring_push(local, ev, a0, a1);
+}
+
+struct trace_ring *new_ring() {
+   pthread_mutex_lock(&rings_lock);
+   if (nrings < TRACE_MAX_THREADS) {
+      local = calloc(1, sizeof(struct trace_ring));
+      if (local) {
+         local->tid = nrings;
+         rings[nrings] = local;
+         __atomic_store_n(&nrings, nrings + 1, __ATOMIC_RELEASE);
+      }
+   }
+   pthread_mutex_unlock(&rings_lock);
+   return local;
+}
+
+void ring_push(struct trace_ring *r, uint16_t ev, uint32_t a0, uint64_t a1) {
+   uint32_t head = r->head;
+   if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TRACE_RING) {
+      __atomic_store_n(&r->lost, r->lost + 1, __ATOMIC_RELAXED);
+      return;
+   }
+   struct trace_rec *rec = &r->rec[head & (TRACE_RING - 1)];
+   rec->time  = now_ns();
+   rec->event = ev;
+   rec->tid   = r->tid;
+   rec->a0    = a0;
+   rec->a1    = a1;
+   __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_drain(FILE **fp) {
+   uint32_t n = __atomic_load_n(&nrings, __ATOMIC_ACQUIRE);
+   for (uint32_t i = 0; i < n; i++) {
+      struct trace_ring *r = rings[i];
+      uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      uint32_t tail = r->tail;
+      uint64_t lost = __atomic_load_n(&r->lost, __ATOMIC_RELAXED);
+      if (head == tail && lost == r->lost_seen)
+         continue;
+
+      if (!*fp) {
+         *fp = fopen(file_loc, "w");
+         if (!*fp) {
+            perror(file_loc);
+            return;
+         }
+         struct timespec real;
+         clock_gettime(CLOCK_REALTIME, &real);
+         struct trace_header hdr = {
+            .magic     = TRACE_MAGIC,
+            .version   = TRACE_VERSION,
+            .rec_size  = sizeof(struct trace_rec),
+            .pid       = getpid(),
+            .real_time = real.tv_sec * 1000000000ULL + real.tv_nsec,
+            .mono_time = now_ns(),
+         };
+         fwrite(&hdr, sizeof(hdr), 1, *fp);
+      }
+
+      /* contiguous chunks of the ring */
+      while (tail != head) {
+         uint32_t off = tail & (TRACE_RING - 1);
+         uint32_t len = head - tail;
+         if (off + len > TRACE_RING)
+            len = TRACE_RING - off;
+         fwrite(&r->rec[off], sizeof(struct trace_rec), len, *fp);
+         tail += len;
+      }
+      __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+      if (lost != r->lost_seen) {
+         struct trace_rec rec = {
+            .time  = now_ns(),
+            .event = TR_LOST,
+            .tid   = r->tid,
+            .a0    = r->tid,
+            .a1    = lost - r->lost_seen,
+         };
+         fwrite(&rec, sizeof(rec), 1, *fp);
+         r->lost_seen = lost;
+      }
+   }
+   if (*fp)
+      fflush(*fp);
+}
+
+void trace_cleanup(void *arg) {
+   FILE **fp = arg;
+   trace_drain(fp);
+   if (*fp)
+      fclose(*fp);
+}
+
+void *trace_collector(void *UNUSED(arg)) {
+   FILE *fp = NULL;
+   struct timespec period = {
+      .tv_sec  = TRACE_PERIOD / 1000,
+      .tv_nsec = (TRACE_PERIOD % 1000) * 1000000L,
+   };
+   pthread_cleanup_push(trace_cleanup, &fp);
+   for (;;) {
+      nanosleep(&period, NULL);
+      trace_drain(&fp);
+   }
+   pthread_cleanup_pop(0);
+   return NULL;
+}
+
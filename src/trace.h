@@ -0,0 +1,155 @@
+/**
+ * \file trace.h
+ * \brief Runtime binary event tracing.
+ *
+ *    Each thread appends fixed-size records to its own ring,
+ *    a collector thread drains the rings to
+ *    <out_dir>/trace[.<run_id>].bin (decoded with copycat-trace).
+ *    A ring has a single producer and a single consumer and is
+ *    lock-free; events are dropped (and counted) when it is full.
+ *    Tracing is toggled at runtime with SIGUSR1 and costs a branch
+ *    when disabled.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_TRACE_H
+#define UDPTUN_TRACE_H
+
+#include <stdint.h>
+#include <signal.h>
+
+/**
+ * \def TRACE_MAGIC
+ * \brief The trace file magic number ("CCTR").
+ */
+#define TRACE_MAGIC 0x43435452
+
+/**
+ * \def TRACE_VERSION
+ * \brief The trace file layout version.
+ */
+#define TRACE_VERSION 1
+
+/**
+ * \def TRACE_FILE
+ * \brief The trace file name (in output directory).
+ */
+#define TRACE_FILE "trace"
+
+/**
+ * \def TRACE_RING
+ * \brief The number of records of a thread ring (power of 2).
+ */
+#define TRACE_RING (1 << 16)
+
+/**
+ * \def TRACE_MAX_THREADS
+ * \brief The maximal number of tracing threads.
+ */
+#define TRACE_MAX_THREADS 16
+
+/**
+ * \def TRACE_PERIOD
+ * \brief The collector period (ms).
+ */
+#define TRACE_PERIOD 50
+
+/**
+ * \def TRACE_NO_PEER
+ * \brief Peer id argument of packets without known peer.
+ */
+#define TRACE_NO_PEER UINT32_MAX
+
+/**
+ * \enum trace_event
+ * \brief Event ids, with the meaning of the record arguments.
+ */
+enum trace_event {
+   TR_THREAD = 0,    /*!< new thread, a0: tid, a1: name (8 chars) */
+   TR_LOST,          /*!< dropped events, a0: tid, a1: count */
+   TR_TUN_READ,      /*!< a0: length */
+   TR_TUN_WRITE,     /*!< a0: length, a1: peer id */
+   TR_UDP_SEND,      /*!< a0: length (negative on error), a1: peer id */
+   TR_UDP_RECV,      /*!< a0: length */
+   TR_LOOKUP_MISS,   /*!< a0: protocol, a1: sport << 16 | dport */
+   TR_NEW_PEER,      /*!< a0: source port */
+   TR_UNKNOWN_PEER,  /*!< a0: source port */
+   TR_SHORT_PKT,     /*!< a0: length */
+   TR_NON_IP,        /*!< a0: first byte */
+   TR_ICMP,          /*!< a0: type, a1: code */
+   TR_EVENTS         /*!< number of events */
+};
+
+/**
+ * \struct trace_rec
+ *	\brief A trace record.
+ */
+struct trace_rec {
+   uint64_t time;               /*!< CLOCK_MONOTONIC (ns) */
+   uint16_t event;              /*!< enum trace_event */
+   uint16_t tid;                /*!< The thread index */
+   uint32_t a0;                 /*!< First argument */
+   uint64_t a1;                 /*!< Second argument */
+};
+
+/**
+ * \struct trace_header
+ *	\brief The trace file header, followed by struct trace_rec.
+ */
+struct trace_header {
+   uint32_t magic;              /*!< TRACE_MAGIC */
+   uint32_t version;            /*!< TRACE_VERSION */
+   uint32_t rec_size;           /*!< sizeof(struct trace_rec) */
+   uint32_t pid;                /*!< The pid of copycat */
+   uint64_t real_time;          /*!< CLOCK_REALTIME at start (ns) */
+   uint64_t mono_time;          /*!< CLOCK_MONOTONIC at start (ns) */
+};
+
+/**
+ * \var extern volatile sig_atomic_t trace_enabled
+ * \brief Non-zero while tracing.
+ */
+extern volatile sig_atomic_t trace_enabled;
+
+/**
+ * \def TRACE(ev, a0, a1)
+ * \brief Record event ev with arguments a0, a1 if tracing is enabled.
+ */
+#define TRACE(ev, a0, a1) do { \
+      if (__builtin_expect(trace_enabled, 0)) \
+         trace_event((ev), (a0), (a1)); \
+   } while (0)
+
+struct tun_state;
+
+/**
+ * \fn void trace_init(struct tun_state *state)
+ * \brief Install the SIGUSR1 toggle and start the collector thread.
+ *
+ * \param state The program state
+ */
+void trace_init(struct tun_state *state);
+
+/**
+ * \fn void trace_register(const char *name)
+ * \brief Name the ring of the calling thread. Threads tracing
+ *        without registering get an anonymous ring.
+ *
+ * \param name The thread name
+ */
+void trace_register(const char *name);
+
+/**
+ * \fn void trace_event(uint16_t ev, uint32_t a0, uint64_t a1)
+ * \brief Append a record to the ring of the calling thread. See TRACE.
+ *
+ * \param ev The event id
+ * \param a0 First argument
+ * \param a1 Second argument
+ */
+void trace_event(uint16_t ev, uint32_t a0, uint64_t a1);
+
+#endif
+
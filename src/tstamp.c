@@ -0,0 +1,365 @@
+/**
+ * \file tstamp.c
+ * \brief Kernel timestamping of tunneled packets.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "sysconfig.h"
+#if defined(LINUX_OS)
+#  include <linux/net_tstamp.h>
+#  include <linux/errqueue.h>
+#endif
+
+#include "tstamp.h"
+#include "state.h"
+#include "sock.h"
+#include "debug.h"
+#include "udptun.h"
+
+/**
+ * \def TSTAMP_FLAGS
+ * \brief The SO_TIMESTAMPING flags of timestamped sockets.
+ */
+#define TSTAMP_FLAGS (SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | \
+                      SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | \
+                      SOF_TIMESTAMPING_OPT_TSONLY)
+
+/**
+ * \struct tstamp_slot
+ *	\brief A datagram waiting for its TX timestamp.
+ */
+struct tstamp_slot {
+   uint32_t id;                 /*!< The OPT_ID of the datagram */
+   int skipped;                 /*!< The send failed */
+   struct timespec tun;         /*!< The tun read time, 0 if none */
+};
+
+/**
+ * \struct tstamp_sock
+ *	\brief The TX timestamping state of a socket. A socket is only
+ *        used by one forwarding thread.
+ */
+struct tstamp_sock {
+   uint32_t next_id;                       /*!< The next OPT_ID */
+   struct tstamp_slot ring[TSTAMP_RING];   /*!< In-flight datagrams */
+};
+
+/**
+ * \struct tstamp_hists
+ *	\brief The histograms of a forwarding thread.
+ */
+struct tstamp_hists {
+   struct hist in;              /*!< tun read to kernel send */
+   struct hist out;             /*!< kernel receive to tun write */
+   struct tstamp_hists *next;   /*!< The next registered thread */
+};
+
+int tstamp_enabled;
+
+/**
+ * \var static struct tstamp_sock *socks[TSTAMP_MAX_FD]
+ * \brief The timestamped sockets, indexed by fd.
+ */
+static struct tstamp_sock *socks[TSTAMP_MAX_FD];
+
+/**
+ * \var static struct tstamp_hists *hists
+ * \brief The list of per-thread histograms.
+ */
+static struct tstamp_hists *hists;
+
+/**
+ * \var static pthread_mutex_t hists_lock
+ * \brief Protects the hists list (thread registration only).
+ */
+static pthread_mutex_t hists_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var static __thread struct tstamp_hists *local
+ * \brief The histograms of the calling thread.
+ */
+static __thread struct tstamp_hists *local;
+
+/**
+ * \var static __thread struct timespec tun_ts
+ * \brief The time of the last tun read.
+ */
+static __thread struct timespec tun_ts;
+
+/**
+ * \var static __thread struct timespec rx_ts
+ * \brief The RX timestamp of the last received datagram.
+ */
+static __thread struct timespec rx_ts;
+
+/**
+ * \fn static struct tstamp_hists *get_hists()
+ * \brief Get (and register on first use) the histograms of the
+ *        calling thread.
+ *
+ * \return The histograms
+ */
+static struct tstamp_hists *get_hists();
+
+/**
+ * \fn static void add_latency(struct hist *h, const struct timespec *from,
+ *                             const struct timespec *to)
+ * \brief Record to - from in h, if positive.
+ */
+static void add_latency(struct hist *h, const struct timespec *from,
+                        const struct timespec *to);
+
+/**
+ * \fn static void print_hist(FILE *fp, const char *name, const struct hist *h)
+ * \brief Print the summary and the non-empty buckets of a histogram.
+ */
+static void print_hist(FILE *fp, const char *name, const struct hist *h);
+
+/**
+ * \fn static unsigned int hist_index(uint64_t v)
+ * \brief The bucket of value v.
+ */
+static unsigned int hist_index(uint64_t v);
+
+/**
+ * \fn static uint64_t hist_value(unsigned int i)
+ * \brief The highest value of bucket i.
+ */
+static uint64_t hist_value(unsigned int i);
+
+void tstamp_init(struct tun_state *state) {
+#if defined(LINUX_OS) && defined(SO_TIMESTAMPING)
+   tstamp_enabled = state->timestamping;
+#else
+   if (state->timestamping)
+      debug_print("SO_TIMESTAMPING not supported\n");
+#endif
+}
+
+void tstamp_sock(int fd) {
+#if defined(LINUX_OS) && defined(SO_TIMESTAMPING)
+   if (fd >= TSTAMP_MAX_FD) {
+      debug_print("fd %d not timestamped\n", fd);
+      return;
+   }
+   int flags = TSTAMP_FLAGS;
+   if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+      die("SO_TIMESTAMPING");
+   if (!socks[fd])
+      socks[fd] = calloc(1, sizeof(struct tstamp_sock));
+   socks[fd]->next_id = 0;
+   debug_print("timestamping enabled on fd %d\n", fd);
+#endif
+}
+
+int tstamp_is_sock(int fd) {
+   return fd < TSTAMP_MAX_FD && socks[fd];
+}
+
+void tstamp_tun_read() {
+   clock_gettime(CLOCK_REALTIME, &tun_ts);
+}
+
+void tstamp_tun_write() {
+   if (!rx_ts.tv_sec)
+      return;
+   struct timespec now;
+   clock_gettime(CLOCK_REALTIME, &now);
+   add_latency(&get_hists()->out, &rx_ts, &now);
+   rx_ts.tv_sec = 0;
+}
+
+void tstamp_sent(int fd, int ret) {
+#if defined(LINUX_OS) && defined(SO_TIMESTAMPING)
+   if (!tstamp_is_sock(fd))
+      return;
+   struct tstamp_sock *s = socks[fd];
+
+   /* every datagram takes an id, tun_ts is only set for tunneled ones.
+      A failed send skips its id: it never completes, and if the kernel
+      did not consume the id, tstamp_completed realigns the ring. */
+   struct tstamp_slot *slot = &s->ring[s->next_id & (TSTAMP_RING-1)];
+   slot->id      = s->next_id++;
+   slot->skipped = ret < 0;
+   slot->tun     = ret < 0 ? (struct timespec){0, 0} : tun_ts;
+   tun_ts.tv_sec = 0;
+#endif
+}
+
+void tstamp_recvd(struct msghdr *msg) {
+#if defined(LINUX_OS) && defined(SO_TIMESTAMPING)
+   struct cmsghdr *cmsg;
+   for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+         /* ts[0] is the software timestamp */
+         rx_ts = ((struct scm_timestamping *)CMSG_DATA(cmsg))->ts[0];
+         return;
+      }
+   }
+#endif
+}
+
+void tstamp_completed(int fd, uint32_t id, const struct timespec *ts) {
+   if (!tstamp_is_sock(fd))
+      return;
+   struct tstamp_sock *s = socks[fd];
+   struct tstamp_slot *slot = &s->ring[id & (TSTAMP_RING-1)];
+
+   /* a completion for a skipped id: the failed send did not consume
+      it, the datagrams registered after it are one id lower */
+   while (slot->id == id && slot->skipped) {
+      for (uint32_t j = id; j + 1 != s->next_id; j++) {
+         s->ring[j & (TSTAMP_RING-1)] = s->ring[(j + 1) & (TSTAMP_RING-1)];
+         s->ring[j & (TSTAMP_RING-1)].id--;
+      }
+      s->next_id--;
+      memset(&s->ring[s->next_id & (TSTAMP_RING-1)], 0, sizeof(struct tstamp_slot));
+   }
+   /* overwritten (too many in flight) or not tunneled */
+   if (slot->id != id || !slot->tun.tv_sec)
+      return;
+   add_latency(&get_hists()->in, &slot->tun, ts);
+   slot->tun.tv_sec = 0;
+}
+
+struct tstamp_hists *get_hists() {
+   if (local)
+      return local;
+   local = xmalloc(sizeof(struct tstamp_hists));
+   memset(local, 0, sizeof(struct tstamp_hists));
+   local->in.min = local->out.min = UINT64_MAX;
+   pthread_mutex_lock(&hists_lock);
+   local->next = hists;
+   hists = local;
+   pthread_mutex_unlock(&hists_lock);
+   return local;
+}
+
+void add_latency(struct hist *h, const struct timespec *from,
+                 const struct timespec *to) {
+   int64_t ns = (int64_t)(to->tv_sec - from->tv_sec) * 1000000000
+                + (to->tv_nsec - from->tv_nsec);
+   /* clock stepped */
+   if (ns < 0)
+      return;
+   hist_add(h, ns);
+}
+
+unsigned int hist_index(uint64_t v) {
+   if (v >> HIST_MAX_BITS)
+      v = (1ULL << HIST_MAX_BITS) - 1;
+   if (v < (1 << HIST_SUB_BITS))
+      return v;
+   unsigned int e = 63 - __builtin_clzll(v);
+   return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+          + (v >> (e - HIST_SUB_BITS)) - (1 << HIST_SUB_BITS);
+}
+
+uint64_t hist_value(unsigned int i) {
+   if (i < (1 << HIST_SUB_BITS))
+      return i;
+   unsigned int e = (i >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+   uint64_t m = (i & ((1 << HIST_SUB_BITS) - 1)) + (1 << HIST_SUB_BITS);
+   return ((m + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_add(struct hist *h, uint64_t v) {
+   h->bucket[hist_index(v)]++;
+   h->count++;
+   h->sum += v;
+   if (v < h->min)
+      h->min = v;
+   if (v > h->max)
+      h->max = v;
+}
+
+uint64_t hist_percentile(const struct hist *h, double p) {
+   if (!h->count)
+      return 0;
+   uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5), cum = 0;
+   if (rank < 1)
+      rank = 1;
+   for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+      cum += h->bucket[i];
+      if (cum >= rank) {
+         uint64_t v = hist_value(i);
+         return v < h->max ? v : h->max;
+      }
+   }
+   return h->max;
+}
+
+void print_hist(FILE *fp, const char *name, const struct hist *h) {
+   fprintf(fp, "# %s: count %lu", name, (unsigned long)h->count);
+   if (!h->count) {
+      fprintf(fp, "\n\n");
+      return;
+   }
+   fprintf(fp, " min %.3f mean %.3f p50 %.3f p90 %.3f p99 %.3f p99.9 %.3f "
+               "p99.99 %.3f max %.3f (us)\n",
+           h->min / 1e3, (double)h->sum / h->count / 1e3,
+           hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+           hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3,
+           hist_percentile(h, 99.99) / 1e3, h->max / 1e3);
+   /* HdrHistogram-like percentile distribution */
+   fprintf(fp, "%12s %12s %10s\n", "value(us)", "count", "percentile");
+   uint64_t cum = 0;
+   for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+      if (!h->bucket[i])
+         continue;
+      cum += h->bucket[i];
+      fprintf(fp, "%12.3f %12lu %10.6f\n", hist_value(i) / 1e3,
+              (unsigned long)h->bucket[i], (double)cum / h->count);
+   }
+   fprintf(fp, "\n");
+}
+
+void tstamp_dump(struct tun_state *state) {
+   if (!tstamp_enabled || !hists)
+      return;
+
+   struct hist *in = calloc(1, sizeof(struct hist)),
+               *out = calloc(1, sizeof(struct hist));
+   in->min = out->min = UINT64_MAX;
+   pthread_mutex_lock(&hists_lock);
+   for (struct tstamp_hists *t = hists; t; t = t->next) {
+      const struct hist *src[2] = {&t->in, &t->out};
+      struct hist *dst[2] = {in, out};
+      for (int d = 0; d < 2; d++) {
+         for (unsigned int i = 0; i < HIST_BUCKETS; i++)
+            dst[d]->bucket[i] += src[d]->bucket[i];
+         dst[d]->count += src[d]->count;
+         dst[d]->sum   += src[d]->sum;
+         if (src[d]->min < dst[d]->min)
+            dst[d]->min = src[d]->min;
+         if (src[d]->max > dst[d]->max)
+            dst[d]->max = src[d]->max;
+      }
+   }
+   pthread_mutex_unlock(&hists_lock);
+
+   char file_loc[STR_SIZE];
+   if (state->args->run_id)
+      snprintf(file_loc, STR_SIZE, "%s%s.%s.txt", state->out_dir, TSTAMP_FILE,
+               state->args->run_id);
+   else
+      snprintf(file_loc, STR_SIZE, "%s%s.txt", state->out_dir, TSTAMP_FILE);
+   FILE *fp = fopen(file_loc, "w");
+   if (fp) {
+      print_hist(fp, "tun read to kernel send", in);
+      print_hist(fp, "kernel receive to tun write", out);
+      fclose(fp);
+      debug_print("latency histograms written to %s\n", file_loc);
+   } else
+      perror(file_loc);
+   free(in); free(out);
+}
+
@@ -0,0 +1,195 @@
+/**
+ * \file tstamp.h
+ * \brief Kernel timestamping of tunneled packets.
+ *
+ *    With SO_TIMESTAMPING, the kernel reports the time a datagram
+ *    was received from (RX) or handed to (TX) the network device.
+ *    Two latencies are accumulated in log-linear histograms:
+ *    kernel receive to tun write ("out") and tun read to kernel
+ *    send ("in"). TX timestamps come back on the error queue, tagged
+ *    with a per-socket counter (OPT_ID) matched against a ring of
+ *    tun read times.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_TSTAMP_H
+#define UDPTUN_TSTAMP_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * \def TSTAMP_FILE
+ * \brief The histograms file name (in output directory).
+ */
+#define TSTAMP_FILE "latency"
+
+/**
+ * \def TSTAMP_MAX_FD
+ * \brief The maximal fd value of a timestamped socket.
+ */
+#define TSTAMP_MAX_FD 1024
+
+/**
+ * \def TSTAMP_RING
+ * \brief The number of TX timestamps in flight per socket (power of 2).
+ */
+#define TSTAMP_RING 1024
+
+/**
+ * \def HIST_SUB_BITS
+ * \brief log2 of the number of sub-buckets per power of two.
+ *        The relative error of a recorded value is < 2^-HIST_SUB_BITS.
+ */
+#define HIST_SUB_BITS 6
+
+/**
+ * \def HIST_MAX_BITS
+ * \brief Values (ns) are clamped to 2^HIST_MAX_BITS - 1.
+ */
+#define HIST_MAX_BITS 40
+
+/**
+ * \def HIST_BUCKETS
+ * \brief The number of buckets of a histogram.
+ */
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/**
+ * \struct hist
+ *	\brief A log-linear (HDR-style) histogram of nanosecond values.
+ */
+struct hist {
+   uint64_t count;               /*!< The number of values */
+   uint64_t sum;                 /*!< The sum of values */
+   uint64_t min;                 /*!< The minimal value */
+   uint64_t max;                 /*!< The maximal value */
+   uint64_t bucket[HIST_BUCKETS];/*!< The buckets */
+};
+
+/**
+ * \var extern int tstamp_enabled
+ * \brief Non-zero if the timestamping cfg parameter is set.
+ */
+extern int tstamp_enabled;
+
+/**
+ * \def TSTAMP_TUN_READ()
+ * \brief Record the time a packet was read from tun.
+ */
+#define TSTAMP_TUN_READ() do { \
+      if (tstamp_enabled) tstamp_tun_read(); \
+   } while (0)
+
+/**
+ * \def TSTAMP_TUN_WRITE()
+ * \brief Account the latency of the last received datagram,
+ *        now written to tun.
+ */
+#define TSTAMP_TUN_WRITE() do { \
+      if (tstamp_enabled) tstamp_tun_write(); \
+   } while (0)
+
+struct tun_state;
+struct msghdr;
+
+/**
+ * \fn void tstamp_init(struct tun_state *state)
+ * \brief Enable timestamping of udp sockets created from now on,
+ *        if set in the configuration.
+ *
+ * \param state The program state
+ */
+void tstamp_init(struct tun_state *state);
+
+/**
+ * \fn void tstamp_sock(int fd)
+ * \brief Enable software RX/TX timestamps with OPT_ID on a UDP socket.
+ *
+ * \param fd The socket
+ */
+void tstamp_sock(int fd);
+
+/**
+ * \fn int tstamp_is_sock(int fd)
+ * \brief Check whether fd was passed to tstamp_sock().
+ *
+ * \param fd The socket
+ * \return 1 if fd is timestamped, 0 otherwise
+ */
+int tstamp_is_sock(int fd);
+
+/**
+ * \fn void tstamp_tun_read()
+ * \brief Record the time a packet was read from tun. See TSTAMP_TUN_READ.
+ */
+void tstamp_tun_read();
+
+/**
+ * \fn void tstamp_tun_write()
+ * \brief Account the latency of the last received datagram.
+ *        See TSTAMP_TUN_WRITE.
+ */
+void tstamp_tun_write();
+
+/**
+ * \fn void tstamp_sent(int fd, int ret)
+ * \brief Register a datagram handed to a timestamped socket, paired
+ *        with the last tun read time. A failed send skips its id.
+ *
+ * \param fd The socket
+ * \param ret The return value of sendto
+ */
+void tstamp_sent(int fd, int ret);
+
+/**
+ * \fn void tstamp_recvd(struct msghdr *msg)
+ * \brief Extract the RX timestamp of a received datagram.
+ *
+ * \param msg The received message with its control data
+ */
+void tstamp_recvd(struct msghdr *msg);
+
+/**
+ * \fn void tstamp_completed(int fd, uint32_t id, const struct timespec *ts)
+ * \brief Account the latency of a datagram whose TX timestamp was
+ *        read from the error queue.
+ *
+ * \param fd The socket
+ * \param id The OPT_ID of the datagram
+ * \param ts The TX timestamp
+ */
+void tstamp_completed(int fd, uint32_t id, const struct timespec *ts);
+
+/**
+ * \fn void hist_add(struct hist *h, uint64_t v)
+ * \brief Record a value in a histogram.
+ *
+ * \param h The histogram
+ * \param v The value (ns)
+ */
+void hist_add(struct hist *h, uint64_t v);
+
+/**
+ * \fn uint64_t hist_percentile(const struct hist *h, double p)
+ * \brief Compute a percentile of a histogram.
+ *
+ * \param h The histogram
+ * \param p The percentile in [0,100]
+ * \return The value at percentile p (ns)
+ */
+uint64_t hist_percentile(const struct hist *h, double p);
+
+/**
+ * \fn void tstamp_dump(struct tun_state *state)
+ * \brief Merge the per-thread histograms and write them to
+ *        <out_dir>/latency[.<run_id>].txt
+ *
+ * \param state The program state
+ */
+void tstamp_dump(struct tun_state *state);
+
+#endif
+
@@ -43,6 +43,7 @@
 #endif
 
 #include "sock.h"
+#include "netlink.h"
 #include "debug.h"
 
 /**
@@ -83,7 +84,7 @@ struct in6_ifreq {
  */ 
 static int tun_alloc(const char *ip4, const char *prefix4, 
                        const char *ip6, const char *prefix6, 
-                       char *dev, int common);
+                       char *dev, int mtu, int txqlen, int common);
 
 /**
  * \fn int tun_alloc6(int iftype, char *if_name)
@@ -95,7 +96,7 @@ static int tun_alloc(const char *ip4, const char *prefix4,
  */ 
 static int tun_alloc6(const char *ip4, const char *prefix4, 
                        const char *ip6, const char *prefix6, 
-                       char *dev, int common);
+                       char *dev, int mtu, int txqlen, int common);
 
 /**
  * \fn int tun_alloc46(int iftype, char *if_name)
@@ -107,7 +108,7 @@ static int tun_alloc6(const char *ip4, const char *prefix4,
  */ 
 static int tun_alloc46(const char *ip4, const char *prefix4, 
                        const char *ip6, const char *prefix6, 
-                       char *dev, int common);
+                       char *dev, int mtu, int txqlen, int common);
 
 /**
  * \fn int tun_alloc_pl(int iftype, char *if_name)
@@ -120,11 +121,21 @@ static int tun_alloc46(const char *ip4, const char *prefix4,
  */ 
 static int tun_alloc_pl(int iftype, char *if_name);
 
+#if defined(BSD_OS)
+/**
+ * \fn static int tun_set_mtu(const char *dev, int mtu)
+ * \brief Set the MTU of an interface.
+ *
+ * \return 0 on success, -1 on error (errno is filled)
+ */
+static int tun_set_mtu(const char *dev, int mtu);
+#endif
+
 static char *create_tun(const char *ip4, const char *prefix4, 
                        const char *ip6, const char *prefix6, 
-                       char *dev, int *tun_fds, 
+                       char *dev, int mtu, int txqlen, int *tun_fds, 
                        int (*func_alloc)(const char*,const char*, 
-                       const char*,const char*, char*,int));
+                       const char*,const char*, char*,int,int,int));
 
 /* Reads vif FD from "fd", writes interface name to vif_name, and returns vif FD.
  * vif_name should be IFNAMSIZ chars long. */
@@ -162,32 +173,35 @@ int receive_vif_fd(int fd, char *vif_name) {
 }
 
 char *create_tun4(const char *ip4, const char *prefix4, 
-                  char *dev, int *tun_fds) {
-   return create_tun(ip4, prefix4, NULL, NULL, dev, tun_fds, &tun_alloc);
+                  char *dev, int mtu, int txqlen, int *tun_fds) {
+   return create_tun(ip4, prefix4, NULL, NULL, dev, mtu, txqlen, 
+                     tun_fds, &tun_alloc);
 }
 
 char *create_tun46(const char *ip4, const char *prefix4, 
                    const char *ip6, const char *prefix6, 
-                   char *dev, int *tun_fds) {
-   return create_tun(ip4, prefix4, ip6, prefix6, dev, tun_fds, &tun_alloc46);
+                   char *dev, int mtu, int txqlen, int *tun_fds) {
+   return create_tun(ip4, prefix4, ip6, prefix6, dev, mtu, txqlen, 
+                     tun_fds, &tun_alloc46);
 }
 
 char *create_tun6(const char *ip6, const char *prefix6, 
-                  char *dev, int *tun_fds) {
-   return create_tun(NULL, NULL, ip6, prefix6, dev, tun_fds, &tun_alloc6);
+                  char *dev, int mtu, int txqlen, int *tun_fds) {
+   return create_tun(NULL, NULL, ip6, prefix6, dev, mtu, txqlen, 
+                     tun_fds, &tun_alloc6);
 }
 
 char *create_tun(const char *ip4, const char *prefix4, 
                  const char *ip6, const char *prefix6, 
-                 char *dev, int *tun_fds, 
+                 char *dev, int mtu, int txqlen, int *tun_fds, 
                  int (*func_alloc)(const char*,const char*, 
                                    const char*,const char*, 
-                                   char*,int)) {
+                                   char*,int,int,int)) {
    int   fd; 
    char *if_name = xmalloc(IFNAMSIZ);
 
    if (dev) {
-      if ((fd = (*func_alloc)(ip4, prefix4, ip6, prefix6, dev, 0)) >= 0) {
+      if ((fd = (*func_alloc)(ip4, prefix4, ip6, prefix6, dev, mtu, txqlen, 0)) >= 0) {
          strcpy(if_name, dev);
          goto succ;
       } else goto err;
@@ -195,7 +209,8 @@ char *create_tun(const char *ip4, const char *prefix4,
 
    for (int i=0; i<99; i++) {
       sprintf(if_name, "tun%d", i);
-      if ((fd = (*func_alloc)(ip4, prefix4, ip6, prefix6, if_name, 1)) >= 0) {
+      if ((fd = (*func_alloc)(ip4, prefix4, ip6, prefix6, if_name, 
+                                 mtu, txqlen, 1)) >= 0) {
          break;
       } else goto err;
    }
@@ -211,8 +226,24 @@ err:
 
 #if defined(BSD_OS)
 
+int tun_set_mtu(const char *dev, int mtu) {
+   struct ifreq ifr;
+   int s, ret;
+   if ((s = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+      return -1;
+   memset(&ifr, 0, sizeof(ifr));
+   strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+   ifr.ifr_mtu = mtu;
+   ret = ioctl(s, SIOCSIFMTU, &ifr);
+   close(s);
+   if (!ret)
+      debug_print("%s mtu %d\n", dev, mtu);
+   return ret;
+}
+
 int tun_alloc(const char *ip4, const char *prefix4, 
-              const char *ip6, const char *prefix6, char *dev, int common) {
+              const char *ip6, const char *prefix6, char *dev, 
+              int mtu, int txqlen, int common) {
    struct ifreq ifr; 
    int fd;
    
@@ -265,23 +296,28 @@ int tun_alloc(const char *ip4, const char *prefix4,
    sprintf(net_prefix_cmd, "ip addr add %s/%s dev %s", ip4, prefix4, dev);
    if (system(net_prefix_cmd) < 0) 
       die("tun prefix");
+   if (mtu && tun_set_mtu(dev, mtu) < 0)
+      die("tun mtu");
 
    close(s);
    return fd;
 }       
 
 int tun_alloc6(const char *ip4, const char *prefix4, 
-                const char *ip6, const char *prefix6, char *dev, int common) {
+                const char *ip6, const char *prefix6, char *dev, 
+              int mtu, int txqlen, int common) {
    return 0;
 }
 int tun_alloc46(const char *ip4, const char *prefix4, 
-                const char *ip6, const char *prefix6, char *dev, int common) {
+                const char *ip6, const char *prefix6, char *dev, 
+              int mtu, int txqlen, int common) {
    return 0;
 }
 #elif defined(LINUX_OS)
 
 int tun_alloc(const char *ip4, const char *prefix4, 
-              const char *ip6, const char *prefix6, char *dev, int common) {
+              const char *ip6, const char *prefix6, char *dev, 
+              int mtu, int txqlen, int common) {
    struct ifreq ifr; 
    int fd, err;
    
@@ -306,191 +342,23 @@ int tun_alloc(const char *ip4, const char *prefix4,
       die("ioctl\n");
    strcpy(dev, ifr.ifr_name);
 
-   /* Create socket */
-   int s;
-   if ( (s = socket(AF_INET, SOCK_DGRAM, 0)) < 0) 
-      die("socket");
-
-   /* Get interface flags */
-   if (ioctl(s, SIOCGIFFLAGS, &ifr) < 0) 
-      die("cannot get interface flags");
-
-   /* Turn on interface */
-   ifr.ifr_flags |= IFF_UP;
-   if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0) 
-      die("ioctl ifup");
+   /* MTU, txqueuelen, addresses and up in one rtnetlink transaction */
+   if (nl_link_setup(dev, ip4, prefix4, ip6, prefix6, mtu, txqlen) < 0) 
+      die("tun setup");
 
-   /* Set interface address */
-   struct sockaddr_in  tun_addr;
-   memset((char *) &tun_addr, 0, sizeof(tun_addr));
-   tun_addr.sin_family = AF_INET;
-   tun_addr.sin_addr.s_addr = htonl(inet_network(ip4));
-   memcpy(&ifr.ifr_addr, &tun_addr, sizeof(struct sockaddr));
-
-   if (ioctl(s, SIOCSIFADDR, &ifr) < 0) 
-      die("cannot set IP address. ");
-
-   char net_prefix_cmd[128];
-   sprintf(net_prefix_cmd, "ip addr add %s/%s dev %s", ip4, prefix4, dev);
-   if (system(net_prefix_cmd) < 0) 
-      die("tun prefix");
-
-   close(s);
    return fd;
 }                   
 
 int tun_alloc46(const char *ip4, const char *prefix4, 
-                const char *ip6, const char *prefix6, char *dev, int common) {
-   struct ifreq ifr; //TODO:compact
-   struct in6_ifreq ifr6;
-   int fd, err;
-   
-   if (common) {
-      if((fd = open("/dev/net/tun", O_RDWR)) < 0 ) 
-         die("err opening tun fd\n");
-   } else {
-      char tunname[14];
-      sprintf(tunname, "/dev/%s", dev);
-      if((fd = open(tunname, O_RDWR)) < 0 ) 
-         //      mknod /dev/tun1 c 10 200
-         die("err opening tun fd\n");
-      return fd;
-   }
-
-   memset(&ifr, 0, sizeof(ifr));
-   ifr.ifr_flags = IFF_TUN | IFF_NO_PI; 
-   if( *dev )
-      strncpy(ifr.ifr_name, dev, IFNAMSIZ);
-
-   if( (err = ioctl(fd, TUNSETIFF, (void *) &ifr)) < 0 ) 
-      die("ioctl\n");
-   strcpy(dev, ifr.ifr_name);
-
-   /* Create  sockets */
-   int s4, s6;
-   if ( (s4 = socket(AF_INET, SOCK_DGRAM, 0)) < 0) 
-      die("socket");
-   if ( (s6 = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) 
-      die("socket");
-
-   /* Get interface flags */
-   if (ioctl(s4, SIOCGIFFLAGS, &ifr) < 0) 
-      die("cannot get interface flags");
-
-   /* Turn on interface */
-   ifr.ifr_flags |= IFF_UP;
-   if (ioctl(s4, SIOCSIFFLAGS, &ifr) < 0) 
-      die("ioctl ifup");
-
-   /* Set interface address */
-   struct sockaddr_in  tun_addr4;
-   memset((char *) &tun_addr4, 0, sizeof(tun_addr4));
-   tun_addr4.sin_family = AF_INET;
-   tun_addr4.sin_addr.s_addr = htonl(inet_network(ip4));
-   memcpy(&ifr.ifr_addr, &tun_addr4, sizeof(struct sockaddr));
-
-   if (ioctl(s4, SIOCSIFADDR, &ifr) < 0) 
-      die("cannot set IP address. ");
-
-   //if (ioctl(s6, SIOCGIFFLAGS, &ifr) < 0) 
-   //   die("cannot get interface flags");
-
-   char net_prefix_cmd[128];
-   sprintf(net_prefix_cmd, "ip addr add %s/%s dev %s", ip4, prefix4, dev);
-   if (system(net_prefix_cmd) < 0) 
-      die("tun prefix");
-
-   /* Set interface address */
-   struct sockaddr_in6  tun_addr6;
-   memset(&tun_addr6, 0, sizeof(tun_addr6));
-   tun_addr6.sin6_family = AF_INET6;
-   if(inet_pton(AF_INET6, ip6, (void *)&tun_addr6.sin6_addr) <= 0) 
-        die("Bad address\n");
-   if(inet_pton(AF_INET6, ip6, (void *)&ifr6.ifr6_addr) <= 0) 
-        die("Bad address\n");
-
-    if (ioctl(s6, SIOGIFINDEX, &ifr) < 0) 
-        die("SIOGIFINDEX");
-    ifr6.ifr6_ifindex   = ifr.ifr_ifindex;
-    ifr6.ifr6_prefixlen = strtol(prefix6, NULL, 10);
-    if (ioctl(s6, SIOCSIFADDR, &ifr6) < 0) 
-        die("SIOCSIFADDR");
-
-    /*ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
-    if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0)
-      die("SIOCSIFFLAGS");*/
-   close(s4);close(s6);
-   return fd;
+                const char *ip6, const char *prefix6, char *dev, 
+                int mtu, int txqlen, int common) {
+   return tun_alloc(ip4, prefix4, ip6, prefix6, dev, mtu, txqlen, common);
 }              
 
 int tun_alloc6(const char *ip4, const char *prefix4, 
-                const char *ip6, const char *prefix6, char *dev, int common) {
-   struct ifreq ifr;
-   struct in6_ifreq ifr6;
-   int fd, err;
-
-   if (common) {
-      if((fd = open("/dev/net/tun", O_RDWR)) < 0 ) 
-         die("err opening tun fd\n");
-   } else {
-      char tunname[14];
-      sprintf(tunname, "/dev/%s", dev);
-      if((fd = open(tunname, O_RDWR)) < 0 ) 
-         //      mknod /dev/tun1 c 10 200
-         die("err opening tun fd\n");
-      return fd;
-   }
-
-   memset(&ifr, 0, sizeof(ifr));
-   ifr.ifr_flags = IFF_TUN | IFF_NO_PI; 
-   if( *dev )
-      strncpy(ifr.ifr_name, dev, IFNAMSIZ);
-   if( (err = ioctl(fd, TUNSETIFF, (void *) &ifr)) < 0 ) 
-      die("ioctl\n");
-   strcpy(dev, ifr.ifr_name);
-
-   /* Create socket */
-   int s;
-   if ( (s = socket(AF_INET6, SOCK_DGRAM, 0)) < 0) 
-      die("socket");
-   /* Get interface flags */
-   if (ioctl(s, SIOCGIFFLAGS, &ifr) < 0) 
-      die("cannot get interface flags");
-
-   // Turn on interface
-   //ifr.ifr_flags |= IFF_UP;
-   //if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0) {
-   //   die("ioctl ifup");
-   //}
-
-   // Set interface address
-   struct sockaddr_in6  tun_addr;
-   memset(&tun_addr, 0, sizeof(tun_addr));
-   tun_addr.sin6_family = AF_INET6;
-   if(inet_pton(AF_INET6, ip6, (void *)&tun_addr.sin6_addr) <= 0) 
-        die("Bad address\n");
-   memcpy((char *) &ifr6.ifr6_addr, (char *) &tun_addr.sin6_addr,
-               sizeof(struct in6_addr));
-
-    if (ioctl(s, SIOGIFINDEX, &ifr) < 0) 
-        die("SIOGIFINDEX");
-    ifr6.ifr6_ifindex   = ifr.ifr_ifindex;
-    ifr6.ifr6_prefixlen = strtol(prefix6, NULL, 10);
-    if (ioctl(s, SIOCSIFADDR, &ifr6) < 0) 
-        die("SIOCSIFADDR");
-
-    ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
-
-    if (ioctl(s, SIOCSIFFLAGS, &ifr) < 0)
-      die("SIOCSIFFLAGS");
-
-   /*char net_prefix_cmd[148]; 
-   sprintf(net_prefix_cmd, "sudo ip -6 addr add %s/64 dev %s", ip, dev);
-   if (system(net_prefix_cmd) < 0) 
-      die("tun prefix");
-    */
-   close(s);
-   return fd;
+                const char *ip6, const char *prefix6, char *dev, 
+                int mtu, int txqlen, int common) {
+   return tun_alloc(NULL, NULL, ip6, prefix6, dev, mtu, txqlen, common);
 }
 
 int tun_alloc_pl(int iftype, char *if_name) {
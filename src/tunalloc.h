@@ -17,15 +17,19 @@
  * \param ip The address of the interface.
  * \param prefix The prefix of the virtual network.
  * \param dev The wished device name, or NULL
+ * \param mtu The interface MTU, or 0 for the default.
+ * \param txqlen The interface transmit queue length, or 0 for the default.
  * \deprecated nat NAT the tun interface or not.
  * \param tun_fds A pointer to an int to be set to the tun interface fd.
  * \return A pointer (malloc) to the interface name.
  */ 
-char *create_tun4(const char *ip4, const char *prefix4, char *dev, int *tun_fds);
+char *create_tun4(const char *ip4, const char *prefix4, char *dev, 
+                  int mtu, int txqlen, int *tun_fds);
 char *create_tun46(const char *ip4, const char *prefix4, 
                    const char *ip6, const char *prefix6, 
-                   char *dev, int *tun_fds);
-char *create_tun6(const char *ip6, const char *prefix6, char *dev, int *tun_fds);
+                   char *dev, int mtu, int txqlen, int *tun_fds);
+char *create_tun6(const char *ip6, const char *prefix6, char *dev, 
+                  int mtu, int txqlen, int *tun_fds);
 
 #  if defined(LINUX_OS)
 /**
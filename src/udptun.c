@@ -17,18 +17,23 @@
 #include <signal.h>
 
 #include "udptun.h"
+#include "state.h"
 
 /* argp variables and structs */
 
 const char *program_version = "copycat 0.1";
-const char*   optstring     = ":abcd:fhi:nNo:pP:qr:sS:tUvV62";
+const char*   optstring     = ":abcC:d:fhi:nNo:O:pP:qr:sS:tUvV62";
 const char* arg_help = "Usage: copycat [OPTION...] -s -o copycat.cfg -d dst.txt\n"
 "  or:  copycat [OPTION...] -c -o copycat.cfg -d dst.txt\n"
-"  or:  copycat [OPTION...] -f -o copycat.cfg -d dst.txt\n\n"
+"  or:  copycat [OPTION...] -f -o copycat.cfg -d dst.txt\n"
+"  or:  copycat [-2|-6] -o copycat.cfg -C dst.txt -O dst.db\n\n"
 "forward tcp packets to/from a udp tunnel\n\n"
 
 "  -d, --dest-file FILE         Destination file\n"
 "  -o, --config FILE            Configuration file\n"
+"  -C, --compile-dest FILE      Compile a destination file to a database,\n"
+"                               used as -d FILE (same ports in copycat.cfg)\n"
+"  -O, --db-out FILE            Compiled destination database\n"
 "\n"
 "  -c, --client                 Client mode\n"
 "  -s, --server                 Server mode\n"
@@ -148,6 +153,10 @@ int parse_arg(int key, char *optarg, int optopt, struct arguments *args) {
          args->dest_file = optarg; break;
       case 'o':
          args->config_file = optarg; break;
+      case 'C':
+         args->compile_dest = optarg; break;
+      case 'O':
+         args->compile_out = optarg; break;
       case 'i':
          args->run_id = optarg; break;
       case '?':
@@ -181,6 +190,8 @@ void init_args(struct arguments *args) {
    args->dest_file   = NULL;
    args->run_id      = NULL;
    args->raw_header  = NULL;
+   args->compile_dest = NULL;
+   args->compile_out  = NULL;
 
    args->inactivity_timeout = 0;
 }
@@ -243,6 +254,15 @@ int validate_args(struct arguments *args) {
       die("set a configuration file (copycat.cfg)");
    } 
 
+   /* compile a destination file */
+   if (args->compile_dest) {
+      if (!args->compile_out) {
+         errno=EINVAL;
+         die("set a destination database (-O dest.db)");
+      }
+      return 0;
+   }
+
    switch (args->mode) {
       case FULLMESH_MODE:
       case CLI_MODE:
@@ -281,6 +301,12 @@ int main(int argc, char *argv[]) {
    validate_args(&args);
    if (args.verbose) print_args(&args);
 
+   if (args.compile_dest) {
+      if (compile_dest_db(&args) < 0)
+         die("destination database");
+      return 0;
+   }
+
    switch (args.mode) {
       case CLI_MODE:
          tun_cli(&args);
@@ -12,10 +12,23 @@
 
 /** 
  * \def BUFF_SIZE
- * \brief The size of the client and server buffers.
+ * \brief The default size of the packet buffers (buffer-length), and
+ *        of the buffers of the tcp clients and servers.
  */
 #define BUFF_SIZE 8192
 
+/** 
+ * \def TUNNEL_MTU
+ * \brief The default MTU of the path between tunnel endpoints (tunnel-mtu).
+ */
+#define TUNNEL_MTU 1500
+
+/** 
+ * \def MAX_PKT_SIZE
+ * \brief The maximal size of an IP packet, inner or outer.
+ */
+#define MAX_PKT_SIZE 65535
+
 /** 
  * \def STR_SIZE
  * \brief The maximal size of a location string.
@@ -95,9 +108,12 @@
 
 /**
  * \def LOCKED
- * \brief Comment to accept packets from nodes not in dest file.
+ * \brief Comment (or build with -DUNLOCKED) to accept packets from
+ *        nodes not in dest file.
  */
+#if !defined(UNLOCKED)
 #define LOCKED
+#endif
 
 /** 
  * \struct arguments
@@ -125,6 +141,9 @@ struct arguments {
    uint8_t inactivity_timeout; /*!< The inactivity timeout */
 
    char *run_id;               /*!< The run ID */
+
+   char *compile_dest;         /*!< The destination file to compile (-C) */
+   char *compile_out;          /*!< The compiled destination database (-O) */
 };
 
 #include "debug.h"
@@ -0,0 +1,204 @@
+/**
+ * \file watchdog.c
+ * \brief Event loop stall watchdog.
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "watchdog.h"
+#include "state.h"
+#include "thread.h"
+#include "stats.h"
+#include "debug.h"
+#include "udptun.h"
+
+/**
+ * \struct wd_watch
+ *	\brief The watchdog view of a loop.
+ */
+struct wd_watch {
+   uint64_t beat;               /*!< The last seen heartbeat */
+   uint64_t since;              /*!< When it was first seen (ns) */
+   uint32_t stage;              /*!< The stage of the ongoing stall */
+   uint8_t  stalled;            /*!< A stall is ongoing */
+};
+
+/**
+ * \var static struct wd_loop loops[WATCHDOG_MAX_LOOPS]
+ * \brief The monitored heartbeats.
+ */
+static struct wd_loop loops[WATCHDOG_MAX_LOOPS];
+
+/**
+ * \var static uint32_t nloops
+ * \brief The number of monitored loops.
+ */
+static uint32_t nloops;
+
+/**
+ * \var static pthread_mutex_t loops_lock
+ * \brief Protects loop registration.
+ */
+static pthread_mutex_t loops_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var static struct wd_loop wd_private
+ * \brief The heartbeat of unregistered threads.
+ */
+static struct wd_loop wd_private;
+
+__thread struct wd_loop *wd_local = &wd_private;
+
+/**
+ * \var static uint32_t threshold
+ * \brief The stall threshold (ms).
+ */
+static uint32_t threshold;
+
+/**
+ * \var static char file_loc[STR_SIZE]
+ * \brief The stall log location.
+ */
+static char file_loc[STR_SIZE];
+
+static const char *stage_names[WD_STAGES] = {
+   "idle", "tun_in", "net_out", "shutdown", "exit"
+};
+
+/**
+ * \fn static void *watchdog_thread(void *arg)
+ * \brief Sample the heartbeats every threshold/4 ms.
+ */
+static void *watchdog_thread(void *arg);
+
+/**
+ * \fn static void watchdog_log(FILE **fp, const struct wd_loop *loop,
+ *                              const struct wd_watch *w, uint64_t now)
+ * \brief Log the start (w->stalled == 1) or the end of a stall, open
+ *        the log on first stall.
+ */
+static void watchdog_log(FILE **fp, const struct wd_loop *loop,
+                         const struct wd_watch *w, uint64_t now);
+
+/**
+ * \fn static void watchdog_cleanup(void *arg)
+ * \brief Close the stall log on exit.
+ */
+static void watchdog_cleanup(void *arg);
+
+static inline uint64_t now_ns() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void watchdog_init(struct tun_state *state) {
+   if (!state->stall_threshold)
+      return;
+   threshold = state->stall_threshold;
+
+   if (state->args->run_id)
+      snprintf(file_loc, STR_SIZE, "%s%s.%s.txt", state->out_dir, WATCHDOG_FILE,
+               state->args->run_id);
+   else
+      snprintf(file_loc, STR_SIZE, "%s%s.txt", state->out_dir, WATCHDOG_FILE);
+
+   xthread_create(watchdog_thread, NULL, 1, "watchdog");
+   debug_print("stall watchdog, threshold %ums\n", threshold);
+}
+
+void watchdog_register(const char *name) {
+   pthread_mutex_lock(&loops_lock);
+   if (nloops < WATCHDOG_MAX_LOOPS) {
+      wd_local = &loops[nloops];
+      strncpy(wd_local->name, name, sizeof(wd_local->name) - 1);
+      __atomic_store_n(&nloops, nloops + 1, __ATOMIC_RELEASE);
+   }
+   pthread_mutex_unlock(&loops_lock);
+}
+
+void watchdog_log(FILE **fp, const struct wd_loop *loop,
+                  const struct wd_watch *w, uint64_t now) {
+   if (!*fp) {
+      *fp = fopen(file_loc, "w");
+      if (!*fp) {
+         perror(file_loc);
+         return;
+      }
+      fprintf(*fp, "# time loop stage event duration(ms)\n");
+   }
+
+   /* wall-clock time of the stall start */
+   struct timespec real;
+   clock_gettime(CLOCK_REALTIME, &real);
+   uint64_t t = real.tv_sec * 1000000000ULL + real.tv_nsec - (now - w->since);
+
+   if (w->stalled)
+      fprintf(*fp, "%lu.%06lu %s %s stall %lu\n", 
+              (unsigned long)(t / 1000000000), (unsigned long)(t % 1000000000) / 1000,
+              loop->name, stage_names[w->stage], (unsigned long)threshold);
+   else
+      fprintf(*fp, "%lu.%06lu %s %s resume %lu\n", 
+              (unsigned long)(t / 1000000000), (unsigned long)(t % 1000000000) / 1000,
+              loop->name, stage_names[w->stage], 
+              (unsigned long)((now - w->since) / 1000000));
+   fflush(*fp);
+}
+
+void watchdog_cleanup(void *arg) {
+   FILE **fp = arg;
+   if (*fp)
+      fclose(*fp);
+}
+
+void *watchdog_thread(void *UNUSED(arg)) {
+   struct wd_watch watch[WATCHDOG_MAX_LOOPS];
+   FILE *fp = NULL;
+   uint64_t period = threshold * 1000000ULL / 4;
+   if (period < 1000000)
+      period = 1000000;
+   struct timespec ts = {
+      .tv_sec  = period / 1000000000,
+      .tv_nsec = period % 1000000000,
+   };
+
+   memset(watch, 0, sizeof(watch));
+   stats_register("watchdog");
+   pthread_cleanup_push(watchdog_cleanup, &fp);
+   for (;;) {
+      nanosleep(&ts, NULL);
+      uint64_t now = now_ns();
+      uint32_t n = __atomic_load_n(&nloops, __ATOMIC_ACQUIRE);
+
+      for (uint32_t i = 0; i < n; i++) {
+         struct wd_watch *w = &watch[i];
+         uint64_t beat  = __atomic_load_n(&loops[i].beat, __ATOMIC_ACQUIRE);
+         uint32_t stage = __atomic_load_n(&loops[i].stage, __ATOMIC_RELAXED);
+         if (stage >= WD_STAGES)
+            stage = WD_IDLE;
+
+         /* progress, or waiting in select */
+         if (beat != w->beat || stage == WD_IDLE) {
+            if (w->stalled) {
+               w->stalled = 0;
+               watchdog_log(&fp, &loops[i], w, now);
+            }
+            w->beat  = beat;
+            w->since = now;
+         } else if (!w->stalled && now - w->since >= threshold * 1000000ULL) {
+            w->stalled = 1;
+            w->stage   = stage;
+            STATS_INC(ST_STALL);
+            watchdog_log(&fp, &loops[i], w, now);
+         }
+      }
+   }
+   pthread_cleanup_pop(0);
+   return NULL;
+}
+
@@ -0,0 +1,100 @@
+/**
+ * \file watchdog.h
+ * \brief Event loop stall watchdog.
+ *
+ *    Each forwarding loop publishes a heartbeat (a sequence number)
+ *    and the stage it is in. A watchdog thread samples the heartbeats
+ *    and reports a stall when a loop outside of select() makes no
+ *    progress for stall-threshold ms: the stall is counted in the
+ *    ST_STALL counter and logged with its stage and duration to
+ *    <out_dir>/stalls[.<run_id>].txt.
+ *
+ * \author k.edeline
+ * \version 0.1
+ */
+
+#ifndef UDPTUN_WATCHDOG_H
+#define UDPTUN_WATCHDOG_H
+
+#include <stdint.h>
+
+/**
+ * \def WATCHDOG_FILE
+ * \brief The stall log file name (in output directory).
+ */
+#define WATCHDOG_FILE "stalls"
+
+/**
+ * \def WATCHDOG_MAX_LOOPS
+ * \brief The maximal number of monitored loops.
+ */
+#define WATCHDOG_MAX_LOOPS 16
+
+/**
+ * \enum wd_stage
+ * \brief Event loop stages.
+ */
+enum wd_stage {
+   WD_IDLE = 0,      /*!< waiting in select(), never a stall */
+   WD_TUN_IN,        /*!< forwarding from tun to network */
+   WD_NET_OUT,       /*!< forwarding from network to tun */
+   WD_SHUTDOWN,      /*!< in the shutdown signal handler */
+   WD_EXIT,          /*!< in die() */
+   WD_STAGES         /*!< number of stages */
+};
+
+/**
+ * \struct wd_loop
+ *	\brief The heartbeat of a loop, on its own cache line.
+ */
+struct wd_loop {
+   uint64_t beat;               /*!< Incremented at each stage change */
+   uint32_t stage;              /*!< enum wd_stage */
+   char     name[16];           /*!< The loop name */
+} __attribute__((aligned(64)));
+
+/**
+ * \var extern __thread struct wd_loop *wd_local
+ * \brief The heartbeat of the calling thread. Points to a private
+ *        (unmonitored) block until the thread registers.
+ */
+extern __thread struct wd_loop *wd_local;
+
+/**
+ * \def WATCHDOG_BEAT(s)
+ * \brief Signal progress and enter stage s.
+ */
+#define WATCHDOG_BEAT(s) do { \
+      struct wd_loop *_wd = wd_local; \
+      __atomic_store_n(&_wd->stage, (s), __ATOMIC_RELAXED); \
+      __atomic_store_n(&_wd->beat, _wd->beat + 1, __ATOMIC_RELEASE); \
+   } while (0)
+
+/**
+ * \def WATCHDOG_STAGE(s)
+ * \brief Enter stage s without signaling progress (e.g. in signal
+ *        handlers or on exit paths).
+ */
+#define WATCHDOG_STAGE(s) \
+      __atomic_store_n(&wd_local->stage, (s), __ATOMIC_RELAXED)
+
+struct tun_state;
+
+/**
+ * \fn void watchdog_init(struct tun_state *state)
+ * \brief Start the watchdog thread if stall-threshold is set.
+ *
+ * \param state The program state
+ */
+void watchdog_init(struct tun_state *state);
+
+/**
+ * \fn void watchdog_register(const char *name)
+ * \brief Monitor the loop of the calling thread.
+ *
+ * \param name The loop name
+ */
+void watchdog_register(const char *name);
+
+#endif
+
@@ -146,28 +146,3 @@ void capture(const char *dev, const char *addr4, const char *addr6,
    pthread_cleanup_pop(0);
 }
 
-struct sock_fprog *gen_bpf(const char *dev, const char *addr, int sport, int dport) {
-   pcap_t *handle;		
-   char errbuf[PCAP_ERRBUF_SIZE];	
-   struct bpf_program *fp = xmalloc(sizeof(struct bpf_program));
-
-   /* build filter */
-   char filter_exp[64]; 
-   if (sport && dport)
-      sprintf(filter_exp, "src port %d and dst port %d", sport, dport);
-   else if (sport && !dport)
-      sprintf(filter_exp, "src port %d", sport);
-   else if (!sport && dport)
-      sprintf(filter_exp, "dst port %d", dport);
-
-   /* compile filter */
-   bpf_u_int32 net = inet_addr(addr);
-   handle = pcap_open_live(dev, BUFSIZ, 0, 1000, errbuf);
-   if (!handle) 
-      die("Couldn't open device %s: %s");
-   if (pcap_compile(handle, fp, filter_exp, 0, net) == -1) 
-      die("Couldn't parse filter %s: %s\n");
-
-   return (struct sock_fprog *)fp;
-}
-